@@ -0,0 +1,417 @@
+#include "allocator.h"
+
+#include "assert.h"
+#include "log.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Blocks aren't made bigger than this fraction of their heap
+#define ALLOCATOR_HEAP_FRACTION 8
+
+static inline uint32_t ceil_log2(VkDeviceSize value) { return value <= 1 ? 0 : 64 - __builtin_clzll(value - 1); }
+
+static inline bool bit_get(uint64_t *bits, uint64_t index) { return (bits[index / 64] >> (index % 64)) & 1; }
+static inline void bit_set(uint64_t *bits, uint64_t index) { bits[index / 64] |= 1ull << (index % 64); }
+static inline void bit_clear(uint64_t *bits, uint64_t index) { bits[index / 64] &= ~(1ull << (index % 64)); }
+
+static MemoryBlock *memory_block_create(Allocator *alloc, uint32_t memory_type, VkDeviceSize size) {
+    VkMemoryAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = memory_type;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(alloc->device, &alloc_info, NULL, &memory) != VK_SUCCESS) {
+        return NULL;
+    }
+
+    MemoryBlock *block = malloc(sizeof(MemoryBlock));
+    assert_alloc(block);
+    block->memory = memory;
+    block->size = size;
+    block->mapped = NULL;
+    block->used = 0;
+    block->max_order = ceil_log2(size);
+
+    if (alloc->memory_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vk_try(vkMapMemory(alloc->device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped), "Failed to map memory block");
+    }
+
+    uint32_t orders = block->max_order - ALLOCATOR_MIN_ORDER + 1;
+    block->free_bits = malloc(orders * sizeof(uint64_t *));
+    block->free_counts = calloc(orders, sizeof(uint32_t));
+    assert_alloc(block->free_bits);
+    assert_alloc(block->free_counts);
+    for (uint32_t i = 0; i < orders; i++) {
+        uint64_t nodes = size >> (i + ALLOCATOR_MIN_ORDER);
+        block->free_bits[i] = calloc((nodes + 63) / 64, sizeof(uint64_t));
+        assert_alloc(block->free_bits[i]);
+    }
+
+    // Only the root is free
+    bit_set(block->free_bits[orders - 1], 0);
+    block->free_counts[orders - 1] = 1;
+
+    return block;
+}
+
+static void memory_block_destroy(Allocator *alloc, MemoryBlock *block) {
+    uint32_t orders = block->max_order - ALLOCATOR_MIN_ORDER + 1;
+    for (uint32_t i = 0; i < orders; i++) {
+        free(block->free_bits[i]);
+    }
+    free(block->free_bits);
+    free(block->free_counts);
+    // Freeing the memory unmaps it
+    vkFreeMemory(alloc->device, block->memory, NULL);
+    free(block);
+}
+
+// Allocate a node of the given order, returns its offset, or -1 if the block has no room for it
+static int64_t memory_block_alloc(MemoryBlock *block, uint32_t order) {
+    // Smallest free node that is big enough
+    uint32_t k = order;
+    while (k <= block->max_order && block->free_counts[k - ALLOCATOR_MIN_ORDER] == 0) {
+        k++;
+    }
+    if (k > block->max_order) {
+        return -1;
+    }
+
+    uint64_t *bits = block->free_bits[k - ALLOCATOR_MIN_ORDER];
+    uint64_t index = 0;
+    while (bits[index / 64] == 0) {
+        index += 64;
+    }
+    index += __builtin_ctzll(bits[index / 64]);
+    bit_clear(bits, index);
+    block->free_counts[k - ALLOCATOR_MIN_ORDER]--;
+
+    // Split it down to the requested order, keeping the left half and freeing the right one
+    while (k > order) {
+        k--;
+        index *= 2;
+        bit_set(block->free_bits[k - ALLOCATOR_MIN_ORDER], index + 1);
+        block->free_counts[k - ALLOCATOR_MIN_ORDER]++;
+    }
+
+    block->used += 1ull << order;
+    return index << order;
+}
+
+static void memory_block_free(MemoryBlock *block, VkDeviceSize offset, uint32_t order) {
+    block->used -= 1ull << order;
+
+    // Merge with the buddy as long as it is free
+    uint64_t index = offset >> order;
+    while (order < block->max_order) {
+        uint64_t *bits = block->free_bits[order - ALLOCATOR_MIN_ORDER];
+        uint64_t buddy = index ^ 1;
+        if (!bit_get(bits, buddy)) {
+            break;
+        }
+        bit_clear(bits, buddy);
+        block->free_counts[order - ALLOCATOR_MIN_ORDER]--;
+        index /= 2;
+        order++;
+    }
+
+    bit_set(block->free_bits[order - ALLOCATOR_MIN_ORDER], index);
+    block->free_counts[order - ALLOCATOR_MIN_ORDER]++;
+}
+
+// Size of the largest free node of the block
+static VkDeviceSize memory_block_largest_free(MemoryBlock *block) {
+    for (uint32_t k = block->max_order + 1; k-- > ALLOCATOR_MIN_ORDER;) {
+        if (block->free_counts[k - ALLOCATOR_MIN_ORDER] > 0) {
+            return 1ull << k;
+        }
+    }
+    return 0;
+}
+
+Allocator allocator_init(VkPhysicalDevice physical_device, VkDevice device) {
+    Allocator res = {0};
+    res.device = device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &res.memory_props);
+
+    for (uint32_t i = 0; i < res.memory_props.memoryTypeCount; i++) {
+        VkDeviceSize heap_size = res.memory_props.memoryHeaps[res.memory_props.memoryTypes[i].heapIndex].size;
+        VkDeviceSize block_size = ALLOCATOR_BLOCK_SIZE;
+        while (block_size > heap_size / ALLOCATOR_HEAP_FRACTION && block_size > (1ull << 20)) {
+            block_size /= 2;
+        }
+
+        for (uint32_t t = 0; t < ALLOC_TILING_COUNT; t++) {
+            res.pools[i][t] = (MemoryPool){.blocks = NULL, .block_count = 0, .block_cap = 0, .block_size = block_size};
+        }
+    }
+
+    res.lock = malloc(sizeof(pthread_mutex_t));
+    assert_alloc(res.lock);
+    pthread_mutex_init(res.lock, NULL);
+
+    return res;
+}
+
+int64_t allocator_find_memory_type(
+    Allocator *alloc, uint32_t type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred
+) {
+    VkMemoryPropertyFlags wanted[] = {required | preferred, required};
+    for (uint32_t w = 0; w < 2; w++) {
+        for (uint32_t i = 0; i < alloc->memory_props.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags flags = alloc->memory_props.memoryTypes[i].propertyFlags;
+            if ((type_bits & (1u << i)) && (flags & wanted[w]) == wanted[w]) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+// Allocation with its own device memory, for those that wouldn't fit in a block
+static VkResult allocator_alloc_dedicated(Allocator *alloc, uint32_t memory_type, VkDeviceSize size, Allocation *res) {
+    VkMemoryAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = memory_type;
+
+    VkResult result = vkAllocateMemory(alloc->device, &alloc_info, NULL, &res->memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    res->offset = 0;
+    res->mapped = NULL;
+    res->block = NULL;
+    res->order = 0;
+    if (alloc->memory_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vk_try(vkMapMemory(alloc->device, res->memory, 0, VK_WHOLE_SIZE, 0, &res->mapped), "Failed to map memory");
+    }
+
+    alloc->dedicated_count++;
+    alloc->dedicated_size += size;
+    return VK_SUCCESS;
+}
+
+VkResult allocator_alloc(
+    Allocator *alloc,
+    const VkMemoryRequirements *requirements,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    AllocationTiling tiling,
+    Allocation *res
+) {
+    int64_t memory_type = allocator_find_memory_type(alloc, requirements->memoryTypeBits, required, preferred);
+    if (memory_type < 0) {
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    res->memory_type = memory_type;
+    res->tiling = tiling;
+    res->size = requirements->size;
+
+    // Nodes are aligned on their size within the block, and the block itself is suitably aligned for any resource
+    VkDeviceSize size = requirements->size > requirements->alignment ? requirements->size : requirements->alignment;
+    uint32_t order = ceil_log2(size);
+    if (order < ALLOCATOR_MIN_ORDER) {
+        order = ALLOCATOR_MIN_ORDER;
+    }
+
+    MemoryPool *pool = &alloc->pools[memory_type][tiling];
+    VkResult result = VK_SUCCESS;
+
+    pthread_mutex_lock(alloc->lock);
+
+    if ((1ull << order) > pool->block_size) {
+        result = allocator_alloc_dedicated(alloc, memory_type, requirements->size, res);
+    } else {
+        int64_t offset = -1;
+        MemoryBlock *block = NULL;
+        for (uint32_t i = 0; i < pool->block_count && offset < 0; i++) {
+            block = pool->blocks[i];
+            offset = memory_block_alloc(block, order);
+        }
+
+        if (offset < 0) {
+            block = memory_block_create(alloc, memory_type, pool->block_size);
+            if (block == NULL) {
+                result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+            } else {
+                if (pool->block_count == pool->block_cap) {
+                    pool->block_cap = pool->block_cap == 0 ? 4 : pool->block_cap * 2;
+                    pool->blocks = realloc(pool->blocks, pool->block_cap * sizeof(MemoryBlock *));
+                    assert_alloc(pool->blocks);
+                }
+                pool->blocks[pool->block_count++] = block;
+                offset = memory_block_alloc(block, order);
+            }
+        }
+
+        if (result == VK_SUCCESS) {
+            res->memory = block->memory;
+            res->offset = offset;
+            res->order = order;
+            res->block = block;
+            res->mapped = block->mapped != NULL ? (uint8_t *)block->mapped + offset : NULL;
+        }
+    }
+
+    if (result == VK_SUCCESS) {
+        alloc->requested += res->size;
+        alloc->allocations++;
+    }
+
+    pthread_mutex_unlock(alloc->lock);
+
+    return result;
+}
+
+void allocator_free(Allocator *alloc, Allocation *allocation) {
+    pthread_mutex_lock(alloc->lock);
+
+    alloc->requested -= allocation->size;
+    alloc->allocations--;
+
+    if (allocation->block == NULL) {
+        alloc->dedicated_count--;
+        alloc->dedicated_size -= allocation->size;
+        vkFreeMemory(alloc->device, allocation->memory, NULL);
+    } else {
+        MemoryBlock *block = allocation->block;
+        memory_block_free(block, allocation->offset, allocation->order);
+
+        // Give empty blocks back to the device, but keep one around to avoid thrashing
+        MemoryPool *pool = &alloc->pools[allocation->memory_type][allocation->tiling];
+        if (block->used == 0 && pool->block_count > 1) {
+            for (uint32_t i = 0; i < pool->block_count; i++) {
+                if (pool->blocks[i] == block) {
+                    pool->blocks[i] = pool->blocks[--pool->block_count];
+                    break;
+                }
+            }
+            memory_block_destroy(alloc, block);
+        }
+    }
+
+    pthread_mutex_unlock(alloc->lock);
+
+    *allocation = (Allocation){0};
+}
+
+VkResult allocator_bind_buffer(
+    Allocator *alloc, VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, Allocation *res
+) {
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(alloc->device, buffer, &requirements);
+
+    VkResult result = allocator_alloc(alloc, &requirements, required, preferred, AllocLinear, res);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    return vkBindBufferMemory(alloc->device, buffer, res->memory, res->offset);
+}
+
+VkResult allocator_bind_streaming_buffer(Allocator *alloc, VkBuffer buffer, Allocation *res) {
+    return allocator_bind_buffer(
+        alloc,
+        buffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        res
+    );
+}
+
+VkResult allocator_bind_image(
+    Allocator *alloc,
+    VkImage image,
+    VkImageTiling tiling,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    Allocation *res
+) {
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(alloc->device, image, &requirements);
+
+    AllocationTiling pool = tiling == VK_IMAGE_TILING_LINEAR ? AllocLinear : AllocOptimal;
+    VkResult result = allocator_alloc(alloc, &requirements, required, preferred, pool, res);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    return vkBindImageMemory(alloc->device, image, res->memory, res->offset);
+}
+
+AllocatorStats allocator_stats(Allocator *alloc) {
+    AllocatorStats res = {0};
+
+    pthread_mutex_lock(alloc->lock);
+
+    for (uint32_t i = 0; i < alloc->memory_props.memoryTypeCount; i++) {
+        for (uint32_t t = 0; t < ALLOC_TILING_COUNT; t++) {
+            MemoryPool *pool = &alloc->pools[i][t];
+            for (uint32_t b = 0; b < pool->block_count; b++) {
+                MemoryBlock *block = pool->blocks[b];
+                VkDeviceSize largest = memory_block_largest_free(block);
+                res.device_allocations++;
+                res.reserved += block->size;
+                res.allocated += block->used;
+                res.free += block->size - block->used;
+                if (largest > res.largest_free) {
+                    res.largest_free = largest;
+                }
+            }
+        }
+    }
+    res.device_allocations += alloc->dedicated_count;
+    res.reserved += alloc->dedicated_size;
+    res.allocated += alloc->dedicated_size;
+    res.requested = alloc->requested;
+    res.allocations = alloc->allocations;
+
+    pthread_mutex_unlock(alloc->lock);
+
+    return res;
+}
+
+void allocator_log_stats(Allocator *alloc) {
+    AllocatorStats stats = allocator_stats(alloc);
+    double mib = 1.0 / (1 << 20);
+    // Internal: lost to rounding up to powers of two, external: free memory that can't be handed out in one piece
+    double internal = stats.allocated > 0 ? 1.0 - (double)stats.requested / stats.allocated : 0.0;
+    double external = stats.free > 0 ? 1.0 - (double)stats.largest_free / stats.free : 0.0;
+
+    log_info(
+        "Device memory: %u allocations in %u device allocations, %.2f MiB reserved, %.2f MiB allocated, %.2f MiB requested",
+        stats.allocations,
+        stats.device_allocations,
+        stats.reserved * mib,
+        stats.allocated * mib,
+        stats.requested * mib
+    );
+    log_info("    fragmentation: %.1f%% internal, %.1f%% external", internal * 100.0, external * 100.0);
+}
+
+void allocator_drop(Allocator alloc) {
+    if (alloc.allocations > 0) {
+        log_warn("%u allocations leaked", alloc.allocations);
+    }
+
+    for (uint32_t i = 0; i < alloc.memory_props.memoryTypeCount; i++) {
+        for (uint32_t t = 0; t < ALLOC_TILING_COUNT; t++) {
+            MemoryPool *pool = &alloc.pools[i][t];
+            for (uint32_t b = 0; b < pool->block_count; b++) {
+                memory_block_destroy(&alloc, pool->blocks[b]);
+            }
+            free(pool->blocks);
+        }
+    }
+
+    pthread_mutex_destroy(alloc.lock);
+    free(alloc.lock);
+}
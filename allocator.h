@@ -0,0 +1,119 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Default size of the blocks of device memory allocations are carved from (smaller on small heaps)
+#define ALLOCATOR_BLOCK_SIZE (64ull << 20)
+// Smallest allocation handed out (allocations are rounded up to a power of two at least as big)
+#define ALLOCATOR_MIN_ORDER 8
+
+// Linear (buffers, linear images) and optimal (optimal tiling images) resources live in separate pools, so that they
+// never share a bufferImageGranularity page.
+typedef enum {
+    AllocLinear,
+    AllocOptimal,
+    ALLOC_TILING_COUNT,
+} AllocationTiling;
+
+// A block of device memory, split between allocations with a buddy scheme: each free node at a given order can be
+// split in two buddies of the order below, which are merged back when both are free.
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    // Persistently mapped memory (NULL if the memory type isn't host visible)
+    void *mapped;
+    uint32_t max_order;
+    // Per order (starting at ALLOCATOR_MIN_ORDER): bitmap of the free nodes and their count
+    uint64_t **free_bits;
+    uint32_t *free_counts;
+    VkDeviceSize used;
+} MemoryBlock;
+
+typedef struct {
+    MemoryBlock **blocks;
+    uint32_t block_count;
+    uint32_t block_cap;
+    VkDeviceSize block_size;
+} MemoryPool;
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Pointer to the start of the allocation if its memory is host visible, NULL otherwise
+    void *mapped;
+
+    uint32_t memory_type;
+    AllocationTiling tiling;
+    uint32_t order;
+    // NULL for dedicated allocations (bigger than a block)
+    MemoryBlock *block;
+} Allocation;
+
+typedef struct {
+    // Number of vkAllocateMemory that are alive
+    uint32_t device_allocations;
+    uint32_t allocations;
+    // Memory allocated from the device, and the part of it handed out (rounded up, and as requested)
+    VkDeviceSize reserved;
+    VkDeviceSize allocated;
+    VkDeviceSize requested;
+    // Largest allocation that can be made without a new block, and the memory free in the blocks
+    VkDeviceSize largest_free;
+    VkDeviceSize free;
+} AllocatorStats;
+
+// Sub-allocates device memory from large blocks, one set of pools per memory type. Thread safe.
+typedef struct {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_props;
+    MemoryPool pools[VK_MAX_MEMORY_TYPES][ALLOC_TILING_COUNT];
+    // Dedicated allocations
+    uint32_t dedicated_count;
+    VkDeviceSize dedicated_size;
+    VkDeviceSize requested;
+    uint32_t allocations;
+    pthread_mutex_t *lock;
+} Allocator;
+
+Allocator allocator_init(VkPhysicalDevice physical_device, VkDevice device);
+// Find a memory type allowed by type_bits that has all the required properties, favoring the ones that also have the
+// preferred properties. Returns -1 if there is none.
+int64_t allocator_find_memory_type(
+    Allocator *alloc, uint32_t type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred
+);
+// Allocate memory fulfilling requirements, returns VK_ERROR_OUT_OF_DEVICE_MEMORY if no memory type fits
+VkResult allocator_alloc(
+    Allocator *alloc,
+    const VkMemoryRequirements *requirements,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    AllocationTiling tiling,
+    Allocation *res
+);
+void allocator_free(Allocator *alloc, Allocation *allocation);
+// Allocate and bind memory for a buffer (linear) or an image (according to its tiling)
+VkResult allocator_bind_buffer(
+    Allocator *alloc, VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, Allocation *res
+);
+// Allocate and bind mapped memory for a buffer the CPU writes every frame and the GPU reads once: device local if it
+// can be mapped (resizable BAR), so that the GPU doesn't read it over the bus
+VkResult allocator_bind_streaming_buffer(Allocator *alloc, VkBuffer buffer, Allocation *res);
+VkResult allocator_bind_image(
+    Allocator *alloc,
+    VkImage image,
+    VkImageTiling tiling,
+    VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred,
+    Allocation *res
+);
+AllocatorStats allocator_stats(Allocator *alloc);
+void allocator_log_stats(Allocator *alloc);
+// Free every block, all the allocations must have been freed
+void allocator_drop(Allocator alloc);
+
+#endif
@@ -0,0 +1,164 @@
+#include "bindless.h"
+
+#include "assert.h"
+#include "log.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vulkan/vulkan.h>
+
+bool bindless_supported(const VkPhysicalDeviceVulkan12Features *features) {
+    return features->runtimeDescriptorArray && features->descriptorBindingPartiallyBound &&
+           features->descriptorBindingUpdateUnusedWhilePending && features->descriptorBindingSampledImageUpdateAfterBind &&
+           features->descriptorBindingStorageBufferUpdateAfterBind;
+}
+
+void bindless_enable(VkPhysicalDeviceVulkan12Features *features) {
+    features->runtimeDescriptorArray = VK_TRUE;
+    features->descriptorBindingPartiallyBound = VK_TRUE;
+    features->descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    features->descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    features->descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+}
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+BindlessTable bindless_table_init(VkPhysicalDevice physical_device, VkDevice device, VkShaderStageFlags stages) {
+    BindlessTable res = {0};
+    res.device = device;
+
+    VkPhysicalDeviceDescriptorIndexingProperties indexing_props = {0};
+    indexing_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+    VkPhysicalDeviceProperties2 props = {0};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &indexing_props;
+    vkGetPhysicalDeviceProperties2(physical_device, &props);
+
+    // Both arrays count towards the per stage resource limit
+    uint32_t resources = indexing_props.maxPerStageUpdateAfterBindResources;
+    res.texture_cap = min_u32(BINDLESS_MAX_TEXTURES, indexing_props.maxPerStageDescriptorUpdateAfterBindSampledImages);
+    res.texture_cap = min_u32(res.texture_cap, indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers);
+    res.texture_cap = min_u32(res.texture_cap, indexing_props.maxDescriptorSetUpdateAfterBindSampledImages);
+    res.texture_cap = min_u32(res.texture_cap, indexing_props.maxDescriptorSetUpdateAfterBindSamplers);
+    res.texture_cap = min_u32(res.texture_cap, resources / 2);
+    res.buffer_cap = min_u32(BINDLESS_MAX_BUFFERS, indexing_props.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+    res.buffer_cap = min_u32(res.buffer_cap, indexing_props.maxDescriptorSetUpdateAfterBindStorageBuffers);
+    res.buffer_cap = min_u32(res.buffer_cap, resources - res.texture_cap);
+
+    VkDescriptorSetLayoutBinding bindings[2] = {0};
+    bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = res.texture_cap;
+    bindings[0].stageFlags = stages;
+    bindings[1].binding = BINDLESS_BUFFER_BINDING;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = res.buffer_cap;
+    bindings[1].stageFlags = stages;
+
+    // Slots that are never written are never read, and slots can be written while others are in use
+    const VkDescriptorBindingFlags binding_flags[2] = {
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_create_info = {0};
+    flags_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_create_info.bindingCount = 2;
+    flags_create_info.pBindingFlags = binding_flags;
+
+    VkDescriptorSetLayoutCreateInfo layout_create_info = {0};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_create_info.pNext = &flags_create_info;
+    layout_create_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layout_create_info.bindingCount = 2;
+    layout_create_info.pBindings = bindings;
+    vk_try(vkCreateDescriptorSetLayout(device, &layout_create_info, NULL, &res.layout), "Failed to create bindless set layout");
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, res.texture_cap},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, res.buffer_cap},
+    };
+    VkDescriptorPoolCreateInfo pool_create_info = {0};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_create_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_create_info.maxSets = 1;
+    pool_create_info.poolSizeCount = 2;
+    pool_create_info.pPoolSizes = pool_sizes;
+    vk_try(vkCreateDescriptorPool(device, &pool_create_info, NULL, &res.pool), "Failed to create bindless descriptor pool");
+
+    VkDescriptorSetAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = res.pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &res.layout;
+    vk_try(vkAllocateDescriptorSets(device, &alloc_info, &res.set), "Failed to allocate bindless descriptor set");
+
+    log_info("Bindless resources: %u textures, %u buffers", res.texture_cap, res.buffer_cap);
+    return res;
+}
+
+uint32_t bindless_table_add_texture(BindlessTable *table, VkImageView view, VkSampler sampler) {
+    assert(table->texture_count < table->texture_cap, "Bindless texture array full (%u textures)", table->texture_cap);
+    uint32_t index = table->texture_count++;
+
+    VkDescriptorImageInfo image_info = {0};
+    image_info.sampler = sampler;
+    image_info.imageView = view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = table->set;
+    write.dstBinding = BINDLESS_TEXTURE_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(table->device, 1, &write, 0, NULL);
+
+    return index;
+}
+
+uint32_t bindless_table_add_buffer(BindlessTable *table, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    assert(table->buffer_count < table->buffer_cap, "Bindless buffer array full (%u buffers)", table->buffer_cap);
+    uint32_t index = table->buffer_count++;
+
+    VkDescriptorBufferInfo buffer_info = {.buffer = buffer, .offset = offset, .range = range};
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = table->set;
+    write.dstBinding = BINDLESS_BUFFER_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(table->device, 1, &write, 0, NULL);
+
+    return index;
+}
+
+void bindless_table_bind(
+    BindlessTable *table, VkCommandBuffer buffer, VkPipelineBindPoint bind_point, VkPipelineLayout layout, uint32_t set
+) {
+    vkCmdBindDescriptorSets(buffer, bind_point, layout, set, 1, &table->set, 0, NULL);
+    table->binds++;
+}
+
+void bindless_table_log_stats(BindlessTable *table) {
+    log_info(
+        "Bindless resources: %u/%u textures, %u/%u buffers, %lu set binds",
+        table->texture_count,
+        table->texture_cap,
+        table->buffer_count,
+        table->buffer_cap,
+        (unsigned long)table->binds
+    );
+}
+
+void bindless_table_drop(BindlessTable table) {
+    // Frees the set
+    vkDestroyDescriptorPool(table.device, table.pool, NULL);
+    vkDestroyDescriptorSetLayout(table.device, table.layout, NULL);
+}
@@ -0,0 +1,52 @@
+#ifndef BINDLESS_H
+#define BINDLESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Slots of each array, lowered to the device's update after bind limits
+#define BINDLESS_MAX_TEXTURES 16384
+#define BINDLESS_MAX_BUFFERS 4096
+// Bindings of the set: combined image samplers, and storage buffers
+#define BINDLESS_TEXTURE_BINDING 0
+#define BINDLESS_BUFFER_BINDING 1
+
+// A single descriptor set holding every texture and buffer shaders can reach, indexed by values passed in push
+// constants. Its arrays are partially bound and updated after bind: slots are written as resources are added, even
+// while the set is in use, and the set is bound once per command buffer whatever the draws use.
+typedef struct {
+    VkDevice device;
+    // Owned by the table (the layout cache doesn't know about binding flags)
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+
+    uint32_t texture_cap;
+    uint32_t texture_count;
+    uint32_t buffer_cap;
+    uint32_t buffer_count;
+    // Set binds since the table was created
+    uint64_t binds;
+} BindlessTable;
+
+// Whether the device supports the descriptor indexing features the table needs
+bool bindless_supported(const VkPhysicalDeviceVulkan12Features *features);
+// Enable the features the table needs, which must be supported
+void bindless_enable(VkPhysicalDeviceVulkan12Features *features);
+// stages are the shader stages the resources are visible to
+BindlessTable bindless_table_init(VkPhysicalDevice physical_device, VkDevice device, VkShaderStageFlags stages);
+// Write a texture to the next slot, returns its index in the array. The view must be in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL by the time it is sampled, and outlive the table.
+uint32_t bindless_table_add_texture(BindlessTable *table, VkImageView view, VkSampler sampler);
+// Write a storage buffer range to the next slot, returns its index in the array. The buffer must outlive the table.
+uint32_t bindless_table_add_buffer(BindlessTable *table, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+// Bind the set (as set number set of layout), once per command buffer
+void bindless_table_bind(
+    BindlessTable *table, VkCommandBuffer buffer, VkPipelineBindPoint bind_point, VkPipelineLayout layout, uint32_t set
+);
+void bindless_table_log_stats(BindlessTable *table);
+// The set mustn't be in use by the device anymore
+void bindless_table_drop(BindlessTable table);
+
+#endif
@@ -0,0 +1,211 @@
+#include "culling.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "descriptors.h"
+#include "mesh.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+__attribute__((aligned(4))) static const uint8_t CULL_SHADER[] = {
+#include "include/cull.comp.spv.bytes"
+};
+static const size_t CULL_SHADER_LEN = sizeof(CULL_SHADER) / sizeof(uint8_t);
+
+Culler culler_init(
+    VkDevice device,
+    VkPipelineCache pipeline_cache,
+    DescriptorLayoutCache *layouts,
+    bool draw_indirect_count,
+    uint32_t max_draw_count
+) {
+    Culler res = {0};
+    res.device = device;
+    res.draw_indirect_count = draw_indirect_count;
+    res.max_draw_count = max_draw_count;
+    res.descriptors = descriptor_allocator_init(device, 1);
+
+    // Instances read, draws written
+    VkDescriptorSetLayoutBinding bindings[2] = {0};
+    for (uint32_t i = 0; i < 2; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    res.set_layout = descriptor_layout_cache_get(layouts, bindings, 2);
+
+    VkPushConstantRange push_constants = {0};
+    push_constants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constants.offset = 0;
+    push_constants.size = sizeof(CullParams);
+
+    VkPipelineLayoutCreateInfo layout_create_info = {0};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_create_info.setLayoutCount = 1;
+    layout_create_info.pSetLayouts = &res.set_layout;
+    layout_create_info.pushConstantRangeCount = 1;
+    layout_create_info.pPushConstantRanges = &push_constants;
+    vk_try(
+        vkCreatePipelineLayout(device, &layout_create_info, NULL, &res.pipeline_layout),
+        "Failed to create culling pipeline layout"
+    );
+
+    VkShaderModuleCreateInfo module_create_info = {0};
+    module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_create_info.codeSize = CULL_SHADER_LEN;
+    module_create_info.pCode = (const uint32_t *)CULL_SHADER;
+    VkShaderModule module;
+    vk_try(vkCreateShaderModule(device, &module_create_info, NULL, &module), "Failed to create culling shader module");
+
+    VkComputePipelineCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    create_info.stage.module = module;
+    create_info.stage.pName = "main";
+    create_info.layout = res.pipeline_layout;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+    vk_try(
+        vkCreateComputePipelines(device, pipeline_cache, 1, &create_info, NULL, &res.pipeline),
+        "Failed to create culling pipeline"
+    );
+
+    vkDestroyShaderModule(device, module, NULL);
+
+    return res;
+}
+
+static void culler_destroy_buffers(Culler *culler, Allocator *allocator) {
+    for (uint32_t i = 0; i < culler->buffer_count; i++) {
+        vkDestroyBuffer(culler->device, culler->draw_buffers[i], NULL);
+        allocator_free(allocator, &culler->draw_allocations[i]);
+    }
+    descriptor_allocator_reset(&culler->descriptors, 0);
+    free(culler->draw_buffers);
+    free(culler->draw_allocations);
+    free(culler->sets);
+    culler->buffer_count = 0;
+}
+
+void culler_set_buffers(
+    Culler *culler, Allocator *allocator, const VkBuffer *instance_buffers, uint32_t buffer_count, uint32_t max_draws
+) {
+    assert(
+        max_draws <= culler->max_draw_count,
+        "Can't draw %u instances indirectly (the limit is %u)",
+        max_draws,
+        culler->max_draw_count
+    );
+
+    culler_destroy_buffers(culler, allocator);
+    culler->buffer_count = buffer_count;
+    culler->max_draws = max_draws;
+    culler->draw_buffers = malloc(buffer_count * sizeof(VkBuffer));
+    culler->draw_allocations = malloc(buffer_count * sizeof(Allocation));
+    culler->sets = malloc(buffer_count * sizeof(VkDescriptorSet));
+    assert_alloc(culler->draw_buffers);
+    assert_alloc(culler->draw_allocations);
+    assert_alloc(culler->sets);
+
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = CULL_COMMANDS_OFFSET + (VkDeviceSize)max_draws * sizeof(VkDrawIndexedIndirectCommand);
+    create_info.usage =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        vk_try(vkCreateBuffer(culler->device, &create_info, NULL, &culler->draw_buffers[i]), "Failed to create draw buffer");
+        // Only ever touched by the device
+        vk_try(
+            allocator_bind_buffer(
+                allocator, culler->draw_buffers[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler->draw_allocations[i]
+            ),
+            "Failed to allocate draw buffer memory"
+        );
+    }
+
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        culler->sets[i] = descriptor_allocator_alloc(&culler->descriptors, 0, culler->set_layout);
+
+        VkDescriptorBufferInfo buffer_infos[2] = {
+            {.buffer = instance_buffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+            {.buffer = culler->draw_buffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+        };
+        VkWriteDescriptorSet writes[2] = {0};
+        for (uint32_t j = 0; j < 2; j++) {
+            writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[j].dstSet = culler->sets[i];
+            writes[j].dstBinding = j;
+            writes[j].descriptorCount = 1;
+            writes[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[j].pBufferInfo = &buffer_infos[j];
+        }
+        vkUpdateDescriptorSets(culler->device, 2, writes, 0, NULL);
+    }
+}
+
+void culler_record(
+    Culler *culler, VkCommandBuffer buffer, uint32_t index, const Mesh *mesh, const float planes[CULL_PLANE_COUNT][4]
+) {
+    VkBuffer draws = culler->draw_buffers[index];
+
+    // The draws of the previous submission using this buffer (cached command buffers are submitted again while the
+    // last submission can still be running) must be done before they are overwritten
+    vkCmdPipelineBarrier(
+        buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL
+    );
+    if (culler->draw_indirect_count) {
+        vkCmdFillBuffer(buffer, draws, 0, sizeof(uint32_t), 0);
+    }
+
+    VkMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL
+    );
+
+    CullParams params = {0};
+    memcpy(params.planes, planes, sizeof(params.planes));
+    params.radius = mesh->radius;
+    params.index_count = mesh->index_count;
+    params.instance_count = culler->max_draws;
+    params.compact = culler->draw_indirect_count;
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culler->pipeline);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culler->pipeline_layout, 0, 1, &culler->sets[index], 0, NULL);
+    vkCmdPushConstants(buffer, culler->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullParams), &params);
+    vkCmdDispatch(buffer, (culler->max_draws + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(
+        buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, NULL, 0, NULL
+    );
+}
+
+void culler_draw(Culler *culler, VkCommandBuffer buffer, uint32_t index) {
+    VkBuffer draws = culler->draw_buffers[index];
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    if (culler->draw_indirect_count) {
+        vkCmdDrawIndexedIndirectCount(buffer, draws, CULL_COMMANDS_OFFSET, draws, 0, culler->max_draws, stride);
+    } else {
+        vkCmdDrawIndexedIndirect(buffer, draws, CULL_COMMANDS_OFFSET, culler->max_draws, stride);
+    }
+}
+
+void culler_drop(Culler culler, Allocator *allocator) {
+    culler_destroy_buffers(&culler, allocator);
+    vkDestroyPipeline(culler.device, culler.pipeline, NULL);
+    vkDestroyPipelineLayout(culler.device, culler.pipeline_layout, NULL);
+    descriptor_allocator_drop(culler.descriptors);
+}
@@ -0,0 +1,76 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "allocator.h"
+#include "descriptors.h"
+#include "mesh.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Planes bounding the view (the scene is flat, so there is no near or far plane)
+#define CULL_PLANE_COUNT 4
+// Instances culled by a compute workgroup (local_size_x of cull.comp)
+#define CULL_GROUP_SIZE 64
+// Offset of the commands in the draw buffers, after the draw count
+#define CULL_COMMANDS_OFFSET sizeof(uint32_t)
+
+// Push constants of cull.comp
+typedef struct {
+    // Inward facing planes (normal xyz, distance w), a sphere is culled once it is entirely behind one
+    float planes[CULL_PLANE_COUNT][4];
+    float radius;
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t compact;
+} CullParams;
+
+// Culls the instances of a mesh against the view on the GPU, and writes an indirect draw per visible instance. Each
+// buffer of instances has its own draw buffer (and descriptor set), holding the draw count followed by the
+// VkDrawIndexedIndirectCommands.
+typedef struct {
+    VkDevice device;
+    // Visible instances are packed and counted, and drawn with vkCmdDrawIndexedIndirectCount. Otherwise every
+    // instance keeps its command (with no instance if culled), and they are all drawn.
+    bool draw_indirect_count;
+    uint32_t max_draw_count;
+    // Owned by the layout cache
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+
+    // One per instance buffer
+    uint32_t buffer_count;
+    uint32_t max_draws;
+    VkBuffer *draw_buffers;
+    Allocation *draw_allocations;
+    // The sets live as long as the buffers, they are allocated again (after a reset) when the buffers change
+    DescriptorAllocator descriptors;
+    VkDescriptorSet *sets;
+} Culler;
+
+// max_draw_count is the device's limit on the draws of an indirect draw call
+Culler culler_init(
+    VkDevice device,
+    VkPipelineCache pipeline_cache,
+    DescriptorLayoutCache *layouts,
+    bool draw_indirect_count,
+    uint32_t max_draw_count
+);
+// (Re)create the draw buffers, for buffer_count buffers of max_draws instances (one draw each). The previous ones
+// mustn't be in use by the device anymore.
+void culler_set_buffers(
+    Culler *culler, Allocator *allocator, const VkBuffer *instance_buffers, uint32_t buffer_count, uint32_t max_draws
+);
+// Record the culling of the instances of a buffer, outside of a render pass. The draws are ready for the draw indirect
+// stage once it is done.
+void culler_record(
+    Culler *culler, VkCommandBuffer buffer, uint32_t index, const Mesh *mesh, const float planes[CULL_PLANE_COUNT][4]
+);
+// Record the draws written by the last culling of a buffer, with the mesh and instances already bound
+void culler_draw(Culler *culler, VkCommandBuffer buffer, uint32_t index);
+// The buffers mustn't be in use by the device anymore
+void culler_drop(Culler culler, Allocator *allocator);
+
+#endif
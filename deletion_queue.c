@@ -0,0 +1,68 @@
+#include "deletion_queue.h"
+
+#include "assert.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+static void deferred_object_destroy(VkDevice device, DeferredObject *obj) {
+    switch (obj->kind) {
+    case DeferredFramebuffer:
+        vkDestroyFramebuffer(device, obj->framebuffer, NULL);
+        break;
+    case DeferredImageView:
+        vkDestroyImageView(device, obj->image_view, NULL);
+        break;
+    case DeferredSwapchain:
+        vkDestroySwapchainKHR(device, obj->swapchain, NULL);
+        break;
+    case DeferredCommandBuffer:
+        vkFreeCommandBuffers(device, obj->command_buffer.pool, 1, &obj->command_buffer.buffer);
+        break;
+    case DeferredQueryPool:
+        vkDestroyQueryPool(device, obj->query_pool, NULL);
+        break;
+    case DeferredSemaphore:
+        vkDestroySemaphore(device, obj->semaphore, NULL);
+        break;
+    }
+}
+
+DeletionQueue deletion_queue_init() { return (DeletionQueue){.objects = NULL, .len = 0, .cap = 0}; }
+
+void deletion_queue_push(DeletionQueue *queue, uint64_t frame, DeferredObject obj) {
+    debug_assert(queue->len == 0 || queue->objects[queue->len - 1].frame <= frame, "Objects must be queued in frame order");
+
+    if (queue->len == queue->cap) {
+        queue->cap = queue->cap == 0 ? 16 : queue->cap * 2;
+        queue->objects = realloc(queue->objects, queue->cap * sizeof(DeferredObject));
+        assert_alloc(queue->objects);
+    }
+
+    obj.frame = frame;
+    queue->objects[queue->len++] = obj;
+}
+
+void deletion_queue_flush(DeletionQueue *queue, VkDevice device, uint64_t completed_frame) {
+    uint32_t count = 0;
+    while (count < queue->len && queue->objects[count].frame <= completed_frame) {
+        deferred_object_destroy(device, &queue->objects[count]);
+        count++;
+    }
+
+    if (count > 0) {
+        log_trace("Destroyed %u deferred objects", count);
+        memmove(queue->objects, queue->objects + count, (queue->len - count) * sizeof(DeferredObject));
+        queue->len -= count;
+    }
+}
+
+void deletion_queue_drop(DeletionQueue queue, VkDevice device) {
+    for (uint32_t i = 0; i < queue.len; i++) {
+        deferred_object_destroy(device, &queue.objects[i]);
+    }
+    free(queue.objects);
+}
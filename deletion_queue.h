@@ -0,0 +1,49 @@
+#ifndef DELETION_QUEUE_H
+#define DELETION_QUEUE_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+typedef enum {
+    DeferredFramebuffer,
+    DeferredImageView,
+    DeferredSwapchain,
+    DeferredCommandBuffer,
+    DeferredQueryPool,
+    DeferredSemaphore,
+} DeferredKind;
+
+// A vulkan object waiting for the frames using it to complete before being destroyed
+typedef struct {
+    DeferredKind kind;
+    // Last frame that can use the object
+    uint64_t frame;
+    union {
+        VkFramebuffer framebuffer;
+        VkImageView image_view;
+        VkSwapchainKHR swapchain;
+        VkQueryPool query_pool;
+        VkSemaphore semaphore;
+        struct {
+            VkCommandPool pool;
+            VkCommandBuffer buffer;
+        } command_buffer;
+    };
+} DeferredObject;
+
+// Objects are queued in frame order, and destroyed once their frame has completed
+typedef struct {
+    DeferredObject *objects;
+    uint32_t len;
+    uint32_t cap;
+} DeletionQueue;
+
+DeletionQueue deletion_queue_init();
+// Queue obj for destruction once frame (and every frame before it) has completed
+void deletion_queue_push(DeletionQueue *queue, uint64_t frame, DeferredObject obj);
+// Destroy the objects of the frames up to completed_frame
+void deletion_queue_flush(DeletionQueue *queue, VkDevice device, uint64_t completed_frame);
+// Destroy every queued object, the device must be idle
+void deletion_queue_drop(DeletionQueue queue, VkDevice device);
+
+#endif
@@ -0,0 +1,211 @@
+#include "descriptors.h"
+
+#include "assert.h"
+#include "log.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Descriptors per set of each type in a pool
+static const VkDescriptorPoolSize POOL_RATIOS[] = {
+    {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 1},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+    {VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1},
+};
+static const uint32_t POOL_RATIO_COUNT = sizeof(POOL_RATIOS) / sizeof(VkDescriptorPoolSize);
+
+// FNV-1a
+static inline uint64_t hash_u32(uint64_t hash, uint32_t value) {
+    for (uint32_t i = 0; i < 4; i++) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+DescriptorLayoutCache descriptor_layout_cache_init(VkDevice device) {
+    DescriptorLayoutCache res = {0};
+    res.device = device;
+    return res;
+}
+
+VkDescriptorSetLayout descriptor_layout_cache_get(
+    DescriptorLayoutCache *cache, const VkDescriptorSetLayoutBinding *bindings, uint32_t binding_count
+) {
+    assert(binding_count <= DESCRIPTOR_MAX_BINDINGS, "Too many bindings for a cached set layout (%u)", binding_count);
+
+    DescriptorLayoutEntry entry = {0};
+    entry.binding_count = binding_count;
+    // Insertion sort by binding number, so that the order bindings are given in doesn't matter
+    for (uint32_t i = 0; i < binding_count; i++) {
+        assert(bindings[i].pImmutableSamplers == NULL, "Immutable samplers aren't supported by the set layout cache");
+        uint32_t j = i;
+        while (j > 0 && entry.bindings[j - 1].binding > bindings[i].binding) {
+            entry.bindings[j] = entry.bindings[j - 1];
+            j--;
+        }
+        entry.bindings[j] = bindings[i];
+    }
+
+    entry.hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < binding_count; i++) {
+        entry.hash = hash_u32(entry.hash, entry.bindings[i].binding);
+        entry.hash = hash_u32(entry.hash, entry.bindings[i].descriptorType);
+        entry.hash = hash_u32(entry.hash, entry.bindings[i].descriptorCount);
+        entry.hash = hash_u32(entry.hash, entry.bindings[i].stageFlags);
+    }
+
+    for (uint32_t i = 0; i < cache->count; i++) {
+        DescriptorLayoutEntry *cached = &cache->entries[i];
+        if (cached->hash == entry.hash && cached->binding_count == binding_count &&
+            memcmp(cached->bindings, entry.bindings, binding_count * sizeof(VkDescriptorSetLayoutBinding)) == 0) {
+            cache->hits++;
+            return cached->layout;
+        }
+    }
+
+    VkDescriptorSetLayoutCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    create_info.bindingCount = binding_count;
+    create_info.pBindings = entry.bindings;
+    vk_try(
+        vkCreateDescriptorSetLayout(cache->device, &create_info, NULL, &entry.layout), "Failed to create descriptor set layout"
+    );
+
+    if (cache->count == cache->cap) {
+        cache->cap = cache->cap == 0 ? 8 : cache->cap * 2;
+        cache->entries = realloc(cache->entries, cache->cap * sizeof(DescriptorLayoutEntry));
+        assert_alloc(cache->entries);
+    }
+    cache->entries[cache->count++] = entry;
+
+    return entry.layout;
+}
+
+void descriptor_layout_cache_drop(DescriptorLayoutCache cache) {
+    for (uint32_t i = 0; i < cache.count; i++) {
+        vkDestroyDescriptorSetLayout(cache.device, cache.entries[i].layout, NULL);
+    }
+    free(cache.entries);
+}
+
+static VkDescriptorPool descriptor_allocator_create_pool(DescriptorAllocator *alloc, uint32_t sets) {
+    VkDescriptorPoolSize sizes[sizeof(POOL_RATIOS) / sizeof(VkDescriptorPoolSize)];
+    for (uint32_t i = 0; i < POOL_RATIO_COUNT; i++) {
+        sizes[i].type = POOL_RATIOS[i].type;
+        sizes[i].descriptorCount = POOL_RATIOS[i].descriptorCount * sets;
+    }
+
+    VkDescriptorPoolCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    create_info.maxSets = sets;
+    create_info.poolSizeCount = POOL_RATIO_COUNT;
+    create_info.pPoolSizes = sizes;
+
+    VkDescriptorPool pool;
+    vk_try(vkCreateDescriptorPool(alloc->device, &create_info, NULL, &pool), "Failed to create descriptor pool");
+    alloc->stats.pools++;
+    alloc->stats.capacity += sets;
+    return pool;
+}
+
+static void descriptor_allocator_create_frames(DescriptorAllocator *alloc) {
+    alloc->frames = malloc(alloc->frame_count * sizeof(DescriptorFramePools));
+    assert_alloc(alloc->frames);
+    for (uint32_t i = 0; i < alloc->frame_count; i++) {
+        alloc->frames[i] = (DescriptorFramePools){0};
+    }
+}
+
+static void descriptor_allocator_destroy_frames(DescriptorAllocator *alloc) {
+    for (uint32_t i = 0; i < alloc->frame_count; i++) {
+        DescriptorFramePools *frame = &alloc->frames[i];
+        for (uint32_t j = 0; j < frame->count; j++) {
+            vkDestroyDescriptorPool(alloc->device, frame->pools[j], NULL);
+        }
+        free(frame->pools);
+    }
+    free(alloc->frames);
+}
+
+DescriptorAllocator descriptor_allocator_init(VkDevice device, uint32_t frame_count) {
+    DescriptorAllocator res = {0};
+    res.device = device;
+    res.frame_count = frame_count;
+    descriptor_allocator_create_frames(&res);
+    return res;
+}
+
+VkDescriptorSet descriptor_allocator_alloc(DescriptorAllocator *alloc, uint32_t frame, VkDescriptorSetLayout layout) {
+    assert(frame < alloc->frame_count, "Descriptor frame %u out of range (%u frames)", frame, alloc->frame_count);
+    DescriptorFramePools *pools = &alloc->frames[frame];
+
+    VkDescriptorSetAllocateInfo allocate_info = {0};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &layout;
+
+    VkDescriptorSet set;
+    while (true) {
+        bool created = pools->current == pools->count;
+        if (created) {
+            // Double the size of the last pool
+            uint32_t sets = DESCRIPTOR_POOL_SETS << (pools->count < 16 ? pools->count : 16);
+            sets = sets < DESCRIPTOR_POOL_MAX_SETS ? sets : DESCRIPTOR_POOL_MAX_SETS;
+            pools->pools = realloc(pools->pools, (pools->count + 1) * sizeof(VkDescriptorPool));
+            assert_alloc(pools->pools);
+            pools->pools[pools->count++] = descriptor_allocator_create_pool(alloc, sets);
+        }
+
+        allocate_info.descriptorPool = pools->pools[pools->current];
+        VkResult result = vkAllocateDescriptorSets(alloc->device, &allocate_info, &set);
+        if (result == VK_SUCCESS) {
+            break;
+        }
+        // Full, move on to the next pool (unless it is empty: the set needs more of a type than any pool holds)
+        if ((result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) && !created) {
+            pools->current++;
+            continue;
+        }
+        vk_try(result, "Failed to allocate descriptor set");
+    }
+
+    alloc->stats.allocations++;
+    return set;
+}
+
+void descriptor_allocator_reset(DescriptorAllocator *alloc, uint32_t frame) {
+    DescriptorFramePools *pools = &alloc->frames[frame];
+    // Only the pools allocated from since the last reset
+    for (uint32_t i = 0; i <= pools->current && i < pools->count; i++) {
+        vkResetDescriptorPool(alloc->device, pools->pools[i], 0);
+    }
+    pools->current = 0;
+    alloc->stats.resets++;
+}
+
+void descriptor_allocator_log_stats(DescriptorAllocator *alloc, const char *name) {
+    DescriptorAllocatorStats *stats = &alloc->stats;
+    log_info(
+        "Descriptors (%s): %lu sets allocated, %lu resets, %u pools created for %lu sets",
+        name,
+        (unsigned long)stats->allocations,
+        (unsigned long)stats->resets,
+        stats->pools,
+        (unsigned long)stats->capacity
+    );
+}
+
+void descriptor_allocator_drop(DescriptorAllocator alloc) { descriptor_allocator_destroy_frames(&alloc); }
@@ -0,0 +1,73 @@
+#ifndef DESCRIPTORS_H
+#define DESCRIPTORS_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Bindings of a cached set layout
+#define DESCRIPTOR_MAX_BINDINGS 16
+// Sets of the first pool of a frame, each pool added when it is full holds twice as many (up to the max)
+#define DESCRIPTOR_POOL_SETS 64
+#define DESCRIPTOR_POOL_MAX_SETS 4096
+
+typedef struct {
+    uint64_t hash;
+    uint32_t binding_count;
+    // Sorted by binding number
+    VkDescriptorSetLayoutBinding bindings[DESCRIPTOR_MAX_BINDINGS];
+    VkDescriptorSetLayout layout;
+} DescriptorLayoutEntry;
+
+// Creates each distinct set layout once, looked up by a hash of its bindings. The layouts are owned by the cache.
+typedef struct {
+    VkDevice device;
+    DescriptorLayoutEntry *entries;
+    uint32_t count;
+    uint32_t cap;
+    // Lookups that found an existing layout
+    uint64_t hits;
+} DescriptorLayoutCache;
+
+// Pools sets of a frame are allocated from, the ones up to current have been allocated from since the last reset
+typedef struct {
+    VkDescriptorPool *pools;
+    uint32_t count;
+    uint32_t current;
+} DescriptorFramePools;
+
+typedef struct {
+    // Pools created, and the sets they can hold in total
+    uint32_t pools;
+    uint64_t capacity;
+    uint64_t allocations;
+    uint64_t resets;
+} DescriptorAllocatorStats;
+
+// Allocates sets from per frame in flight pools, which are never freed from: all the pools of a frame are reset at
+// once, when the frame's fence has signaled. Pools are kept across resets, so a steady workload creates none.
+typedef struct {
+    VkDevice device;
+    uint32_t frame_count;
+    DescriptorFramePools *frames;
+    DescriptorAllocatorStats stats;
+} DescriptorAllocator;
+
+DescriptorLayoutCache descriptor_layout_cache_init(VkDevice device);
+// Get the layout of a set with these bindings (in any order), created on the first request. Not thread safe.
+VkDescriptorSetLayout descriptor_layout_cache_get(
+    DescriptorLayoutCache *cache, const VkDescriptorSetLayoutBinding *bindings, uint32_t binding_count
+);
+// The layouts mustn't be in use anymore
+void descriptor_layout_cache_drop(DescriptorLayoutCache cache);
+
+DescriptorAllocator descriptor_allocator_init(VkDevice device, uint32_t frame_count);
+// Allocate a set for a frame, valid until the frame's next reset. Fails if the layout needs more descriptors of a
+// type than a new pool holds (see POOL_RATIOS).
+VkDescriptorSet descriptor_allocator_alloc(DescriptorAllocator *alloc, uint32_t frame, VkDescriptorSetLayout layout);
+// Free every set of a frame, which mustn't be in use by the device anymore
+void descriptor_allocator_reset(DescriptorAllocator *alloc, uint32_t frame);
+void descriptor_allocator_log_stats(DescriptorAllocator *alloc, const char *name);
+// The sets mustn't be in use by the device anymore
+void descriptor_allocator_drop(DescriptorAllocator alloc);
+
+#endif
@@ -0,0 +1,58 @@
+#include "fs.h"
+
+#include "assert.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void *fs_read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    void *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long len = ftell(file);
+        if (len > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc(len);
+            assert_alloc(data);
+            if (fread(data, 1, len, file) == (size_t)len) {
+                *size = len;
+            } else {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+
+    fclose(file);
+    return data;
+}
+
+bool fs_write_file_atomic(const char *path, const void *data, size_t size) {
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    assert_alloc(tmp_path);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = fwrite(data, 1, size, file) == size;
+        ok = fflush(file) == 0 && ok;
+        ok = fsync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(tmp_path, path) == 0;
+
+    if (!ok) {
+        remove(tmp_path);
+    }
+
+    free(tmp_path);
+    return ok;
+}
@@ -0,0 +1,13 @@
+#ifndef FS_H
+#define FS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read the whole file at path into a malloc'd buffer, returns NULL if it doesn't exist, is empty or can't be read
+void *fs_read_file(const char *path, size_t *size);
+// Write data to path atomically: readers only ever see the previous file or the complete new one, even if the process
+// dies in the middle of writing (data goes to a temporary file, which is synced and renamed over path)
+bool fs_write_file_atomic(const char *path, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,668 @@
+#include "image.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+// Grow a buffer to at least size bytes, returns false if it can't be
+static bool reserve(uint8_t **buf, size_t *cap, size_t size) {
+    if (size <= *cap) {
+        return true;
+    }
+    uint8_t *res = realloc(*buf, size);
+    if (res == NULL) {
+        return false;
+    }
+    *buf = res;
+    *cap = size;
+    return true;
+}
+
+static inline uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline uint32_t read_le16(const uint8_t *p) { return (uint32_t)p[0] | (uint32_t)p[1] << 8; }
+
+// Set the size of the decoded image, and make room for its pixels
+static const char *image_resize(ImageBuffer *buf, uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0 || width > IMAGE_MAX_SIDE || height > IMAGE_MAX_SIDE) {
+        return "Invalid image size";
+    }
+    if (!reserve(&buf->pixels, &buf->pixels_cap, (size_t)width * height * 4)) {
+        return "Out of memory";
+    }
+    buf->width = width;
+    buf->height = height;
+    return NULL;
+}
+
+// Inflate (RFC 1951)
+
+#define HUFFMAN_MAX_BITS 15
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    // Bits read but not consumed yet, least significant first
+    uint32_t bits;
+    uint32_t count;
+    // Set once reading past the end (reads then return zeros)
+    bool overrun;
+} BitReader;
+
+// Canonical Huffman code: number of codes of each length, and the symbols ordered by code
+typedef struct {
+    uint16_t counts[HUFFMAN_MAX_BITS + 1];
+    uint16_t symbols[288];
+} Huffman;
+
+static const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+                                           1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+                                           12, 12, 13, 13};
+// Order the lengths of the code length code are stored in
+static const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Read n bits (at most 16)
+static inline uint32_t bits_read(BitReader *br, uint32_t n) {
+    while (br->count < n) {
+        if (br->pos == br->size) {
+            br->overrun = true;
+            return 0;
+        }
+        br->bits |= (uint32_t)br->data[br->pos++] << br->count;
+        br->count += 8;
+    }
+    uint32_t res = br->bits & ((1u << n) - 1);
+    br->bits >>= n;
+    br->count -= n;
+    return res;
+}
+
+// Build the code of the given code lengths (0 for unused symbols), returns false if it is over subscribed
+static bool huffman_build(Huffman *h, const uint8_t *lengths, uint32_t count) {
+    memset(h->counts, 0, sizeof(h->counts));
+    for (uint32_t i = 0; i < count; i++) {
+        h->counts[lengths[i]]++;
+    }
+
+    int32_t left = 1;
+    for (uint32_t len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+        left = left * 2 - h->counts[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    uint16_t offsets[HUFFMAN_MAX_BITS + 1] = {0};
+    for (uint32_t len = 1; len < HUFFMAN_MAX_BITS; len++) {
+        offsets[len + 1] = offsets[len] + h->counts[len];
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (lengths[i] != 0) {
+            h->symbols[offsets[lengths[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+// Decode a symbol bit by bit, returns -1 if the code isn't valid
+static int32_t huffman_decode(BitReader *br, const Huffman *h) {
+    // Codes of a given length are consecutive, and follow the (shifted) codes of the length before
+    int32_t code = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+    for (uint32_t len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+        code |= bits_read(br, 1);
+        int32_t count = h->counts[len];
+        if (code - first < count) {
+            return h->symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Inflate the codes of a compressed block, up to its end
+static const char *inflate_codes(BitReader *br, uint8_t *out, size_t size, size_t *pos, const Huffman *lit, const Huffman *dist) {
+    while (true) {
+        int32_t sym = huffman_decode(br, lit);
+        if (sym < 0 || br->overrun) {
+            return "Invalid deflate code";
+        }
+
+        if (sym < 256) {
+            if (*pos == size) {
+                return "Inflated data too long";
+            }
+            out[(*pos)++] = sym;
+        } else if (sym == 256) {
+            return NULL;
+        } else {
+            sym -= 257;
+            if (sym >= 29) {
+                return "Invalid deflate length";
+            }
+            size_t len = LENGTH_BASE[sym] + bits_read(br, LENGTH_EXTRA[sym]);
+            int32_t d = huffman_decode(br, dist);
+            if (d < 0 || d >= 30) {
+                return "Invalid deflate distance";
+            }
+            size_t distance = DISTANCE_BASE[d] + bits_read(br, DISTANCE_EXTRA[d]);
+            if (br->overrun) {
+                return "Truncated deflate data";
+            }
+            if (distance > *pos) {
+                return "Deflate distance too far back";
+            }
+            if (len > size - *pos) {
+                return "Inflated data too long";
+            }
+            // Byte per byte, the copy can overlap what it writes
+            for (size_t i = 0; i < len; i++, (*pos)++) {
+                out[*pos] = out[*pos - distance];
+            }
+        }
+    }
+}
+
+// Read the code lengths of a dynamic block, and build its codes
+static const char *inflate_dynamic_codes(BitReader *br, Huffman *lit, Huffman *dist) {
+    uint32_t lit_count = bits_read(br, 5) + 257;
+    uint32_t dist_count = bits_read(br, 5) + 1;
+    uint32_t code_length_count = bits_read(br, 4) + 4;
+
+    uint8_t lengths[320] = {0};
+    for (uint32_t i = 0; i < code_length_count; i++) {
+        lengths[CODE_LENGTH_ORDER[i]] = bits_read(br, 3);
+    }
+    Huffman code_lengths;
+    if (!huffman_build(&code_lengths, lengths, 19)) {
+        return "Invalid deflate code lengths";
+    }
+
+    memset(lengths, 0, sizeof(lengths));
+    for (uint32_t i = 0; i < lit_count + dist_count;) {
+        int32_t sym = huffman_decode(br, &code_lengths);
+        if (sym < 0 || br->overrun) {
+            return "Invalid deflate code lengths";
+        }
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+
+        // Repeat the previous length, or zeros
+        uint8_t value = 0;
+        uint32_t repeat;
+        if (sym == 16) {
+            if (i == 0) {
+                return "Invalid deflate code lengths";
+            }
+            value = lengths[i - 1];
+            repeat = 3 + bits_read(br, 2);
+        } else if (sym == 17) {
+            repeat = 3 + bits_read(br, 3);
+        } else {
+            repeat = 11 + bits_read(br, 7);
+        }
+        if (i + repeat > lit_count + dist_count) {
+            return "Invalid deflate code lengths";
+        }
+        while (repeat-- > 0) {
+            lengths[i++] = value;
+        }
+    }
+
+    if (lengths[256] == 0) {
+        return "Deflate block without an end";
+    }
+    if (!huffman_build(lit, lengths, lit_count) || !huffman_build(dist, lengths + lit_count, dist_count)) {
+        return "Invalid deflate codes";
+    }
+    return NULL;
+}
+
+// Inflate a zlib stream to out, which it must fill exactly (the checksum isn't checked)
+static const char *zlib_inflate(const uint8_t *data, size_t size, uint8_t *out, size_t out_size) {
+    if (size < 2) {
+        return "Truncated zlib stream";
+    }
+    // Deflate, no preset dictionary
+    if ((data[0] & 0x0f) != 8 || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 0x20) != 0) {
+        return "Invalid zlib header";
+    }
+
+    BitReader br = {.data = data + 2, .size = size - 2};
+    size_t pos = 0;
+    bool last = false;
+    while (!last) {
+        last = bits_read(&br, 1);
+        uint32_t type = bits_read(&br, 2);
+        const char *error = NULL;
+
+        if (type == 0) {
+            // Stored: byte aligned, the length and its complement followed by the data
+            br.bits = 0;
+            br.count = 0;
+            if (br.size - br.pos < 4) {
+                return "Truncated deflate data";
+            }
+            uint32_t len = read_le16(br.data + br.pos);
+            if ((len ^ 0xffff) != read_le16(br.data + br.pos + 2)) {
+                return "Invalid stored deflate block";
+            }
+            br.pos += 4;
+            if (br.size - br.pos < len) {
+                return "Truncated deflate data";
+            }
+            if (len > out_size - pos) {
+                return "Inflated data too long";
+            }
+            memcpy(out + pos, br.data + br.pos, len);
+            br.pos += len;
+            pos += len;
+        } else if (type == 1) {
+            uint8_t lengths[318];
+            memset(lengths, 8, 144);
+            memset(lengths + 144, 9, 112);
+            memset(lengths + 256, 7, 24);
+            memset(lengths + 280, 8, 8);
+            memset(lengths + 288, 5, 30);
+            Huffman lit, dist;
+            huffman_build(&lit, lengths, 288);
+            huffman_build(&dist, lengths + 288, 30);
+            error = inflate_codes(&br, out, out_size, &pos, &lit, &dist);
+        } else if (type == 2) {
+            Huffman lit, dist;
+            error = inflate_dynamic_codes(&br, &lit, &dist);
+            if (error == NULL) {
+                error = inflate_codes(&br, out, out_size, &pos, &lit, &dist);
+            }
+        } else {
+            return "Invalid deflate block type";
+        }
+
+        if (error != NULL) {
+            return error;
+        }
+        if (br.overrun) {
+            return "Truncated deflate data";
+        }
+    }
+
+    if (pos != out_size) {
+        return "Inflated data too short";
+    }
+    return NULL;
+}
+
+// PNG
+
+static inline uint8_t paeth(int32_t a, int32_t b, int32_t c) {
+    int32_t p = a + b - c;
+    int32_t pa = abs(p - a);
+    int32_t pb = abs(p - b);
+    int32_t pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+static const char *png_decode(ImageBuffer *buf, const uint8_t *data, size_t size) {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t depth = 0;
+    uint8_t color_type = 0;
+    uint8_t interlace = 0;
+    bool header = false;
+    // RGBA, opaque unless given a transparency
+    uint8_t palette[256][4];
+    uint32_t palette_count = 0;
+    memset(palette, 0xff, sizeof(palette));
+    size_t compressed_size = 0;
+
+    size_t pos = sizeof(PNG_SIGNATURE);
+    bool end = false;
+    while (!end) {
+        if (size - pos < 12) {
+            return "Truncated PNG";
+        }
+        uint32_t len = read_be32(data + pos);
+        const uint8_t *type = data + pos + 4;
+        const uint8_t *chunk = data + pos + 8;
+        if (len > size - pos - 12) {
+            return "Truncated PNG chunk";
+        }
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (len != 13) {
+                return "Invalid PNG header";
+            }
+            width = read_be32(chunk);
+            height = read_be32(chunk + 4);
+            depth = chunk[8];
+            color_type = chunk[9];
+            interlace = chunk[12];
+            if (chunk[10] != 0 || chunk[11] != 0) {
+                return "Unknown PNG compression or filter method";
+            }
+            header = true;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            if (len % 3 != 0 || len / 3 > 256) {
+                return "Invalid PNG palette";
+            }
+            palette_count = len / 3;
+            for (uint32_t i = 0; i < palette_count; i++) {
+                memcpy(palette[i], chunk + i * 3, 3);
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            // Only the alpha of palettes, the color keys of other color types are ignored
+            if (color_type == 3) {
+                for (uint32_t i = 0; i < len && i < 256; i++) {
+                    palette[i][3] = chunk[i];
+                }
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            if (!reserve(&buf->compressed, &buf->compressed_cap, compressed_size + len)) {
+                return "Out of memory";
+            }
+            memcpy(buf->compressed + compressed_size, chunk, len);
+            compressed_size += len;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            end = true;
+        } else if ((type[0] & 0x20) == 0) {
+            // Ancillary chunks (lowercase first letter) can be skipped, critical ones can't
+            return "Unknown critical PNG chunk";
+        }
+
+        pos += 12 + len;
+    }
+
+    if (!header) {
+        return "Missing PNG header";
+    }
+    if (depth != 8) {
+        return "Only 8 bits per channel PNGs are supported";
+    }
+    if (interlace != 0) {
+        return "Interlaced PNGs aren't supported";
+    }
+
+    uint32_t channels;
+    switch (color_type) {
+    case 0:
+        channels = 1;
+        break;
+    case 2:
+        channels = 3;
+        break;
+    case 3:
+        channels = 1;
+        if (palette_count == 0) {
+            return "Missing PNG palette";
+        }
+        break;
+    case 4:
+        channels = 2;
+        break;
+    case 6:
+        channels = 4;
+        break;
+    default:
+        return "Invalid PNG color type";
+    }
+
+    const char *error = image_resize(buf, width, height);
+    if (error != NULL) {
+        return error;
+    }
+
+    // Each row starts with its filter type
+    size_t stride = (size_t)width * channels;
+    size_t inflated_size = (stride + 1) * height;
+    if (!reserve(&buf->inflated, &buf->inflated_cap, inflated_size)) {
+        return "Out of memory";
+    }
+    error = zlib_inflate(buf->compressed, compressed_size, buf->inflated, inflated_size);
+    if (error != NULL) {
+        return error;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *row = buf->inflated + y * (stride + 1) + 1;
+        // Filters predict from the unfiltered bytes of the pixel on the left (a), above (b) and above left (c)
+        const uint8_t *prev = y > 0 ? row - (stride + 1) : NULL;
+        uint8_t filter = row[-1];
+        if (filter > 4) {
+            return "Invalid PNG filter";
+        }
+
+        for (size_t x = 0; x < stride; x++) {
+            int32_t a = x >= channels ? row[x - channels] : 0;
+            int32_t b = prev != NULL ? prev[x] : 0;
+            int32_t c = prev != NULL && x >= channels ? prev[x - channels] : 0;
+            switch (filter) {
+            case 1:
+                row[x] += a;
+                break;
+            case 2:
+                row[x] += b;
+                break;
+            case 3:
+                row[x] += (a + b) / 2;
+                break;
+            case 4:
+                row[x] += paeth(a, b, c);
+                break;
+            }
+        }
+
+        uint8_t *dst = buf->pixels + (size_t)y * width * 4;
+        for (uint32_t x = 0; x < width; x++, dst += 4) {
+            const uint8_t *src = row + (size_t)x * channels;
+            switch (color_type) {
+            case 0:
+                dst[0] = dst[1] = dst[2] = src[0];
+                dst[3] = 0xff;
+                break;
+            case 2:
+                memcpy(dst, src, 3);
+                dst[3] = 0xff;
+                break;
+            case 3:
+                if (src[0] >= palette_count) {
+                    return "PNG palette index out of range";
+                }
+                memcpy(dst, palette[src[0]], 4);
+                break;
+            case 4:
+                dst[0] = dst[1] = dst[2] = src[0];
+                dst[3] = src[1];
+                break;
+            case 6:
+                memcpy(dst, src, 4);
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// PPM / PGM
+
+// Skip whitespace and comments, and parse a decimal number
+static bool ppm_read_number(const uint8_t *data, size_t size, size_t *pos, uint32_t *value) {
+    while (*pos < size) {
+        uint8_t c = data[*pos];
+        if (c == '#') {
+            while (*pos < size && data[*pos] != '\n') {
+                (*pos)++;
+            }
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f') {
+            (*pos)++;
+        } else {
+            break;
+        }
+    }
+
+    if (*pos == size || data[*pos] < '0' || data[*pos] > '9') {
+        return false;
+    }
+    uint64_t res = 0;
+    while (*pos < size && data[*pos] >= '0' && data[*pos] <= '9') {
+        res = res * 10 + (data[(*pos)++] - '0');
+        if (res > UINT32_MAX) {
+            return false;
+        }
+    }
+    *value = res;
+    return true;
+}
+
+static const char *ppm_decode(ImageBuffer *buf, const uint8_t *data, size_t size) {
+    uint32_t channels = data[1] == '6' ? 3 : 1;
+    size_t pos = 2;
+    uint32_t width, height, max;
+    if (!ppm_read_number(data, size, &pos, &width) || !ppm_read_number(data, size, &pos, &height) ||
+        !ppm_read_number(data, size, &pos, &max)) {
+        return "Invalid PPM header";
+    }
+    if (max == 0 || max > 255) {
+        return "Only 8 bits per channel PPMs are supported";
+    }
+    // A single whitespace before the data
+    pos++;
+
+    const char *error = image_resize(buf, width, height);
+    if (error != NULL) {
+        return error;
+    }
+    size_t count = (size_t)width * height;
+    if (pos > size || size - pos < count * channels) {
+        return "Truncated PPM data";
+    }
+
+    const uint8_t *src = data + pos;
+    uint8_t *dst = buf->pixels;
+    for (size_t i = 0; i < count; i++, src += channels, dst += 4) {
+        for (uint32_t c = 0; c < 3; c++) {
+            dst[c] = src[channels == 3 ? c : 0] * 255 / max;
+        }
+        dst[3] = 0xff;
+    }
+    return NULL;
+}
+
+// TGA
+
+static const char *tga_decode(ImageBuffer *buf, const uint8_t *data, size_t size) {
+    if (size < 18) {
+        return "Unknown image format";
+    }
+    uint8_t id_length = data[0];
+    uint8_t color_map = data[1];
+    uint8_t type = data[2];
+    uint32_t width = read_le16(data + 12);
+    uint32_t height = read_le16(data + 14);
+    uint8_t depth = data[16];
+    uint8_t descriptor = data[17];
+
+    // True color (2) and grayscale (3), and their run length encoded versions (10 and 11)
+    if (type != 2 && type != 3 && type != 10 && type != 11) {
+        return "Unknown image format";
+    }
+    if (color_map != 0) {
+        return "Color mapped TGAs aren't supported";
+    }
+    bool gray = type == 3 || type == 11;
+    bool rle = type == 10 || type == 11;
+    if (gray ? depth != 8 : depth != 24 && depth != 32) {
+        return "Unsupported TGA pixel depth";
+    }
+    // Alpha bits in the low nibble of the descriptor, the 4th byte of a pixel is padding without them
+    bool alpha = depth == 32 && (descriptor & 0x0f) != 0;
+    // Rows are bottom to top, unless the origin is at the top
+    bool top_down = (descriptor & 0x20) != 0;
+
+    const char *error = image_resize(buf, width, height);
+    if (error != NULL) {
+        return error;
+    }
+
+    uint32_t bpp = depth / 8;
+    size_t pos = 18 + id_length;
+    size_t count = (size_t)width * height;
+    uint8_t pixel[4] = {0, 0, 0, 0xff};
+    for (size_t i = 0; i < count;) {
+        size_t run = count - i;
+        bool repeat = false;
+        if (rle) {
+            if (pos >= size) {
+                return "Truncated TGA data";
+            }
+            uint8_t packet = data[pos++];
+            run = (packet & 0x7f) + 1;
+            repeat = (packet & 0x80) != 0;
+            if (run > count - i) {
+                return "TGA run past the end of the image";
+            }
+        }
+
+        for (size_t j = 0; j < run; j++, i++) {
+            if (j == 0 || !repeat) {
+                if (pos > size || size - pos < bpp) {
+                    return "Truncated TGA data";
+                }
+                // BGR(A)
+                const uint8_t *src = data + pos;
+                pixel[0] = src[gray ? 0 : 2];
+                pixel[1] = src[gray ? 0 : 1];
+                pixel[2] = src[0];
+                pixel[3] = alpha ? src[3] : 0xff;
+                pos += bpp;
+            }
+
+            size_t x = i % width;
+            size_t y = i / width;
+            size_t row = top_down ? y : height - 1 - y;
+            memcpy(buf->pixels + (row * width + x) * 4, pixel, 4);
+        }
+    }
+    return NULL;
+}
+
+ImageBuffer image_buffer_init(void) {
+    ImageBuffer res = {0};
+    return res;
+}
+
+const char *image_decode(ImageBuffer *buf, const uint8_t *data, size_t size) {
+    if (size >= sizeof(PNG_SIGNATURE) && memcmp(data, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) == 0) {
+        return png_decode(buf, data, size);
+    }
+    if (size >= 2 && data[0] == 'P' && (data[1] == '5' || data[1] == '6')) {
+        return ppm_decode(buf, data, size);
+    }
+    // TGAs have no signature, anything else is tried as one
+    return tga_decode(buf, data, size);
+}
+
+void image_buffer_drop(ImageBuffer buf) {
+    free(buf.pixels);
+    free(buf.compressed);
+    free(buf.inflated);
+}
@@ -0,0 +1,32 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest width or height of a decoded image
+#define IMAGE_MAX_SIDE 16384
+
+// Buffers an image is decoded to, grown as needed and kept from one decode to the next (so that reusing a buffer
+// eventually stops allocating). Not thread safe, but buffers are independent.
+typedef struct {
+    // RGBA, 8 bits per channel, rows top to bottom
+    uint8_t *pixels;
+    size_t pixels_cap;
+    uint32_t width;
+    uint32_t height;
+    // Intermediate data (i.e. the compressed and inflated data of PNGs)
+    uint8_t *compressed;
+    size_t compressed_cap;
+    uint8_t *inflated;
+    size_t inflated_cap;
+} ImageBuffer;
+
+ImageBuffer image_buffer_init(void);
+// Decode a PNG (8 bits per channel, not interlaced), binary PPM/PGM (P6/P5) or TGA (true color or grayscale, RLE or
+// not) file to buf. Returns NULL on success, or a (static) description of the error. Doesn't log, so it can run in a
+// job.
+const char *image_decode(ImageBuffer *buf, const uint8_t *data, size_t size);
+void image_buffer_drop(ImageBuffer buf);
+
+#endif
@@ -0,0 +1,173 @@
+#include "instances.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "job.h"
+#include "mesh.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#define TAU 6.28318530718f
+
+static void instance_set_create_buffers(InstanceSet *set, Allocator *allocator) {
+    set->buffers = malloc(set->buffer_count * sizeof(VkBuffer));
+    set->allocations = malloc(set->buffer_count * sizeof(Allocation));
+    assert_alloc(set->buffers);
+    assert_alloc(set->allocations);
+
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = (VkDeviceSize)set->count * sizeof(InstanceData);
+    // Also read by the culling pass
+    create_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    for (uint32_t i = 0; i < set->buffer_count; i++) {
+        vk_try(vkCreateBuffer(set->device, &create_info, NULL, &set->buffers[i]), "Failed to create instance buffer");
+        vk_try(
+            allocator_bind_streaming_buffer(allocator, set->buffers[i], &set->allocations[i]),
+            "Failed to allocate instance buffer memory"
+        );
+        memcpy(set->allocations[i].mapped, set->data, create_info.size);
+    }
+}
+
+static void instance_set_destroy_buffers(InstanceSet *set, Allocator *allocator) {
+    for (uint32_t i = 0; i < set->buffer_count; i++) {
+        vkDestroyBuffer(set->device, set->buffers[i], NULL);
+        allocator_free(allocator, &set->allocations[i]);
+    }
+    free(set->buffers);
+    free(set->allocations);
+}
+
+InstanceSet instance_set_init(Allocator *allocator, VkDevice device, JobSystem *jobs, uint32_t count, uint32_t buffer_count) {
+    assert(count > 0, "Instance sets can't be empty");
+
+    InstanceSet res = {0};
+    res.device = device;
+    res.jobs = jobs;
+    res.count = count;
+    res.data = malloc(count * sizeof(InstanceData));
+    res.speeds = malloc(count * sizeof(float));
+    assert_alloc(res.data);
+    assert_alloc(res.speeds);
+
+    // Square grid covering the whole viewport
+    uint32_t side = ceilf(sqrtf(count));
+    float cell = 2.0f / side;
+    float scale = fminf(1.0f, cell * 0.9f);
+    for (uint32_t i = 0; i < count; i++) {
+        InstanceData *instance = &res.data[i];
+        instance->transform[0] = -1.0f + cell * (i % side + 0.5f);
+        instance->transform[1] = -1.0f + cell * (i / side + 0.5f);
+        instance->transform[2] = scale;
+        instance->transform[3] = 0.0f;
+
+        // A single instance stays as the mesh is
+        if (count == 1) {
+            instance->color[0] = instance->color[1] = instance->color[2] = instance->color[3] = 1.0f;
+            res.speeds[i] = 0.0f;
+            continue;
+        }
+
+        float hue = TAU * i / count;
+        instance->color[0] = 0.5f + 0.5f * cosf(hue);
+        instance->color[1] = 0.5f + 0.5f * cosf(hue + TAU / 3.0f);
+        instance->color[2] = 0.5f + 0.5f * cosf(hue + 2.0f * TAU / 3.0f);
+        instance->color[3] = 1.0f;
+        res.speeds[i] = (i % 2 ? -1.0f : 1.0f) * (0.5f + 0.25f * (i % 5));
+    }
+
+    res.buffer_count = buffer_count;
+    instance_set_create_buffers(&res, allocator);
+
+    res.slice_count = (count + INSTANCE_SLICE - 1) / INSTANCE_SLICE;
+    res.updates = malloc(res.slice_count * sizeof(InstanceUpdate));
+    res.update_jobs = malloc(res.slice_count * sizeof(Job));
+    assert_alloc(res.updates);
+    assert_alloc(res.update_jobs);
+
+    return res;
+}
+
+void instance_set_vertex_layout(VertexLayout *layout) {
+    assert(
+        layout->binding_count < VERTEX_LAYOUT_MAX_BINDINGS && layout->attribute_count + 2 <= VERTEX_LAYOUT_MAX_ATTRIBUTES,
+        "Vertex layout is full"
+    );
+
+    uint32_t binding = layout->binding_count++;
+    layout->bindings[binding] = (VkVertexInputBindingDescription){
+        .binding = binding,
+        .stride = sizeof(InstanceData),
+        .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+    };
+    layout->attributes[layout->attribute_count++] = (VkVertexInputAttributeDescription){
+        .location = 2,
+        .binding = binding,
+        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+        .offset = offsetof(InstanceData, transform),
+    };
+    layout->attributes[layout->attribute_count++] = (VkVertexInputAttributeDescription){
+        .location = 3,
+        .binding = binding,
+        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+        .offset = offsetof(InstanceData, color),
+    };
+}
+
+void instance_set_set_buffer_count(InstanceSet *set, Allocator *allocator, uint32_t buffer_count) {
+    instance_set_destroy_buffers(set, allocator);
+    set->buffer_count = buffer_count;
+    instance_set_create_buffers(set, allocator);
+}
+
+static void instance_update_slice(void *data) {
+    InstanceUpdate *update = data;
+    for (uint32_t i = update->first; i < update->last; i++) {
+        float rotation = update->data[i].transform[3] + update->speeds[i] * update->dt;
+        update->data[i].transform[3] = fmodf(rotation, TAU);
+    }
+    // The buffer may be write combined: only write to it, sequentially
+    memcpy(update->dst + update->first, update->data + update->first, (update->last - update->first) * sizeof(InstanceData));
+}
+
+void instance_set_update(InstanceSet *set, uint32_t buffer, float dt) {
+    InstanceData *dst = set->allocations[buffer].mapped;
+    for (uint32_t i = 0; i < set->slice_count; i++) {
+        uint32_t last = (i + 1) * INSTANCE_SLICE;
+        set->updates[i] = (InstanceUpdate){
+            .data = set->data,
+            .speeds = set->speeds,
+            .dst = dst,
+            .first = i * INSTANCE_SLICE,
+            .last = last < set->count ? last : set->count,
+            .dt = dt,
+        };
+        set->update_jobs[i] = (Job){.func = instance_update_slice, .data = &set->updates[i]};
+    }
+
+    if (set->slice_count == 1) {
+        instance_update_slice(&set->updates[0]);
+        return;
+    }
+
+    JobCounter counter = 0;
+    job_system_run(set->jobs, set->update_jobs, set->slice_count, &counter);
+    job_system_wait(set->jobs, &counter);
+}
+
+void instance_set_drop(InstanceSet set, Allocator *allocator) {
+    instance_set_destroy_buffers(&set, allocator);
+    free(set.data);
+    free(set.speeds);
+    free(set.updates);
+    free(set.update_jobs);
+}
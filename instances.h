@@ -0,0 +1,62 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include "allocator.h"
+#include "job.h"
+#include "mesh.h"
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Instances updated by a single job (smaller sets are updated inline)
+#define INSTANCE_SLICE 16384
+
+// Per instance vertex attributes
+typedef struct {
+    // Offset (xy), scale (z) and rotation in radians (w) of the mesh
+    float transform[4];
+    float color[4];
+} InstanceData;
+
+// Part of the instances updated by a job
+typedef struct {
+    InstanceData *data;
+    const float *speeds;
+    InstanceData *dst;
+    uint32_t first;
+    uint32_t last;
+    float dt;
+} InstanceUpdate;
+
+// Instances of a mesh, laid out on a grid and spinning. The CPU side array is the reference, and is written to a
+// host visible buffer (one per frame in flight) every time it is updated.
+typedef struct {
+    VkDevice device;
+    JobSystem *jobs;
+    uint32_t count;
+    InstanceData *data;
+    // Rotation speed of each instance (radians per second)
+    float *speeds;
+
+    uint32_t buffer_count;
+    VkBuffer *buffers;
+    Allocation *allocations;
+
+    uint32_t slice_count;
+    InstanceUpdate *updates;
+    Job *update_jobs;
+} InstanceSet;
+
+// count instances, written to buffer_count buffers
+InstanceSet instance_set_init(Allocator *allocator, VkDevice device, JobSystem *jobs, uint32_t count, uint32_t buffer_count);
+// Add the per instance binding (and its attributes) to a vertex layout
+void instance_set_vertex_layout(VertexLayout *layout);
+// Change the number of buffers (which mustn't be in use by the device anymore), they are written with the current data
+void instance_set_set_buffer_count(InstanceSet *set, Allocator *allocator, uint32_t buffer_count);
+// Advance the instances by dt seconds (in parallel on the job system) and write them to a buffer, which mustn't be in
+// use by the device
+void instance_set_update(InstanceSet *set, uint32_t buffer, float dt);
+// The buffers mustn't be in use by the device anymore
+void instance_set_drop(InstanceSet set, Allocator *allocator);
+
+#endif
@@ -0,0 +1,338 @@
+#include "job.h"
+
+#include "assert.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Failed attempts at finding a job before a worker goes to sleep
+#define JOB_SPIN_COUNT 64
+
+struct JobSystem {
+    uint32_t worker_count;
+    JobWorker *workers;
+    // Threads of the workers but the first one
+    pthread_t *threads;
+
+    // Sleeping workers are woken up when jobs are submitted
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint64_t wake_generation;
+    atomic_uint_fast32_t sleeping;
+    atomic_bool quit;
+
+    // Jobs run by the background thread, oldest first (guarded by background_lock). The thread is started whatever the
+    // worker count, and never runs the workers' jobs: long jobs neither wait for nor delay the frame's.
+    pthread_t background_thread;
+    pthread_mutex_t background_lock;
+    pthread_cond_t background_wake;
+    Job *background[JOB_BACKGROUND_CAPACITY];
+    uint32_t background_first;
+    uint32_t background_count;
+};
+
+// Worker of the calling thread (NULL if it isn't part of a job system)
+static _Thread_local JobWorker *CURRENT_WORKER = NULL;
+
+static inline void job_deque_init(JobDeque *deque) {
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    for (uint32_t i = 0; i < JOB_DEQUE_CAPACITY; i++) {
+        atomic_init(&deque->jobs[i], NULL);
+    }
+}
+
+// Push a job at the bottom (owner only), returns false if the deque is full
+static inline bool job_deque_push(JobDeque *deque, Job *job) {
+    int_fast64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int_fast64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (b - t >= JOB_DEQUE_CAPACITY) {
+        return false;
+    }
+    atomic_store_explicit(&deque->jobs[b & (JOB_DEQUE_CAPACITY - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+// Take a job from the bottom (owner only), returns NULL if the deque is empty
+static inline Job *job_deque_take(JobDeque *deque) {
+    int_fast64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Job *job = atomic_load_explicit(&deque->jobs[b & (JOB_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (t == b) {
+        // Last job: race against the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            job = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+// Steal a job from the top (any thread), returns NULL if the deque is empty or another thread won the race
+static inline Job *job_deque_steal(JobDeque *deque) {
+    int_fast64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return NULL;
+    }
+
+    Job *job = atomic_load_explicit(&deque->jobs[t & (JOB_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return job;
+}
+
+static inline void job_execute(Job *job) {
+    JobCounter *counter = job->counter;
+    job->func(job->data);
+    // The job can be freed by its owner as soon as the counter is decremented
+    atomic_fetch_sub_explicit(counter, 1, memory_order_release);
+}
+
+// Find a job: from the worker's own deque first, then from the others, starting at a random one
+static Job *job_find(JobWorker *worker) {
+    Job *job = job_deque_take(&worker->deque);
+    if (job != NULL) {
+        return job;
+    }
+
+    JobSystem *sys = worker->system;
+    worker->rng ^= worker->rng << 13;
+    worker->rng ^= worker->rng >> 17;
+    worker->rng ^= worker->rng << 5;
+    uint32_t start = worker->rng % sys->worker_count;
+    for (uint32_t i = 0; i < sys->worker_count; i++) {
+        uint32_t victim = (start + i) % sys->worker_count;
+        if (victim == worker->index) {
+            continue;
+        }
+        job = job_deque_steal(&sys->workers[victim].deque);
+        if (job != NULL) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Wake the sleeping workers up, after jobs have been submitted
+static void job_system_wake(JobSystem *sys) {
+    // Pairs with the fence between announcing a sleep and searching for jobs
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sys->sleeping, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&sys->lock);
+        sys->wake_generation++;
+        pthread_cond_broadcast(&sys->wake);
+        pthread_mutex_unlock(&sys->lock);
+    }
+}
+
+static void *job_worker_main(void *arg) {
+    JobWorker *worker = arg;
+    JobSystem *sys = worker->system;
+    CURRENT_WORKER = worker;
+
+    uint32_t failures = 0;
+    while (!atomic_load_explicit(&sys->quit, memory_order_acquire)) {
+        Job *job = job_find(worker);
+        if (job != NULL) {
+            job_execute(job);
+            failures = 0;
+            continue;
+        }
+
+        if (++failures < JOB_SPIN_COUNT) {
+            sched_yield();
+            continue;
+        }
+
+        // Announce the sleep before searching one last time, so that a submission either sees the sleeper or has its
+        // jobs found by that search
+        atomic_fetch_add(&sys->sleeping, 1);
+        pthread_mutex_lock(&sys->lock);
+        uint64_t generation = sys->wake_generation;
+        pthread_mutex_unlock(&sys->lock);
+
+        job = job_find(worker);
+        if (job == NULL) {
+            pthread_mutex_lock(&sys->lock);
+            while (sys->wake_generation == generation && !atomic_load(&sys->quit)) {
+                pthread_cond_wait(&sys->wake, &sys->lock);
+            }
+            pthread_mutex_unlock(&sys->lock);
+        }
+        atomic_fetch_sub(&sys->sleeping, 1);
+
+        if (job != NULL) {
+            job_execute(job);
+        }
+        failures = 0;
+    }
+
+    CURRENT_WORKER = NULL;
+    return NULL;
+}
+
+// Run the background jobs in submission order until the system quits, the queue is drained first
+static void *job_background_main(void *arg) {
+    JobSystem *sys = arg;
+
+    pthread_mutex_lock(&sys->background_lock);
+    while (true) {
+        while (sys->background_count == 0 && !atomic_load(&sys->quit)) {
+            pthread_cond_wait(&sys->background_wake, &sys->background_lock);
+        }
+        if (sys->background_count == 0) {
+            break;
+        }
+
+        Job *job = sys->background[sys->background_first];
+        sys->background_first = (sys->background_first + 1) % JOB_BACKGROUND_CAPACITY;
+        sys->background_count--;
+
+        pthread_mutex_unlock(&sys->background_lock);
+        job_execute(job);
+        pthread_mutex_lock(&sys->background_lock);
+    }
+    pthread_mutex_unlock(&sys->background_lock);
+
+    return NULL;
+}
+
+JobSystem *job_system_init(uint32_t thread_count) {
+    assert(CURRENT_WORKER == NULL, "The thread is already part of a job system");
+
+    JobSystem *sys = malloc(sizeof(JobSystem));
+    assert_alloc(sys);
+
+    sys->worker_count = thread_count + 1;
+    sys->workers = malloc(sys->worker_count * sizeof(JobWorker));
+    sys->threads = malloc(sys->worker_count * sizeof(pthread_t));
+    assert_alloc(sys->workers);
+    assert_alloc(sys->threads);
+
+    pthread_mutex_init(&sys->lock, NULL);
+    pthread_cond_init(&sys->wake, NULL);
+    sys->wake_generation = 0;
+    atomic_init(&sys->sleeping, 0);
+    atomic_init(&sys->quit, false);
+    pthread_mutex_init(&sys->background_lock, NULL);
+    pthread_cond_init(&sys->background_wake, NULL);
+    sys->background_first = 0;
+    sys->background_count = 0;
+
+    for (uint32_t i = 0; i < sys->worker_count; i++) {
+        JobWorker *worker = &sys->workers[i];
+        worker->index = i;
+        worker->system = sys;
+        // Any non zero seed works for xorshift
+        worker->rng = 2654435761u * (i + 1);
+        job_deque_init(&worker->deque);
+    }
+
+    CURRENT_WORKER = &sys->workers[0];
+    for (uint32_t i = 1; i < sys->worker_count; i++) {
+        assert_eq(pthread_create(&sys->threads[i], NULL, job_worker_main, &sys->workers[i]), 0, "Failed to create worker thread");
+    }
+    assert_eq(pthread_create(&sys->background_thread, NULL, job_background_main, sys), 0, "Failed to create background thread");
+
+    log_debug("Job system started with %u workers", sys->worker_count);
+
+    return sys;
+}
+
+uint32_t job_system_worker_count(JobSystem *sys) { return sys->worker_count; }
+
+uint32_t job_system_worker_index(JobSystem *sys) {
+    assert(CURRENT_WORKER != NULL && CURRENT_WORKER->system == sys, "Thread isn't a worker of the job system");
+    return CURRENT_WORKER->index;
+}
+
+void job_system_run(JobSystem *sys, Job *jobs, uint32_t count, JobCounter *counter) {
+    JobWorker *worker = &sys->workers[job_system_worker_index(sys)];
+
+    atomic_fetch_add_explicit(counter, count, memory_order_relaxed);
+    for (uint32_t i = 0; i < count; i++) {
+        jobs[i].counter = counter;
+        if (!job_deque_push(&worker->deque, &jobs[i])) {
+            job_execute(&jobs[i]);
+        }
+    }
+
+    job_system_wake(sys);
+}
+
+void job_system_run_background(JobSystem *sys, Job *jobs, uint32_t count, JobCounter *counter) {
+    atomic_fetch_add_explicit(counter, count, memory_order_relaxed);
+    for (uint32_t i = 0; i < count; i++) {
+        jobs[i].counter = counter;
+
+        bool queued = false;
+        pthread_mutex_lock(&sys->background_lock);
+        if (sys->background_count < JOB_BACKGROUND_CAPACITY) {
+            sys->background[(sys->background_first + sys->background_count) % JOB_BACKGROUND_CAPACITY] = &jobs[i];
+            sys->background_count++;
+            pthread_cond_signal(&sys->background_wake);
+            queued = true;
+        }
+        pthread_mutex_unlock(&sys->background_lock);
+        if (!queued) {
+            job_execute(&jobs[i]);
+        }
+    }
+}
+
+void job_system_wait(JobSystem *sys, JobCounter *counter) {
+    JobWorker *worker = &sys->workers[job_system_worker_index(sys)];
+
+    // Help instead of blocking, which also makes waiting from within a job safe
+    while (atomic_load_explicit(counter, memory_order_acquire) > 0) {
+        Job *job = job_find(worker);
+        if (job != NULL) {
+            job_execute(job);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+void job_system_drop(JobSystem *sys) {
+    pthread_mutex_lock(&sys->lock);
+    atomic_store(&sys->quit, true);
+    pthread_cond_broadcast(&sys->wake);
+    pthread_mutex_unlock(&sys->lock);
+    pthread_mutex_lock(&sys->background_lock);
+    pthread_cond_signal(&sys->background_wake);
+    pthread_mutex_unlock(&sys->background_lock);
+
+    for (uint32_t i = 1; i < sys->worker_count; i++) {
+        pthread_join(sys->threads[i], NULL);
+    }
+    pthread_join(sys->background_thread, NULL);
+
+    CURRENT_WORKER = NULL;
+    pthread_mutex_destroy(&sys->lock);
+    pthread_cond_destroy(&sys->wake);
+    pthread_mutex_destroy(&sys->background_lock);
+    pthread_cond_destroy(&sys->background_wake);
+    free(sys->workers);
+    free(sys->threads);
+    free(sys);
+}
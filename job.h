@@ -0,0 +1,62 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Capacity of each worker's deque (power of two), jobs pushed to a full deque are run inline
+#define JOB_DEQUE_CAPACITY 4096
+// Capacity of the queue of background jobs, jobs pushed to a full queue are run inline
+#define JOB_BACKGROUND_CAPACITY 256
+
+typedef void (*JobFunc)(void *data);
+
+// Number of jobs left to run in a batch, jobs can wait on the counter of the batches they depend on
+typedef atomic_uint_fast32_t JobCounter;
+
+// A job, owned by the caller until the counter it was submitted with reaches zero
+typedef struct {
+    JobFunc func;
+    void *data;
+    // Set on submission
+    JobCounter *counter;
+} Job;
+
+// Work-stealing deque (Chase-Lev): the owner pushes and takes at the bottom, thieves steal from the top
+typedef struct {
+    atomic_int_fast64_t top;
+    atomic_int_fast64_t bottom;
+    _Atomic(Job *) jobs[JOB_DEQUE_CAPACITY];
+} JobDeque;
+
+typedef struct JobSystem JobSystem;
+
+typedef struct {
+    uint32_t index;
+    JobSystem *system;
+    JobDeque deque;
+    // State of the xorshift generator used to pick victims
+    uint32_t rng;
+} JobWorker;
+
+// Create a job system with thread_count worker threads and a background thread, the calling thread becomes worker 0 (it
+// runs jobs while waiting on counters).
+JobSystem *job_system_init(uint32_t thread_count);
+// Number of workers, including the thread that created the system
+uint32_t job_system_worker_count(JobSystem *sys);
+// Index of the calling worker in [0, job_system_worker_count) (asserts that the thread is part of the system)
+uint32_t job_system_worker_index(JobSystem *sys);
+// Submit count jobs, counter is incremented by count and decremented as each of them ends. Must be called from a
+// worker (including from within a job).
+void job_system_run(JobSystem *sys, Job *jobs, uint32_t count, JobCounter *counter);
+// Submit count jobs that are only run by the system's background thread (in submission order), never by the workers:
+// long jobs can't delay the calling thread or the other jobs. They can't submit jobs themselves, and are run inline
+// only if the background queue is full.
+void job_system_run_background(JobSystem *sys, Job *jobs, uint32_t count, JobCounter *counter);
+// Run jobs until the counter reaches zero
+void job_system_wait(JobSystem *sys, JobCounter *counter);
+// Stop and join the threads, no job may be pending
+void job_system_drop(JobSystem *sys);
+
+#endif
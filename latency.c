@@ -0,0 +1,119 @@
+#include "latency.h"
+
+#include "log.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+const char *latency_policy_name(LatencyPolicy policy) {
+    switch (policy) {
+    case LatencyBalanced:
+        return "balanced";
+    case LatencyLowest:
+        return "lowest";
+    case LatencyVsync:
+        return "vsync";
+    case LatencyCapped:
+        return "capped";
+    }
+    return "unknown";
+}
+
+FrameLimiter frame_limiter_init(double fps) {
+    FrameLimiter res;
+    memset(&res, 0, sizeof(FrameLimiter));
+    res.interval = fps > 0.0 ? (uint64_t)(1e9 / fps) : 0;
+    res.spin_margin = LIMITER_INITIAL_SPIN_MARGIN;
+    return res;
+}
+
+// Sleep until time (on the clock of timing_now)
+static void sleep_until(uint64_t time) {
+    struct timespec ts = {.tv_sec = time / 1000000000, .tv_nsec = time % 1000000000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void frame_limiter_wait(FrameLimiter *limiter) {
+    if (limiter->interval == 0) {
+        return;
+    }
+
+    uint64_t now = timing_now();
+    // The first frame starts right away
+    if (limiter->deadline == 0) {
+        limiter->deadline = now;
+    }
+
+    uint64_t deadline = limiter->deadline;
+    if (now < deadline) {
+        uint64_t wait_start = now;
+        if (deadline - now > limiter->spin_margin) {
+            uint64_t target = deadline - limiter->spin_margin;
+            sleep_until(target);
+            now = timing_now();
+
+            // Grow the margin right away when a sleep wakes up too late, and shrink it slowly otherwise
+            uint64_t overshoot = now > target ? now - target : 0;
+            uint64_t margin = limiter->spin_margin - limiter->spin_margin / 16;
+            if (overshoot + overshoot / 2 > margin) {
+                margin = overshoot + overshoot / 2;
+            }
+            if (margin < LIMITER_MIN_SPIN_MARGIN) {
+                margin = LIMITER_MIN_SPIN_MARGIN;
+            }
+            if (margin > limiter->interval / 2) {
+                margin = limiter->interval / 2;
+            }
+            limiter->spin_margin = margin;
+        }
+        histogram_record(&limiter->sleep, now - wait_start);
+
+        uint64_t spin_start = now;
+        while (now < deadline) {
+            now = timing_now();
+        }
+        histogram_record(&limiter->spin, now - spin_start);
+    }
+
+    if (limiter->last_start != 0) {
+        uint64_t elapsed = now - limiter->last_start;
+        uint64_t jitter = elapsed > limiter->interval ? elapsed - limiter->interval : limiter->interval - elapsed;
+        histogram_record(&limiter->jitter, jitter);
+    }
+    limiter->last_start = now;
+
+    // Deadlines stay on the same grid while frames keep up, so that small delays don't accumulate
+    limiter->deadline += limiter->interval;
+    if (limiter->deadline <= now) {
+        limiter->deadline = now + limiter->interval;
+        limiter->missed++;
+    }
+}
+
+void frame_limiter_report(FrameLimiter *limiter) {
+    Histogram *jitter = &limiter->jitter;
+    if (jitter->count == 0) {
+        return;
+    }
+
+    log_info(
+        "Frame limiter (%.1f fps, %lu frames), jitter in ms: mean %.3f, p50 %.3f, p99 %.3f, max %.3f",
+        1e9 / limiter->interval,
+        (unsigned long)jitter->count + 1,
+        (double)jitter->total / jitter->count * 1e-6,
+        histogram_percentile(jitter, 0.50) * 1e-6,
+        histogram_percentile(jitter, 0.99) * 1e-6,
+        jitter->max * 1e-6
+    );
+    log_info(
+        "    mean sleep %.3fms, mean spin %.3fms, spin margin %.3fms, %lu missed deadlines",
+        limiter->sleep.count > 0 ? (double)limiter->sleep.total / limiter->sleep.count * 1e-6 : 0.0,
+        limiter->spin.count > 0 ? (double)limiter->spin.total / limiter->spin.count * 1e-6 : 0.0,
+        limiter->spin_margin * 1e-6,
+        (unsigned long)limiter->missed
+    );
+}
@@ -0,0 +1,55 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "timing.h"
+
+#include <stdint.h>
+
+// The limiter sleeps until that long before a frame's deadline, and spins the rest of the way. The margin starts at
+// the initial value, then follows how late the sleeps wake up (without going under the minimum).
+#define LIMITER_INITIAL_SPIN_MARGIN 1000000
+#define LIMITER_MIN_SPIN_MARGIN 100000
+
+// How frames are paced, traded between latency, tearing and power
+typedef enum {
+    // Mailbox when available, FIFO otherwise
+    LatencyBalanced,
+    // Immediate (or mailbox) with as few swapchain images as possible: frames are shown as soon as they are done, and
+    // may tear
+    LatencyLowest,
+    // FIFO (relaxed when available): frames are locked to the display's refresh
+    LatencyVsync,
+    // Like balanced, with the frames started at a fixed rate by the frame limiter
+    LatencyCapped,
+} LatencyPolicy;
+
+// Paces the start of the frames to a fixed rate: the CPU work of a frame starts just before its deadline, so that the
+// input it reads is as recent as possible and the CPU is idle in between. Sleeping is cheap but imprecise, so it sleeps
+// until close to the deadline, and spins the rest of the way.
+typedef struct {
+    // Target time between the start of two frames in nanoseconds (0: not limited)
+    uint64_t interval;
+    // Time the next frame should start at (0 before the first)
+    uint64_t deadline;
+    uint64_t spin_margin;
+    // Start of the previous frame
+    uint64_t last_start;
+    // Distance between the achieved and the target frame time
+    Histogram jitter;
+    // Time spent waiting for each deadline, sleeping then spinning
+    Histogram sleep;
+    Histogram spin;
+    // Frames that started more than a whole interval late (the deadlines are then pushed back instead of catching up)
+    uint64_t missed;
+} FrameLimiter;
+
+const char *latency_policy_name(LatencyPolicy policy);
+
+// fps of 0 disables the limiter
+FrameLimiter frame_limiter_init(double fps);
+// Wait for the start of the next frame
+void frame_limiter_wait(FrameLimiter *limiter);
+// Log the achieved pacing since the limiter was created
+void frame_limiter_report(FrameLimiter *limiter);
+
+#endif
@@ -7,20 +7,42 @@
         (VkFramebuffer, VkFramebufferVec, vk_framebuffer), (VkLayerProperties, VkLayerPropertiesVec, vk_layer_properties), \
         (VkPhysicalDevice, VkPhysicalDeviceVec, vk_physical_device), (VkCommandBuffer, VkCommandBufferVec, vk_command_buffer), \
         (VkExtensionProperties, VkExtensionPropertiesVec, vk_extension_properties), (VkSemaphore, VkSemaphoreVec, vk_semaphore), \
-        (VkFence, VkFenceVec, vk_fence)
+        (VkFence, VkFenceVec, vk_fence), (Allocation, AllocationVec, allocation), \
+        (VkQueryPool, VkQueryPoolVec, vk_query_pool), (uint64_t, U64Vec, u64), (bool, BoolVec, bool)
+#include "allocator.h"
 #include "assert.h"
+#include "bindless.h"
+#include "culling.h"
+#include "deletion_queue.h"
+#include "descriptors.h"
+#include "fs.h"
+#include "instances.h"
+#include "job.h"
+#include "latency.h"
 #include "log.h"
 #include "macro_utils.h"
+#include "mesh.h"
+#include "pipeline_cache.h"
 #include "proxies.h"
+#include "recorder.h"
+#include "rendering.h"
+#include "sprites.h"
+#include "staging.h"
+#include "textures.h"
+#include "timing.h"
+#include "uniforms.h"
+#include "utils.h"
 #include "vk_enum_string_helper.h"
 
 #include <GLFW/glfw3.h>
 #include <limits.h>
+#include <math.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <vulkan/vulkan.h>
 
 // vector.h must be included last (or actually after vulkan.h), since it references some
@@ -29,34 +51,76 @@
 #include "vector.h"
 // clang-format on
 
-// run expr, and assert that the returned VkResult is VK_SUCCESS
-#define vk_try(expr, fmt, ...) \
-    do { \
-        VkResult _res = expr; \
-        assert_eq(_res, VK_SUCCESS, fmt " (%s)", __VA_ARGS__ __VA_OPT__(, ) string_VkResult(_res)); \
-    } while (false)
-#define vk_get_vec(vec, expr) \
-    do { \
-        uint32_t _count; \
-        uint32_t *count = &_count; \
-        void *ptr = NULL; \
-        expr; \
-        vec_grow(vec, _count); \
-        ptr = (vec)->data; \
-        expr; \
-        (vec)->len = _count; \
-    } while (false)
-
-#define CONCURENT_FRAMES 2
-
 // Structs
 
+// Runtime settings, parsed from the command line
+typedef struct {
+    // Render into device owned images instead of a window surface, without touching GLFW
+    bool headless;
+    uint32_t width;
+    uint32_t height;
+    // Number of frames to render before exiting (0: until the window is closed)
+    uint64_t frame_limit;
+    // Number of frames the CPU can record ahead of the GPU
+    uint32_t frames_in_flight;
+    // Let the frames in flight be adjusted at runtime, see FramesInFlightTuner
+    bool tune_frames_in_flight;
+    // Latency the tuner aims to stay under, in seconds
+    double latency_target;
+    // Requested number of swapchain images (0: one more than the minimum)
+    uint32_t image_count;
+    // Record a command buffer once per image, and replay it until it is invalidated (see ctx_invalidate_commands)
+    bool cache_commands;
+    // Number of draws in the draw list
+    uint32_t draw_count;
+    // Slices of the draw list recorded in parallel in secondary command buffers (0: record inline on the main thread)
+    uint32_t record_slices;
+    // Background threads of the job system
+    uint32_t worker_threads;
+    // File the pipeline cache is loaded from and saved to (NULL: don't persist it)
+    const char *pipeline_cache_path;
+    // Time the window size has to be stable for before the swapchain is rebuilt, in seconds (0: rebuild right away)
+    double resize_debounce;
+    // File the selected physical device is remembered in (NULL: always probe every device)
+    const char *device_cache_path;
+    // Seconds between two frame timing reports (0: only report on exit)
+    double stats_interval;
+    // Layout of the mesh's vertices, and how many times its triangle is subdivided
+    MeshLayout mesh_layout;
+    uint32_t mesh_subdivisions;
+    // Instances of the mesh drawn by each draw
+    uint32_t instance_count;
+    // Measure the frame time for instance counts from 1 to BENCHMARK_MAX_INSTANCES instead of running normally
+    bool benchmark_instances;
+    // Cull the instances against the view in a compute pass, and draw the visible ones indirectly (replaces the draw
+    // list)
+    bool gpu_culling;
+    // Sprites of the overlay, batched and written every frame (0: no overlay)
+    uint32_t sprite_count;
+    // Files loaded as textures in the background, while frames are drawn
+    ConstStringVec textures;
+    // Reach textures through a single descriptor indexing set, indexed per draw (textures the sprites if there are
+    // some)
+    bool bindless;
+    // Render straight to the image views with dynamic rendering, instead of through a render pass and framebuffers
+    bool dynamic_rendering;
+    // Track frames with a timeline semaphore signaled with each frame's number, instead of a fence per frame in flight
+    bool timeline_sync;
+    // How frames are presented and paced, and the frame rate of LatencyCapped
+    LatencyPolicy latency_policy;
+    double fps_cap;
+} Settings;
+
 typedef struct {
     int64_t graphics;
     int64_t present;
+    // Compute (without graphics) and transfer only families if there are some (work on them runs alongside graphics
+    // work), the graphics family otherwise
+    int64_t compute;
+    int64_t transfer;
 } QueueFamilyIndices;
 
-#define MAX_QUEUE_COUNT 2
+#define MAX_QUEUE_COUNT 4
 
 typedef struct {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -75,39 +139,164 @@ typedef struct {
     VkSurfaceTransformFlagBitsKHR transform;
 } SwapChainConfig;
 
+// Adjusts the number of frames in flight at runtime: a deeper queue keeps the GPU fed through CPU spikes, a
+// shallower one cuts latency. Decisions are taken every TUNER_WINDOW frames, from the time spent waiting on
+// fences (high when the GPU is the bottleneck), the latency between the submission of a frame and the CPU
+// observing its completion, and the spread of the frame times.
+typedef struct {
+    bool enabled;
+    // Target latency in nanoseconds
+    uint64_t latency_target;
+    // Statistics of the current window
+    uint32_t frames;
+    uint64_t fence_wait;
+    uint64_t latency;
+    Histogram frame_times;
+    // Start of the previous frame
+    uint64_t last_frame_start;
+} FramesInFlightTuner;
+
+// Command buffer recorded for a single image, and submitted again every time the image is rendered to
+typedef struct {
+    VkCommandBuffer buffer;
+    // Needs to be recorded again before its next submission
+    bool dirty;
+    // Number of the frame that last submitted the buffer (0 if none did)
+    uint64_t frame;
+    // Timestamps written by the buffer
+    VkQueryPool timestamps;
+    bool timestamps_pending;
+} CachedCommands;
+
+// Uniforms of a frame (Frame in shader.vert)
+typedef struct {
+    // Scale (xy) and offset (zw) from the scene to clip space
+    float view[4];
+} FrameUniforms;
+
 typedef struct {
+    Settings settings;
+    JobSystem *jobs;
     VkInstance instance;
     // Debug messenger used to route vulkan messages through the logger
     VkDebugUtilsMessengerEXT debug_messenger;
-    // Window surface
+    // Window surface (VK_NULL_HANDLE in headless mode)
     VkSurfaceKHR surface;
     VkPhysicalDevice physical_device;
     QueueFamilyIndices queue_family_indices;
     SwapChainSupportDetails swapchain_support;
 
     VkDevice device;
+    Allocator allocator;
+    // Set layouts, shared by every pipeline layout
+    DescriptorLayoutCache descriptor_layouts;
+    // Uniforms written when recording, a region per frame in flight (or per image with cached command buffers)
+    UniformRing uniforms;
+    // Uploads of data to device local memory
+    StagingRing staging;
     SwapChainConfig config;
     VkSwapchainKHR swapchain;
+    // Swapchain images, or device owned images in headless mode
     VkImageVec images;
+    // Memory backing the images in headless mode
+    AllocationVec offscreen_allocations;
     VkImageViewVec image_views;
+    // Waited on by the presentation of each image (empty in headless mode)
+    VkSemaphoreVec render_finished_semaphores;
+    // Empty with dynamic rendering
     VkFramebufferVec framebuffers;
-    VkRenderPass render_pass;
+    // The render pass (VK_NULL_HANDLE with dynamic rendering) and format the pipelines are created for
+    RenderTarget target;
+    // vkCmdBeginRenderingKHR and vkCmdEndRenderingKHR (only loaded with dynamic rendering)
+    PFN_vkCmdBeginRenderingKHR begin_rendering;
+    PFN_vkCmdEndRenderingKHR end_rendering;
+    // Used for all pipeline creations, persisted across runs
+    VkPipelineCache pipeline_cache;
     VkPipelineLayout pipeline_layout;
     VkPipeline graphics_pipeline;
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffers[CONCURENT_FRAMES];
-    VkSemaphore image_available_semaphores[CONCURENT_FRAMES];
-    VkSemaphore render_finished_semaphores[CONCURENT_FRAMES];
-    VkFence in_flight_fences[CONCURENT_FRAMES];
+
+    // Per frame in flight objects, see _ctx_create_frames
+    uint32_t frames_in_flight;
+    VkCommandBufferVec command_buffers;
+    VkSemaphoreVec image_available_semaphores;
+    // Empty with settings.timeline_sync, frames are waited on through frame_timeline
+    VkFenceVec in_flight_fences;
+    // Timestamps of the start and end of each GPU pass
+    VkQueryPoolVec timestamp_pools;
+    // Whether the pool has been written to by a submitted frame, and has results to read
+    BoolVec timestamps_pending;
+    // When the frame was last submitted (0 if it never was)
+    U64Vec submit_times;
+    // Number of the frame last submitted with each frame in flight (0 if none was)
+    U64Vec frame_numbers;
+    FramesInFlightTuner tuner;
+
+    // One per framebuffer if settings.cache_commands is set, see _ctx_create_cached_commands
+    uint32_t cached_commands_count;
+    CachedCommands *cached_commands;
+
+    // Geometry drawn
+    Mesh mesh;
+    // Written every frame (to the frame's buffer), or once with cached commands (which all use the first buffer)
+    InstanceSet instances;
+    uint64_t last_instance_update;
+    // Culling pass and the draws it writes, one buffer per instance buffer (only used if settings.gpu_culling is set)
+    Culler culler;
+    // Overlay drawn over the instances (only used if settings.sprite_count > 0)
+    SpriteBatch sprites;
+    // Textures loaded asynchronously (see settings.textures), moved forward every frame
+    TextureLoader textures;
+    // Set every texture is reached through (only used if settings.bindless is set), and the index of each texture in
+    // it plus one (0 until the texture is ready)
+    BindlessTable bindless;
+    uint32_t *texture_slots;
+    // Draws recorded each frame
+    uint32_t draw_count;
+    DrawCommand *draws;
+    DrawConstants *draw_constants;
+    // Parallel recording of the draw list (only used if settings.record_slices > 0)
+    Recorder recorder;
+    // Secondary buffers recorded by the recorder for the current frame (one per slice at most)
+    VkCommandBuffer *secondary_buffers;
+
+    // Nanoseconds per timestamp tick (0 if timestamps aren't supported by the graphics queue)
+    double timestamp_period;
+    // Mask of the valid bits of the timestamps
+    uint64_t timestamp_mask;
 
     VkQueue graphics_queue;
     VkQueue present_queue;
+    VkQueue compute_queue;
+    VkQueue transfer_queue;
 
     uint32_t current_frame;
     bool framebuffer_resized;
+    // While the window is being resized, frames are still rendered to the current swapchain (letterboxed to keep their
+    // aspect ratio once scaled to the window), and the swapchain is only rebuilt once the size is stable.
+    // Time and size of the last resize event
+    uint64_t last_resize;
+    VkExtent2D window_extent;
+    // Part of the images drawn to (the whole image unless letterboxed)
+    VkRect2D draw_area;
+    // Resize events folded into an already pending rebuild (each would have been a rebuild without coalescing)
+    uint64_t rebuilds_avoided;
+    // Number of frames submitted, and number of the last frame known to have completed
+    uint64_t frame_number;
+    uint64_t completed_frame;
+    // Signaled with the number of each frame when it completes (only used if settings.timeline_sync is set)
+    VkSemaphore frame_timeline;
+    // Objects destroyed once the frames that can use them have completed
+    DeletionQueue deletion_queue;
+
+    // CPU time spent in each part of the frame
+    FrameTimer timer;
+    // Paces the frames with LatencyCapped (disabled otherwise)
+    FrameLimiter limiter;
 } GraphicContext;
 
 typedef struct {
+    // NULL in headless mode
     GLFWwindow *win;
     GraphicContext ctx;
 } Window;
@@ -123,6 +312,34 @@ static const uint32_t REQUIRED_EXTENSIONS_COUNT = sizeof(REQUIRED_EXTENSIONS) /
 static const char *REQUIRED_DEVICE_EXTENSIONS[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 static const uint32_t REQUIRED_DEVICE_EXTENSIONS_COUNT = sizeof(REQUIRED_DEVICE_EXTENSIONS) / sizeof(char *);
 
+static const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+static const uint32_t MAX_FRAMES_IN_FLIGHT = 8;
+
+// Number of frames between two decisions of the frames in flight tuner
+static const uint32_t TUNER_WINDOW = 120;
+// Share of the frame time spent waiting on fences above which the GPU is considered the bottleneck
+static const double TUNER_GPU_BOUND_WAIT = 0.3;
+// Share of the frame time spent waiting on fences under which the GPU can be starved by CPU spikes
+static const double TUNER_STARVED_WAIT = 0.05;
+// Ratio of the p99 over the p50 frame time above which frame times are considered spiky
+static const double TUNER_SPIKE_RATIO = 1.5;
+// Bounds of the tuned frames in flight
+static const uint32_t TUNER_MIN_FRAMES = 1;
+static const uint32_t TUNER_MAX_FRAMES = 4;
+// Frames in flight kept when GPU bound, so that the CPU can work on a frame while the GPU does on another
+static const uint32_t TUNER_GPU_BOUND_MIN_FRAMES = 2;
+
+// Format of the images rendered to in headless mode
+static const VkFormat OFFSCREEN_FORMAT = VK_FORMAT_B8G8R8A8_SRGB;
+// Frames rendered before exiting in headless mode, if no limit is given
+static const uint64_t DEFAULT_HEADLESS_FRAME_LIMIT = 1000;
+
+// Instance counts are benchmarked by powers of ten up to this one
+static const uint32_t BENCHMARK_MAX_INSTANCES = 1000000;
+// Frames rendered for each instance count (if no limit is given), after some frames to warm up
+static const uint64_t BENCHMARK_FRAMES = 200;
+static const uint64_t BENCHMARK_WARMUP_FRAMES = 10;
+
 __attribute__((aligned(4))) static const uint8_t VERTEX_SHADER[] = {
 #include "include/shader.vert.spv.bytes"
 };
@@ -157,10 +374,15 @@ void swapchain_support_details_drop(SwapChainSupportDetails swpd) {
         free(swpd.present_modes);
 }
 
+// surface can be VK_NULL_HANDLE (headless), in which case the present queue is the graphics queue. The first matching
+// family is picked for each, and the graphics family is preferred for presentation.
 QueueFamilyIndices queue_family_indices_init(VkPhysicalDevice dev, VkSurfaceKHR surface) {
     QueueFamilyIndices idx;
     idx.graphics = -1;
     idx.present = -1;
+    idx.compute = -1;
+    idx.transfer = -1;
+    bool graphics_present = false;
 
     uint32_t count;
     vkGetPhysicalDeviceQueueFamilyProperties(dev, &count, NULL);
@@ -170,15 +392,37 @@ QueueFamilyIndices queue_family_indices_init(VkPhysicalDevice dev, VkSurfaceKHR
     vkGetPhysicalDeviceQueueFamilyProperties(dev, &count, props);
     for (uint32_t i = 0; i < count; i++) {
         VkQueueFamilyProperties queue = props[i];
-        VkBool32 present_support;
-        vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, surface, &present_support);
+        VkBool32 present_support = VK_FALSE;
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, surface, &present_support);
+        }
 
-        if (queue.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        bool graphics = queue.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+        bool compute = queue.queueFlags & VK_QUEUE_COMPUTE_BIT;
+        if (graphics && idx.graphics < 0) {
             idx.graphics = i;
+            graphics_present = present_support;
         }
-        if (present_support) {
+        if (present_support && idx.present < 0) {
             idx.present = i;
         }
+        if (compute && !graphics && idx.compute < 0) {
+            idx.compute = i;
+        }
+        if ((queue.queueFlags & VK_QUEUE_TRANSFER_BIT) && !graphics && !compute && idx.transfer < 0) {
+            idx.transfer = i;
+        }
+    }
+
+    if (surface == VK_NULL_HANDLE || graphics_present) {
+        idx.present = idx.graphics;
+    }
+    // Graphics queues support compute and transfers
+    if (idx.compute < 0) {
+        idx.compute = idx.graphics;
+    }
+    if (idx.transfer < 0) {
+        idx.transfer = idx.graphics;
     }
 
     free(props);
@@ -187,6 +431,325 @@ QueueFamilyIndices queue_family_indices_init(VkPhysicalDevice dev, VkSurfaceKHR
 
 bool queue_family_indices_complete(QueueFamilyIndices *idx) { return idx->present >= 0 && idx->graphics >= 0; }
 
+static inline VkSurfaceFormatKHR choose_surface_format(SwapChainSupportDetails *details) {
+    // Default to the first one
+    VkSurfaceFormatKHR res = details->formats[0];
+    // Prefer BGRA8 SRGB if available
+    for (uint32_t i = 0; i < details->formats_count; i++) {
+        VkSurfaceFormatKHR format = details->formats[i];
+        if (format.format == VK_FORMAT_B8G8R8A8_SRGB && format.colorSpace == VK_COLORSPACE_SRGB_NONLINEAR_KHR) {
+            res = format;
+        }
+    }
+    return res;
+}
+
+static inline bool present_mode_supported(SwapChainSupportDetails *details, VkPresentModeKHR mode) {
+    for (uint32_t i = 0; i < details->present_modes_count; i++) {
+        if (details->present_modes[i] == mode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline VkPresentModeKHR choose_present_mode(SwapChainSupportDetails *details, LatencyPolicy policy) {
+    switch (policy) {
+    case LatencyLowest:
+        if (present_mode_supported(details, VK_PRESENT_MODE_IMMEDIATE_KHR)) {
+            return VK_PRESENT_MODE_IMMEDIATE_KHR;
+        }
+        if (present_mode_supported(details, VK_PRESENT_MODE_MAILBOX_KHR)) {
+            return VK_PRESENT_MODE_MAILBOX_KHR;
+        }
+        break;
+    case LatencyVsync:
+        // Presents late frames right away instead of holding them for another refresh
+        if (present_mode_supported(details, VK_PRESENT_MODE_FIFO_RELAXED_KHR)) {
+            return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        }
+        break;
+    case LatencyBalanced:
+    case LatencyCapped:
+        if (present_mode_supported(details, VK_PRESENT_MODE_MAILBOX_KHR)) {
+            return VK_PRESENT_MODE_MAILBOX_KHR;
+        }
+        break;
+    }
+    // Always available
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// Whether dev supports the extension
+bool device_extension_supported(VkPhysicalDevice dev, const char *name) {
+    VkExtensionPropertiesVec device_extensions = vec_init();
+    vk_get_vec(&device_extensions, vkEnumerateDeviceExtensionProperties(dev, NULL, count, ptr));
+
+    bool res = false;
+    for (int i = 0; i < device_extensions.len && !res; i++) {
+        res = strcmp(name, device_extensions.data[i].extensionName) == 0;
+    }
+
+    vec_drop(device_extensions);
+    return res;
+}
+
+// Whether dev supports every required device extension, missing is set to the first one that isn't otherwise
+bool device_extensions_supported(VkPhysicalDevice dev, const char **missing) {
+    for (int i = 0; i < REQUIRED_DEVICE_EXTENSIONS_COUNT; i++) {
+        if (!device_extension_supported(dev, REQUIRED_DEVICE_EXTENSIONS[i])) {
+            *missing = REQUIRED_DEVICE_EXTENSIONS[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+// Suitability and score of a physical device, filled by probe_device
+typedef struct {
+    VkPhysicalDevice device;
+    VkSurfaceKHR surface;
+    bool headless;
+    const char *preferred_name;
+    VkPhysicalDeviceProperties props;
+    QueueFamilyIndices idx;
+    // Why the device can't be used (empty if it can)
+    char skip_reason[VK_MAX_EXTENSION_NAME_SIZE + 32];
+    int32_t score;
+} DeviceProbe;
+
+// Job probing a physical device, probes are independent from each other and can run in parallel (they don't log, as
+// the logger isn't thread safe)
+static void probe_device(void *data) {
+    DeviceProbe *probe = data;
+    VkPhysicalDevice dev = probe->device;
+
+    probe->skip_reason[0] = '\0';
+    probe->score = -1;
+    probe->idx = queue_family_indices_init(dev, probe->surface);
+    vkGetPhysicalDeviceProperties(dev, &probe->props);
+
+    // Conditions preventing this device from being choosen altogether
+    {
+        // Timeline semaphores are core in 1.2
+        if (probe->props.apiVersion < VK_API_VERSION_1_2) {
+            snprintf(probe->skip_reason, sizeof(probe->skip_reason), "vulkan 1.2 isn't supported");
+            return;
+        }
+
+        // Make sure the device supports all the required queue families
+        if (!queue_family_indices_complete(&probe->idx)) {
+            snprintf(probe->skip_reason, sizeof(probe->skip_reason), "missing queue family");
+            return;
+        }
+
+        // Make sure the device supports all the required device extensions
+        const char *missing = NULL;
+        if (!probe->headless && !device_extensions_supported(dev, &missing)) {
+            snprintf(probe->skip_reason, sizeof(probe->skip_reason), "extension %s not supported", missing);
+            return;
+        }
+
+        bool swapchain_adequate = true;
+        if (!probe->headless) {
+            SwapChainSupportDetails details = swapchain_support_details_init(dev, probe->surface);
+            swapchain_adequate = details.formats_count != 0 && details.present_modes_count != 0;
+            swapchain_support_details_drop(details);
+        }
+
+        if (!swapchain_adequate) {
+            snprintf(probe->skip_reason, sizeof(probe->skip_reason), "swapchain isn't adequate");
+            return;
+        }
+    }
+
+    // The device is valid, now compute its score to see if it is the best one.
+    probe->score = 0;
+    switch (probe->props.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        probe->score += 10;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        probe->score += 5;
+        break;
+    default:
+        break;
+    }
+    // Dedicated queues let compute and copies overlap with graphics work
+    if (probe->idx.compute != probe->idx.graphics) {
+        probe->score += 1;
+    }
+    if (probe->idx.transfer != probe->idx.graphics) {
+        probe->score += 1;
+    }
+
+    if (strstr(probe->props.deviceName, probe->preferred_name)) {
+        probe->score = 9999;
+    }
+}
+
+#define DEVICE_CACHE_MAGIC 0x56444556
+#define DEVICE_CACHE_VERSION 3
+
+// The physical device selected on a previous run, and the choices made for it. Devices are identified by their IDs,
+// driver version and pipeline cache UUID.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    int64_t graphics;
+    int64_t present;
+    int64_t compute;
+    int64_t transfer;
+    VkSurfaceFormatKHR format;
+    VkPresentModeKHR present_mode;
+    // The context the selection was made in
+    bool headless;
+    char preferred_device[256];
+} DeviceCache;
+
+static inline bool device_cache_matches(DeviceCache *cache, VkPhysicalDeviceProperties *props) {
+    return cache->vendor_id == props->vendorID && cache->device_id == props->deviceID &&
+           cache->driver_version == props->driverVersion &&
+           memcmp(cache->pipeline_cache_uuid, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Load the device selected on a previous run, and check that it is still there and suitable (as the checks are only
+// done on that device, it is much cheaper than probing all of them). On success, sets dev, idx and details (if not
+// headless).
+bool device_cache_load(
+    const char *path,
+    VkPhysicalDeviceVec *devices,
+    VkSurfaceKHR surface,
+    bool headless,
+    const char *preferred_device,
+    VkPhysicalDevice *dev,
+    QueueFamilyIndices *idx,
+    SwapChainSupportDetails *details
+) {
+    size_t size = 0;
+    DeviceCache *cache = fs_read_file(path, &size);
+    if (cache == NULL) {
+        return false;
+    }
+
+    const char *reason = NULL;
+    VkPhysicalDevice found = VK_NULL_HANDLE;
+    if (size != sizeof(DeviceCache) || cache->magic != DEVICE_CACHE_MAGIC || cache->version != DEVICE_CACHE_VERSION) {
+        reason = "invalid file";
+    } else if (cache->headless != headless || strncmp(cache->preferred_device, preferred_device, 256) != 0) {
+        reason = "settings changed";
+    } else {
+        for (uint32_t i = 0; i < devices->len && found == VK_NULL_HANDLE; i++) {
+            VkPhysicalDeviceProperties props;
+            vkGetPhysicalDeviceProperties(devices->data[i], &props);
+            if (device_cache_matches(cache, &props)) {
+                found = devices->data[i];
+            }
+        }
+        if (found == VK_NULL_HANDLE) {
+            reason = "device not found";
+        }
+    }
+
+    // Check the cached choices against the device's current support
+    SwapChainSupportDetails support = {0};
+    if (reason == NULL) {
+        uint32_t count;
+        vkGetPhysicalDeviceQueueFamilyProperties(found, &count, NULL);
+        VkQueueFamilyProperties *queue_props = malloc(count * sizeof(VkQueueFamilyProperties));
+        assert_alloc(queue_props);
+        vkGetPhysicalDeviceQueueFamilyProperties(found, &count, queue_props);
+
+        VkBool32 present_support = headless;
+        if (cache->graphics >= 0 && cache->graphics < count && cache->present >= 0 && cache->present < count && !headless) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(found, cache->present, surface, &present_support);
+        }
+        bool graphics_valid = cache->graphics >= 0 && cache->graphics < count &&
+                              (queue_props[cache->graphics].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+        bool compute_valid = cache->compute >= 0 && cache->compute < count &&
+                             (queue_props[cache->compute].queueFlags & VK_QUEUE_COMPUTE_BIT);
+        bool transfer_valid = cache->transfer >= 0 && cache->transfer < count &&
+                              (queue_props[cache->transfer].queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT));
+        if (!graphics_valid || !present_support || !compute_valid || !transfer_valid) {
+            reason = "queue families changed";
+        }
+        free(queue_props);
+    }
+    const char *missing = NULL;
+    if (reason == NULL && !headless && !device_extensions_supported(found, &missing)) {
+        reason = "extension no longer supported";
+    }
+    if (reason == NULL && !headless) {
+        support = swapchain_support_details_init(found, surface);
+        if (support.formats_count == 0 || support.present_modes_count == 0) {
+            reason = "swapchain isn't adequate";
+        } else {
+            VkSurfaceFormatKHR format = choose_surface_format(&support);
+            if (format.format != cache->format.format || format.colorSpace != cache->format.colorSpace ||
+                choose_present_mode(&support, LatencyBalanced) != cache->present_mode) {
+                reason = "surface support changed";
+            }
+        }
+        if (reason != NULL) {
+            swapchain_support_details_drop(support);
+        }
+    }
+
+    if (reason != NULL) {
+        log_info("Ignoring device cache '%s' (%s)", path, reason);
+        free(cache);
+        return false;
+    }
+
+    *dev = found;
+    idx->graphics = cache->graphics;
+    idx->present = cache->present;
+    idx->compute = cache->compute;
+    idx->transfer = cache->transfer;
+    if (!headless) {
+        *details = support;
+    }
+    free(cache);
+    return true;
+}
+
+// Remember the selected device for the next runs
+void device_cache_save(
+    const char *path,
+    VkPhysicalDeviceProperties *props,
+    QueueFamilyIndices *idx,
+    SwapChainSupportDetails *details,
+    bool headless,
+    const char *preferred_device
+) {
+    DeviceCache cache = {0};
+    cache.magic = DEVICE_CACHE_MAGIC;
+    cache.version = DEVICE_CACHE_VERSION;
+    cache.vendor_id = props->vendorID;
+    cache.device_id = props->deviceID;
+    cache.driver_version = props->driverVersion;
+    memcpy(cache.pipeline_cache_uuid, props->pipelineCacheUUID, VK_UUID_SIZE);
+    cache.graphics = idx->graphics;
+    cache.present = idx->present;
+    cache.compute = idx->compute;
+    cache.transfer = idx->transfer;
+    if (!headless) {
+        cache.format = choose_surface_format(details);
+        // Only used to notice changes of the surface's support, whatever the policy of the run
+        cache.present_mode = choose_present_mode(details, LatencyBalanced);
+    }
+    cache.headless = headless;
+    strncpy(cache.preferred_device, preferred_device, sizeof(cache.preferred_device) - 1);
+
+    if (!fs_write_file_atomic(path, &cache, sizeof(cache))) {
+        log_warn("Failed to save device cache to '%s'", path);
+    }
+}
+
 VkResult create_shader_module(VkDevice dev, const uint32_t *data, size_t len, VkShaderModule *module) {
     VkShaderModuleCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -258,31 +821,15 @@ static inline VkDebugUtilsMessengerCreateInfoEXT debug_messenger_create_info() {
     return create_info;
 }
 
-// Configure swapchain according to what it supports and the window
-static inline SwapChainConfig configure_swapchain(SwapChainSupportDetails *details, Window *win) {
+// Configure swapchain according to what it supports, the window and the latency policy, image_count is the requested
+// number of images (0 for the default: one more than the minimum, or the minimum when presenting immediately)
+static inline SwapChainConfig configure_swapchain(
+    SwapChainSupportDetails *details, Window *win, LatencyPolicy policy, uint32_t image_count
+) {
     SwapChainConfig cfg;
 
-    // Format
-    // Default to the first one
-    cfg.format = details->formats[0];
-    // Prefer BGRA8 SRGB if available
-    for (uint32_t i = 0; i < details->formats_count; i++) {
-        VkSurfaceFormatKHR format = details->formats[i];
-        if (format.format == VK_FORMAT_B8G8R8A8_SRGB && format.colorSpace == VK_COLORSPACE_SRGB_NONLINEAR_KHR) {
-            cfg.format = format;
-        }
-    }
-
-    // Present mode
-    // Default to FIFO (always available)
-    cfg.present_mode = VK_PRESENT_MODE_FIFO_KHR;
-    // Prefer mailbox if possible
-    for (uint32_t i = 0; i < details->present_modes_count; i++) {
-        VkPresentModeKHR mode = details->present_modes[i];
-        if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            cfg.present_mode = mode;
-        }
-    }
+    cfg.format = choose_surface_format(details);
+    cfg.present_mode = choose_present_mode(details, policy);
 
     // Extent
     if (details->capabilities.currentExtent.width != UINT32_MAX) {
@@ -307,6 +854,16 @@ static inline SwapChainConfig configure_swapchain(SwapChainSupportDetails *detai
 
     // Image count
     cfg.image_count = details->capabilities.minImageCount + 1;
+    // Frames don't queue up behind each other when presented immediately (mailbox needs a spare image to replace)
+    if (policy == LatencyLowest && cfg.present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+        cfg.image_count = details->capabilities.minImageCount;
+    }
+    if (image_count != 0) {
+        cfg.image_count = image_count;
+        if (cfg.image_count < details->capabilities.minImageCount) {
+            cfg.image_count = details->capabilities.minImageCount;
+        }
+    }
     if (details->capabilities.maxImageCount > 0 && cfg.image_count > details->capabilities.maxImageCount) {
         cfg.image_count = details->capabilities.maxImageCount;
     }
@@ -361,7 +918,32 @@ static inline VkResult create_swapchain(
 // Create the images views of the context, assumes ctx->image_views is initialized.
 // Needs: images, config, device
 // Note: overrides previous views
+// Create the semaphores the presentation of each swapchain image waits on. They are per image rather than per frame
+// in flight: a presentation is only known to be done with its semaphore once its image is acquired again, which
+// waiting for the device doesn't cover (so they can't go with the frames in flight when their number changes).
+void _ctx_create_render_finished_semaphores(GraphicContext *ctx) {
+    VkSemaphoreCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    vec_grow(&ctx->render_finished_semaphores, ctx->images.len);
+    for (size_t i = 0; i < ctx->images.len; i++) {
+        vk_try(
+            vkCreateSemaphore(ctx->device, &create_info, NULL, &ctx->render_finished_semaphores.data[i]),
+            "Failed to create semaphore"
+        );
+    }
+    ctx->render_finished_semaphores.len = ctx->images.len;
+}
+
 void _ctx_create_image_views(GraphicContext *ctx) {
+    // Cached command buffers use a region of the uniform ring per image (the implementation can return more images
+    // than requested)
+    assert(
+        !ctx->settings.cache_commands || ctx->images.len <= UNIFORM_RING_REGIONS,
+        "Too many swapchain images for cached command buffers (%u, at most %u)",
+        (uint32_t)ctx->images.len,
+        UNIFORM_RING_REGIONS
+    );
     vec_grow(&ctx->image_views, ctx->images.len);
     for (size_t i = 0; i < ctx->images.len; i++) {
         VkImageViewCreateInfo create_info = {0};
@@ -390,10 +972,13 @@ void _ctx_create_image_views(GraphicContext *ctx) {
     ctx->image_views.len = ctx->images.len;
 }
 
-// Create the framebuffers of the context, assumes ctx->framebuffers is initialized.
-// Needs: image_views, render_pass, config, device
+// Create the framebuffers of the context, assumes ctx->framebuffers is initialized (no-op with dynamic rendering).
+// Needs: image_views, target, config, device
 // Note: overrides previous framebuffers
 void _ctx_create_framebuffers(GraphicContext *ctx) {
+    if (ctx->target.render_pass == VK_NULL_HANDLE) {
+        return;
+    }
     vec_grow(&ctx->framebuffers, ctx->image_views.len);
 
     for (size_t i = 0; i < ctx->image_views.len; i++) {
@@ -401,7 +986,7 @@ void _ctx_create_framebuffers(GraphicContext *ctx) {
 
         VkFramebufferCreateInfo create_info = {0};
         create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        create_info.renderPass = ctx->render_pass;
+        create_info.renderPass = ctx->target.render_pass;
         create_info.attachmentCount = 1;
         create_info.pAttachments = attachments;
         create_info.width = ctx->config.extent.width;
@@ -414,16 +999,238 @@ void _ctx_create_framebuffers(GraphicContext *ctx) {
     ctx->framebuffers.len = ctx->image_views.len;
 }
 
+// Create the images rendered to in headless mode (in place of the swapchain's), assumes ctx->images and
+// ctx->offscreen_allocations are initialized.
+// Needs: config, device, allocator
+void _ctx_create_offscreen_images(GraphicContext *ctx) {
+    vec_grow(&ctx->images, ctx->config.image_count);
+    vec_grow(&ctx->offscreen_allocations, ctx->config.image_count);
+
+    for (size_t i = 0; i < ctx->config.image_count; i++) {
+        VkImageCreateInfo create_info = {0};
+        create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        create_info.imageType = VK_IMAGE_TYPE_2D;
+        create_info.format = ctx->config.format.format;
+        create_info.extent.width = ctx->config.extent.width;
+        create_info.extent.height = ctx->config.extent.height;
+        create_info.extent.depth = 1;
+        create_info.mipLevels = 1;
+        create_info.arrayLayers = 1;
+        create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        vk_try(vkCreateImage(ctx->device, &create_info, NULL, &ctx->images.data[i]), "Failed to create offscreen image #%lu", i);
+
+        vk_try(
+            allocator_bind_image(
+                &ctx->allocator,
+                ctx->images.data[i],
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                0,
+                &ctx->offscreen_allocations.data[i]
+            ),
+            "Failed to allocate offscreen image memory"
+        );
+    }
+
+    ctx->images.len = ctx->config.image_count;
+    ctx->offscreen_allocations.len = ctx->config.image_count;
+}
+
+// Destroy the images rendered to in headless mode, along with their views and framebuffers
+void _ctx_destroy_offscreen_images(GraphicContext *ctx) {
+    vec_foreach(&ctx->framebuffers, fb, vkDestroyFramebuffer(ctx->device, fb, NULL));
+    vec_foreach(&ctx->image_views, view, vkDestroyImageView(ctx->device, view, NULL));
+    vec_foreach(&ctx->images, image, vkDestroyImage(ctx->device, image, NULL));
+    for (size_t i = 0; i < ctx->offscreen_allocations.len; i++) {
+        allocator_free(&ctx->allocator, &ctx->offscreen_allocations.data[i]);
+    }
+    vec_clear(&ctx->framebuffers);
+    vec_clear(&ctx->image_views);
+    vec_clear(&ctx->images);
+    vec_clear(&ctx->offscreen_allocations);
+}
+
+// Create the objects used by each frame in flight, assumes their vectors are initialized and empty.
+// Needs: frames_in_flight, command_pool, timestamp_period, device
+void _ctx_create_frames(GraphicContext *ctx) {
+    uint32_t count = ctx->frames_in_flight;
+
+    vec_grow(&ctx->command_buffers, count);
+    vec_grow(&ctx->image_available_semaphores, count);
+    vec_grow(&ctx->in_flight_fences, count);
+
+    // Command buffers
+    {
+        VkCommandBufferAllocateInfo alloc_info = {0};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = ctx->command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = count;
+
+        vk_try(
+            vkAllocateCommandBuffers(ctx->device, &alloc_info, ctx->command_buffers.data), "Failed to allocate command buffer"
+        );
+        ctx->command_buffers.len = count;
+    }
+
+    // Synchronisation
+    {
+        VkSemaphoreCreateInfo semaphore_create_info = {0};
+        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkFenceCreateInfo fence_create_info = {0};
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        for (size_t i = 0; i < count; i++) {
+            vk_try(
+                vkCreateSemaphore(ctx->device, &semaphore_create_info, NULL, &ctx->image_available_semaphores.data[i]),
+                "Failed to create semaphore"
+            );
+            if (!ctx->settings.timeline_sync) {
+                vk_try(
+                    vkCreateFence(ctx->device, &fence_create_info, NULL, &ctx->in_flight_fences.data[i]), "Failed to create fence"
+                );
+            }
+            vec_push(&ctx->submit_times, 0);
+            vec_push(&ctx->frame_numbers, 0);
+        }
+        ctx->image_available_semaphores.len = count;
+        ctx->in_flight_fences.len = ctx->settings.timeline_sync ? 0 : count;
+    }
+
+    // Timestamp queries
+    if (ctx->timestamp_period > 0.0) {
+        VkQueryPoolCreateInfo create_info = {0};
+        create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount = GPU_PASS_COUNT * 2;
+
+        for (size_t i = 0; i < count; i++) {
+            VkQueryPool pool;
+            vk_try(vkCreateQueryPool(ctx->device, &create_info, NULL, &pool), "Failed to create query pool");
+            vec_push(&ctx->timestamp_pools, pool);
+            vec_push(&ctx->timestamps_pending, false);
+        }
+    }
+}
+
+// Destroy the objects used by each frame in flight, they mustn't be in use by the device anymore
+void _ctx_destroy_frames(GraphicContext *ctx) {
+    vkFreeCommandBuffers(ctx->device, ctx->command_pool, ctx->command_buffers.len, ctx->command_buffers.data);
+    vec_foreach(&ctx->in_flight_fences, fence, vkDestroyFence(ctx->device, fence, NULL));
+    vec_foreach(&ctx->image_available_semaphores, semaphore, vkDestroySemaphore(ctx->device, semaphore, NULL));
+    vec_foreach(&ctx->timestamp_pools, pool, vkDestroyQueryPool(ctx->device, pool, NULL));
+
+    vec_clear(&ctx->command_buffers);
+    vec_clear(&ctx->in_flight_fences);
+    vec_clear(&ctx->image_available_semaphores);
+    vec_clear(&ctx->timestamp_pools);
+    vec_clear(&ctx->timestamps_pending);
+    vec_clear(&ctx->submit_times);
+    vec_clear(&ctx->frame_numbers);
+}
+
+// Allocate the cached command buffers, one per image, all of them dirty (no-op unless commands are cached).
+// Needs: image_views, command_pool, timestamp_period, device
+void _ctx_create_cached_commands(GraphicContext *ctx) {
+    if (!ctx->settings.cache_commands) {
+        return;
+    }
+
+    uint32_t count = ctx->image_views.len;
+    VkCommandBuffer *buffers = malloc(count * sizeof(VkCommandBuffer));
+    ctx->cached_commands = malloc(count * sizeof(CachedCommands));
+    assert_alloc(buffers);
+    assert_alloc(ctx->cached_commands);
+    ctx->cached_commands_count = count;
+
+    VkCommandBufferAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = ctx->command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = count;
+
+    vk_try(vkAllocateCommandBuffers(ctx->device, &alloc_info, buffers), "Failed to allocate cached command buffers");
+
+    VkQueryPoolCreateInfo pool_create_info = {0};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_create_info.queryCount = GPU_PASS_COUNT * 2;
+
+    for (uint32_t i = 0; i < count; i++) {
+        CachedCommands *cached = &ctx->cached_commands[i];
+        cached->buffer = buffers[i];
+        cached->dirty = true;
+        cached->frame = 0;
+        cached->timestamps = VK_NULL_HANDLE;
+        cached->timestamps_pending = false;
+        if (ctx->timestamp_period > 0.0) {
+            vk_try(
+                vkCreateQueryPool(ctx->device, &pool_create_info, NULL, &cached->timestamps), "Failed to create query pool"
+            );
+        }
+    }
+
+    free(buffers);
+}
+
+// Free the cached command buffers, once the frames submitted so far have completed
+void _ctx_destroy_cached_commands(GraphicContext *ctx) {
+    for (uint32_t i = 0; i < ctx->cached_commands_count; i++) {
+        CachedCommands *cached = &ctx->cached_commands[i];
+        DeferredObject buffer = {.kind = DeferredCommandBuffer};
+        buffer.command_buffer.pool = ctx->command_pool;
+        buffer.command_buffer.buffer = cached->buffer;
+        deletion_queue_push(&ctx->deletion_queue, ctx->frame_number, buffer);
+        if (cached->timestamps != VK_NULL_HANDLE) {
+            DeferredObject pool = {.kind = DeferredQueryPool, .query_pool = cached->timestamps};
+            deletion_queue_push(&ctx->deletion_queue, ctx->frame_number, pool);
+        }
+    }
+    free(ctx->cached_commands);
+    ctx->cached_commands = NULL;
+    ctx->cached_commands_count = 0;
+}
+
+// Mark every cached command buffer as needing to be recorded again, to be called whenever something they reference
+// (pipeline, scene, ...) changes.
+void ctx_invalidate_commands(GraphicContext *ctx) {
+    for (uint32_t i = 0; i < ctx->cached_commands_count; i++) {
+        ctx->cached_commands[i].dirty = true;
+    }
+}
+
+// Point the culling pass at the current instance buffers, with room for every instance
+void _ctx_update_culler(GraphicContext *ctx) {
+    if (!ctx->settings.gpu_culling) {
+        return;
+    }
+    InstanceSet *instances = &ctx->instances;
+    culler_set_buffers(&ctx->culler, &ctx->allocator, instances->buffers, instances->buffer_count, instances->count);
+}
+
 void _ctx_recreate_swapchain(GraphicContext *ctx, Window *win) {
 
     VkSwapchainKHR old_swapchain = ctx->swapchain;
     VkImageViewVec old_image_views = ctx->image_views;
     VkFramebufferVec old_framebuffers = ctx->framebuffers;
+    VkSemaphoreVec old_render_finished_semaphores = ctx->render_finished_semaphores;
     SwapChainConfig old_config = ctx->config;
 
-    ctx->config = configure_swapchain(&ctx->swapchain_support, win);
+    // The capabilities (current extent, image counts, transform) change with the window
+    swapchain_support_details_drop(ctx->swapchain_support);
+    ctx->swapchain_support = swapchain_support_details_init(ctx->physical_device, ctx->surface);
+
+    ctx->config = configure_swapchain(&ctx->swapchain_support, win, ctx->settings.latency_policy, ctx->settings.image_count);
     ctx->image_views = (VkImageViewVec)vec_init();
     ctx->framebuffers = (VkFramebufferVec)vec_init();
+    ctx->render_finished_semaphores = (VkSemaphoreVec)vec_init();
 
     vk_try(
         create_swapchain(ctx->device, &ctx->config, ctx->surface, &ctx->queue_family_indices, old_swapchain, &ctx->swapchain),
@@ -434,15 +1241,44 @@ void _ctx_recreate_swapchain(GraphicContext *ctx, Window *win) {
 
     _ctx_create_image_views(ctx);
     _ctx_create_framebuffers(ctx);
+    _ctx_create_render_finished_semaphores(ctx);
+
+    // The image count may have changed, and the buffers reference the old framebuffers (or views) anyway
+    _ctx_destroy_cached_commands(ctx);
+    _ctx_create_cached_commands(ctx);
+    // The old buffers can still be reading the uniforms of their image: the new ones wait for the last submitted frame
+    // before being recorded
+    for (uint32_t i = 0; i < ctx->cached_commands_count; i++) {
+        ctx->cached_commands[i].frame = ctx->frame_number;
+    }
 
-    vkDeviceWaitIdle(ctx->device);
-
-    vec_foreach(&old_framebuffers, fb, vkDestroyFramebuffer(ctx->device, fb, NULL));
-    vec_foreach(&old_image_views, view, vkDestroyImageView(ctx->device, view, NULL));
-    vkDestroySwapchainKHR(ctx->device, old_swapchain, NULL);
+    // The frames in flight can still be using the old objects: instead of waiting for the device to be idle, retire
+    // them once those frames have completed
+    DeletionQueue *queue = &ctx->deletion_queue;
+    vec_foreach(
+        &old_framebuffers,
+        fb,
+        deletion_queue_push(queue, ctx->frame_number, (DeferredObject){.kind = DeferredFramebuffer, .framebuffer = fb})
+    );
+    vec_foreach(
+        &old_image_views,
+        view,
+        deletion_queue_push(queue, ctx->frame_number, (DeferredObject){.kind = DeferredImageView, .image_view = view})
+    );
+    deletion_queue_push(queue, ctx->frame_number, (DeferredObject){.kind = DeferredSwapchain, .swapchain = old_swapchain});
+    // After the swapchain, whose destruction waits for its presentations
+    vec_foreach(
+        &old_render_finished_semaphores,
+        semaphore,
+        deletion_queue_push(queue, ctx->frame_number, (DeferredObject){.kind = DeferredSemaphore, .semaphore = semaphore})
+    );
 
     vec_drop(old_framebuffers);
     vec_drop(old_image_views);
+    vec_drop(old_render_finished_semaphores);
+
+    // The new images match the window
+    ctx->draw_area = (VkRect2D){.offset = {0, 0}, .extent = ctx->config.extent};
 
 #ifndef LOG_DISABLE
     {
@@ -468,19 +1304,38 @@ void _ctx_recreate_swapchain(GraphicContext *ctx, Window *win) {
 #endif
 }
 
-GraphicContext ctx_init(const char *app_name, Window *win) {
+GraphicContext ctx_init(const char *app_name, Window *win, Settings *settings) {
     GraphicContext res = {0};
 
+    res.settings = *settings;
     res.current_frame = 0;
+    res.frames_in_flight = settings->frames_in_flight;
     res.framebuffer_resized = false;
+    res.last_resize = 0;
+    res.rebuilds_avoided = 0;
+    res.frame_number = 0;
+    res.completed_frame = 0;
+    res.deletion_queue = deletion_queue_init();
+    res.timer = frame_timer_init(settings->stats_interval * 1e9);
+    res.limiter = frame_limiter_init(settings->latency_policy == LatencyCapped ? settings->fps_cap : 0.0);
+    res.tuner = (FramesInFlightTuner){0};
+    res.tuner.enabled = settings->tune_frames_in_flight;
+    res.tuner.latency_target = settings->latency_target * 1e9;
+    res.jobs = job_system_init(settings->worker_threads);
+
+    bool headless = settings->headless;
 
     ConstStringVec required_exts = vec_init();
     ConstStringVec enabled_layers = vec_init();
 
     // Required extensions
     {
-        uint32_t glfw_ext_count;
-        const char **glfw_exts = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
+        uint32_t glfw_ext_count = 0;
+        const char **glfw_exts = NULL;
+        // Headless mode doesn't need any window system integration
+        if (!headless) {
+            glfw_exts = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
+        }
 
         vec_grow(&required_exts, glfw_ext_count + REQUIRED_EXTENSIONS_COUNT);
 
@@ -525,7 +1380,7 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
         appinfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appinfo.pEngineName = "None";
         appinfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appinfo.apiVersion = VK_API_VERSION_1_0;
+        appinfo.apiVersion = VK_API_VERSION_1_2;
 
         // Log the supported ext ensions
 #ifndef LOG_DISABLE
@@ -533,9 +1388,9 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
             VkExtensionPropertiesVec supported_exts = vec_init();
             vk_get_vec(&supported_exts, vkEnumerateInstanceExtensionProperties(NULL, count, ptr));
 
-            log_info("Availables vulkan extensions:");
+            log_debug("Availables vulkan extensions:");
             for (uint32_t i = 0; i < supported_exts.len; i++) {
-                log_info("    %s", supported_exts.data[i].extensionName);
+                log_debug("    %s", supported_exts.data[i].extensionName);
             }
 
             vec_drop(supported_exts);
@@ -580,7 +1435,11 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
     }
 
     // Surface
-    vk_try(glfwCreateWindowSurface(res.instance, win->win, NULL, &res.surface), "Failed to create window surface");
+    if (headless) {
+        res.surface = VK_NULL_HANDLE;
+    } else {
+        vk_try(glfwCreateWindowSurface(res.instance, win->win, NULL, &res.surface), "Failed to create window surface");
+    }
 
     // Physical Device
     {
@@ -601,7 +1460,7 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
                 uint32_t len = fread(preferred_device_name, 1, 255, override_file);
 
                 // Strip ending newline if present
-                if (preferred_device_name[len - 1] == '\n') {
+                if (len > 0 && preferred_device_name[len - 1] == '\n') {
                     preferred_device_name[len - 1] = '\0';
                 }
 
@@ -610,95 +1469,68 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
             }
         }
 
-        int32_t max_score = -1;
         VkPhysicalDeviceProperties final_device_props;
-        log_info("Suitable vulkan devices:");
-        for (uint32_t i = 0; i < devices.len; i++) {
-            VkPhysicalDevice dev = devices.data[i];
-            VkPhysicalDeviceProperties props;
-            VkPhysicalDeviceFeatures feats;
-            QueueFamilyIndices idx;
-            VkExtensionPropertiesVec device_extensions = vec_init();
-
-            idx = queue_family_indices_init(dev, res.surface);
-            vkGetPhysicalDeviceProperties(dev, &props);
-            vkGetPhysicalDeviceFeatures(dev, &feats);
-            vk_get_vec(&device_extensions, vkEnumerateDeviceExtensionProperties(dev, NULL, count, ptr));
-
-            // Conditions preventing this device from being choosen altogether
-            {
-                // Make sure the device supports all the required queue families
-                if (!queue_family_indices_complete(&idx)) {
-                    log_info("    (skipping '%s': missing queue family)", props.deviceName);
-                    goto skip_device;
-                }
+        bool cached = false;
+        if (settings->device_cache_path != NULL) {
+            cached = device_cache_load(
+                settings->device_cache_path,
+                &devices,
+                res.surface,
+                headless,
+                preferred_device_name,
+                &res.physical_device,
+                &res.queue_family_indices,
+                &res.swapchain_support
+            );
+        }
 
-                // Make sure the device supports all the required device extensions
-                for (int i = 0; i < REQUIRED_DEVICE_EXTENSIONS_COUNT; i++) {
-                    const char *ext = REQUIRED_DEVICE_EXTENSIONS[i];
-                    bool found = false;
-                    for (int j = 0; j < device_extensions.len; j++) {
-                        if (strcmp(ext, device_extensions.data[j].extensionName) == 0) {
-                            found = true;
-                            break;
-                        }
-                    }
+        if (cached) {
+            vkGetPhysicalDeviceProperties(res.physical_device, &final_device_props);
+        } else {
+            // Probe every device in parallel, and only log once they are all done
+            DeviceProbe *probes = malloc(devices.len * sizeof(DeviceProbe));
+            Job *jobs = malloc(devices.len * sizeof(Job));
+            assert_alloc(probes);
+            assert_alloc(jobs);
+            for (uint32_t i = 0; i < devices.len; i++) {
+                probes[i] = (DeviceProbe){0};
+                probes[i].device = devices.data[i];
+                probes[i].surface = res.surface;
+                probes[i].headless = headless;
+                probes[i].preferred_name = preferred_device_name;
+                jobs[i] = (Job){.func = probe_device, .data = &probes[i]};
+            }
 
-                    // Required extensions not supported, skip
-                    if (!found) {
-                        log_info("    (skipping '%s': extension %s not supported)", props.deviceName, ext);
-                        goto skip_device;
-                    }
-                }
+            JobCounter counter = 0;
+            job_system_run(res.jobs, jobs, devices.len, &counter);
+            job_system_wait(res.jobs, &counter);
 
-                bool swapchain_adequate;
-                {
-                    SwapChainSupportDetails details = swapchain_support_details_init(dev, res.surface);
-                    swapchain_adequate = details.formats_count != 0 && details.present_modes_count != 0;
-                    swapchain_support_details_drop(details);
-                }
+            int32_t max_score = -1;
+            log_info("Suitable vulkan devices:");
+            for (uint32_t i = 0; i < devices.len; i++) {
+                DeviceProbe *probe = &probes[i];
 
-                if (!swapchain_adequate) {
-                    log_info("    (skipping '%s': swapchain isn't adequate)", props.deviceName);
-                    goto skip_device;
+                if (probe->skip_reason[0] != '\0') {
+                    log_info("    (skipping '%s': %s)", probe->props.deviceName, probe->skip_reason);
+                    continue;
                 }
-            }
 
-            // The device is valid, now compute its score to see if it is the best one.
-            int32_t score = 0;
-            {
-                // Compute score
-                switch (props.deviceType) {
-                case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
-                    score += 10;
-                    break;
-                case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
-                    score += 5;
-                    break;
-                default:
-                    break;
+                if (probe->score >= 9999) {
+                    log_info("    '%s' (score: %d, preferred)", probe->props.deviceName, probe->score);
+                } else {
+                    log_info("    '%s' (score: %d)", probe->props.deviceName, probe->score);
                 }
 
-                if (strstr(props.deviceName, preferred_device_name)) {
-                    score = 9999;
+                if (probe->score > max_score) {
+                    max_score = probe->score;
+                    res.physical_device = probe->device;
+                    res.queue_family_indices = probe->idx;
+                    final_device_props = probe->props;
                 }
             }
 
-            if (score >= 9999) {
-                log_info("    '%s' (score: %d, preferred)", props.deviceName, score);
-            } else {
-                log_info("    '%s' (score: %d)", props.deviceName, score);
-            }
-
-            if (score > max_score) {
-                max_score = score;
-                res.physical_device = dev;
-                res.queue_family_indices = idx;
-                final_device_props = props;
-            }
-
-        skip_device:
-            vec_drop(device_extensions);
+            free(jobs);
+            free(probes);
         }
 
         vec_drop(devices);
@@ -707,27 +1539,50 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
             log_error("Couldn't find suitable vulkan device.");
             exit(1);
         } else {
-            res.swapchain_support = swapchain_support_details_init(res.physical_device, res.surface);
-            log_info("Selected vulkan device: '%s'", final_device_props.deviceName);
+            if (!headless && !cached) {
+                res.swapchain_support = swapchain_support_details_init(res.physical_device, res.surface);
+            }
+            if (!cached && settings->device_cache_path != NULL) {
+                device_cache_save(
+                    settings->device_cache_path,
+                    &final_device_props,
+                    &res.queue_family_indices,
+                    &res.swapchain_support,
+                    headless,
+                    preferred_device_name
+                );
+            }
+            log_info("Selected vulkan device: '%s'%s", final_device_props.deviceName, cached ? " (cached)" : "");
         }
     }
 
+    // Whether the draw count of indirect draws can be read from a buffer
+    bool draw_indirect_count = false;
+
     // Device
     {
-        float priority = 1.0;
         uint32_t queue_indices[MAX_QUEUE_COUNT] = {
             res.queue_family_indices.graphics,
             res.queue_family_indices.present,
+            res.queue_family_indices.compute,
+            res.queue_family_indices.transfer,
         };
+        // Frames come first, async compute should be scheduled ahead of background uploads
+        const float queue_priorities[MAX_QUEUE_COUNT] = {1.0f, 1.0f, 0.75f, 0.5f};
+        float priorities[MAX_QUEUE_COUNT];
         VkDeviceQueueCreateInfo queue_create_infos[MAX_QUEUE_COUNT] = {0};
         uint32_t queue_count = 0;
 
+        // One queue per distinct family, with the highest priority of its uses
         for (int i = 0; i < MAX_QUEUE_COUNT; i++) {
             uint32_t index = queue_indices[i];
             bool found = false;
-            for (int j = 0; i < queue_count; j++) {
+            for (int j = 0; j < queue_count; j++) {
                 if (queue_create_infos[j].queueFamilyIndex == index) {
                     found = true;
+                    if (queue_priorities[i] > priorities[j]) {
+                        priorities[j] = queue_priorities[i];
+                    }
                     break;
                 }
             }
@@ -735,22 +1590,90 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
                 continue;
             }
 
+            priorities[queue_count] = queue_priorities[i];
             queue_create_infos[queue_count].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
             queue_create_infos[queue_count].queueFamilyIndex = index;
             queue_create_infos[queue_count].queueCount = 1;
-            queue_create_infos[queue_count].pQueuePriorities = &priority;
+            queue_create_infos[queue_count].pQueuePriorities = &priorities[queue_count];
             queue_count++;
         }
 
-        VkPhysicalDeviceFeatures feats = {0};
+        VkPhysicalDeviceVulkan12Features supported12 = {0};
+        supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supported = {0};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supported.pNext = &supported12;
+        vkGetPhysicalDeviceFeatures2(res.physical_device, &supported);
+
+        // The culling pass draws each visible instance with its own indirect draw
+        bool culling = settings->gpu_culling;
+        if (culling && (!supported.features.multiDrawIndirect || !supported.features.drawIndirectFirstInstance)) {
+            log_warn("Multi draw indirect isn't supported by the device, drawing without culling");
+            res.settings.gpu_culling = culling = false;
+        }
+        draw_indirect_count = culling && supported12.drawIndirectCount;
 
-        VkDeviceCreateInfo create_info = {0};
+        // Core in Vulkan 1.3 only, the extension is used whatever the version
+        bool dynamic_rendering = settings->dynamic_rendering;
+        if (dynamic_rendering && !device_extension_supported(res.physical_device, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+            dynamic_rendering = false;
+        }
+        if (dynamic_rendering) {
+            VkPhysicalDeviceDynamicRenderingFeatures supported_dynamic_rendering = {0};
+            supported_dynamic_rendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+            supported.pNext = &supported_dynamic_rendering;
+            vkGetPhysicalDeviceFeatures2(res.physical_device, &supported);
+            supported.pNext = &supported12;
+            dynamic_rendering = supported_dynamic_rendering.dynamicRendering;
+        }
+        if (settings->dynamic_rendering && !dynamic_rendering) {
+            log_warn("Dynamic rendering isn't supported by the device, using a render pass");
+            res.settings.dynamic_rendering = false;
+        }
+
+        bool bindless = settings->bindless;
+        if (bindless && !bindless_supported(&supported12)) {
+            log_warn("Descriptor indexing isn't supported by the device, disabling bindless resources");
+            res.settings.bindless = bindless = false;
+        }
+
+        VkPhysicalDeviceFeatures feats = {0};
+        feats.multiDrawIndirect = culling;
+        feats.drawIndirectFirstInstance = culling;
+
+        VkPhysicalDeviceVulkan12Features feats12 = {0};
+        feats12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        feats12.timelineSemaphore = VK_TRUE;
+        feats12.drawIndirectCount = draw_indirect_count;
+        if (bindless) {
+            bindless_enable(&feats12);
+        }
+
+        VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_feats = {0};
+        dynamic_rendering_feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+        dynamic_rendering_feats.dynamicRendering = VK_TRUE;
+        if (dynamic_rendering) {
+            feats12.pNext = &dynamic_rendering_feats;
+        }
+
+        // The swapchain extension isn't needed in headless mode
+        const char *extensions[REQUIRED_DEVICE_EXTENSIONS_COUNT + 1];
+        uint32_t extension_count = 0;
+        for (uint32_t i = 0; i < REQUIRED_DEVICE_EXTENSIONS_COUNT && !headless; i++) {
+            extensions[extension_count++] = REQUIRED_DEVICE_EXTENSIONS[i];
+        }
+        if (dynamic_rendering) {
+            extensions[extension_count++] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+        }
+
+        VkDeviceCreateInfo create_info = {0};
         create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        create_info.pNext = &feats12;
         create_info.pQueueCreateInfos = queue_create_infos;
         create_info.queueCreateInfoCount = queue_count;
         create_info.pEnabledFeatures = &feats;
-        create_info.enabledExtensionCount = REQUIRED_DEVICE_EXTENSIONS_COUNT;
-        create_info.ppEnabledExtensionNames = REQUIRED_DEVICE_EXTENSIONS;
+        create_info.enabledExtensionCount = extension_count;
+        create_info.ppEnabledExtensionNames = extensions;
 #ifdef ENABLE_VALIDATION_LAYERS
         create_info.enabledLayerCount = enabled_layers.len;
         create_info.ppEnabledLayerNames = enabled_layers.data;
@@ -762,28 +1685,98 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
 
         vkGetDeviceQueue(res.device, res.queue_family_indices.graphics, 0, &res.graphics_queue);
         vkGetDeviceQueue(res.device, res.queue_family_indices.present, 0, &res.present_queue);
+        vkGetDeviceQueue(res.device, res.queue_family_indices.compute, 0, &res.compute_queue);
+        vkGetDeviceQueue(res.device, res.queue_family_indices.transfer, 0, &res.transfer_queue);
+
+        if (dynamic_rendering) {
+            res.begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(res.device, "vkCmdBeginRenderingKHR");
+            res.end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(res.device, "vkCmdEndRenderingKHR");
+            assert(res.begin_rendering != NULL && res.end_rendering != NULL, "Failed to load the dynamic rendering functions");
+        }
+
+        log_info(
+            "Queue families: graphics %ld, present %ld, compute %ld%s, transfer %ld%s",
+            (long)res.queue_family_indices.graphics,
+            (long)res.queue_family_indices.present,
+            (long)res.queue_family_indices.compute,
+            res.queue_family_indices.compute != res.queue_family_indices.graphics ? " (async)" : "",
+            (long)res.queue_family_indices.transfer,
+            res.queue_family_indices.transfer != res.queue_family_indices.graphics ? " (async)" : ""
+        );
     }
 
-    // Swapchain
+    res.allocator = allocator_init(res.physical_device, res.device);
+    res.descriptor_layouts = descriptor_layout_cache_init(res.device);
+    res.uniforms = uniform_ring_init(
+        &res.allocator, res.physical_device, res.device, &res.descriptor_layouts, VK_SHADER_STAGE_VERTEX_BIT
+    );
+
+    if (res.settings.bindless) {
+        res.bindless = bindless_table_init(res.physical_device, res.device, VK_SHADER_STAGE_FRAGMENT_BIT);
+    }
+
+    // Staging ring
     {
-        res.config = configure_swapchain(&res.swapchain_support, win);
+        res.staging = staging_ring_init(
+            &res.allocator,
+            res.device,
+            res.transfer_queue,
+            res.queue_family_indices.transfer,
+            res.graphics_queue,
+            res.queue_family_indices.graphics,
+            STAGING_RING_SIZE
+        );
+    }
+
+    // Swapchain
+    if (headless) {
+        // One image per frame in flight: the frame's fence then guards its image, no acquire needed.
+        res.config = (SwapChainConfig){0};
+        res.config.format.format = OFFSCREEN_FORMAT;
+        res.config.format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+        res.config.extent = (VkExtent2D){settings->width, settings->height};
+        res.config.image_count = res.frames_in_flight;
+        res.swapchain = VK_NULL_HANDLE;
+
+        res.images = (VkImageVec)vec_init();
+        res.offscreen_allocations = (AllocationVec)vec_init();
+        _ctx_create_offscreen_images(&res);
+
+        log_info("Rendering offscreen (%ux%u, %s)", settings->width, settings->height, string_VkFormat(OFFSCREEN_FORMAT));
+    } else {
+        res.config = configure_swapchain(&res.swapchain_support, win, settings->latency_policy, settings->image_count);
         vk_try(
             create_swapchain(res.device, &res.config, res.surface, &res.queue_family_indices, VK_NULL_HANDLE, &res.swapchain),
             "Failed to create swapchain"
         );
+        log_info(
+            "Latency policy: %s (%s, %u images)",
+            latency_policy_name(settings->latency_policy),
+            string_VkPresentModeKHR(res.config.present_mode),
+            res.config.image_count
+        );
 
         res.images = (VkImageVec)vec_init();
+        res.offscreen_allocations = (AllocationVec)vec_init();
         vk_get_vec(&res.images, vkGetSwapchainImagesKHR(res.device, res.swapchain, count, ptr));
     }
+    res.window_extent = res.config.extent;
+    res.draw_area = (VkRect2D){.offset = {0, 0}, .extent = res.config.extent};
 
     // Image views
     {
         res.image_views = (VkImageViewVec)vec_init();
         _ctx_create_image_views(&res);
+        res.render_finished_semaphores = (VkSemaphoreVec)vec_init();
+        if (!headless) {
+            _ctx_create_render_finished_semaphores(&res);
+        }
     }
 
-    // Render Pass
-    {
+    // Render Pass (pipelines only need the format with dynamic rendering)
+    res.target.render_pass = VK_NULL_HANDLE;
+    res.target.color_format = res.config.format.format;
+    if (!res.settings.dynamic_rendering) {
         VkAttachmentDescription color_attachment = {0};
         color_attachment.format = res.config.format.format;
         color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -792,7 +1785,8 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
         color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // Offscreen images are never presented, leave them ready to be read back
+        color_attachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         VkAttachmentReference color_attachment_reference = {0};
         color_attachment_reference.attachment = 0;
@@ -820,7 +1814,18 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
         create_info.dependencyCount = 1;
         create_info.pDependencies = &dependency;
 
-        vk_try(vkCreateRenderPass(res.device, &create_info, NULL, &res.render_pass), "Failed to create render pass");
+        vk_try(vkCreateRenderPass(res.device, &create_info, NULL, &res.target.render_pass), "Failed to create render pass");
+    }
+
+    // Pipeline cache
+    {
+        if (settings->pipeline_cache_path != NULL) {
+            res.pipeline_cache = pipeline_cache_load(res.physical_device, res.device, settings->pipeline_cache_path);
+        } else {
+            VkPipelineCacheCreateInfo create_info = {0};
+            create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+            vk_try(vkCreatePipelineCache(res.device, &create_info, NULL, &res.pipeline_cache), "Failed to create pipeline cache");
+        }
     }
 
     // Graphic pipeline
@@ -851,14 +1856,19 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
 
         VkPipelineShaderStageCreateInfo shader_stages[2] = {vertex_shader_stage_create_info, fragment_shader_stage_create_info};
 
+        VertexLayout vertex_layout = mesh_vertex_layout(settings->mesh_layout);
+        instance_set_vertex_layout(&vertex_layout);
+
         VkPipelineVertexInputStateCreateInfo vertex_input_state = {0};
         vertex_input_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertex_input_state.vertexBindingDescriptionCount = 0;
-        vertex_input_state.vertexAttributeDescriptionCount = 0;
+        vertex_input_state.vertexBindingDescriptionCount = vertex_layout.binding_count;
+        vertex_input_state.pVertexBindingDescriptions = vertex_layout.bindings;
+        vertex_input_state.vertexAttributeDescriptionCount = vertex_layout.attribute_count;
+        vertex_input_state.pVertexAttributeDescriptions = vertex_layout.attributes;
 
         VkPipelineInputAssemblyStateCreateInfo input_assembly = {0};
         input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+        input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         input_assembly.primitiveRestartEnable = VK_FALSE;
 
         static const VkDynamicState DYNAMIC_STATES[] = {
@@ -918,12 +1928,19 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
         color_blend_state.blendConstants[2] = 0.0f;
         color_blend_state.blendConstants[3] = 0.0f;
 
+        // Per draw data
+        VkPushConstantRange push_constants = {0};
+        push_constants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        push_constants.offset = 0;
+        push_constants.size = sizeof(DrawConstants);
+
+        // Set 0 is the uniform ring, the frame's uniforms are a slice of it
         VkPipelineLayoutCreateInfo pipeline_layout_create_info = {0};
         pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipeline_layout_create_info.setLayoutCount = 0;
-        pipeline_layout_create_info.pSetLayouts = NULL;
-        pipeline_layout_create_info.pushConstantRangeCount = 0;
-        pipeline_layout_create_info.pPushConstantRanges = NULL;
+        pipeline_layout_create_info.setLayoutCount = 1;
+        pipeline_layout_create_info.pSetLayouts = &res.uniforms.set_layout;
+        pipeline_layout_create_info.pushConstantRangeCount = 1;
+        pipeline_layout_create_info.pPushConstantRanges = &push_constants;
 
         vk_try(
             vkCreatePipelineLayout(res.device, &pipeline_layout_create_info, NULL, &res.pipeline_layout),
@@ -943,13 +1960,13 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
         create_info.pColorBlendState = &color_blend_state;
         create_info.pDynamicState = &dynamic_state;
         create_info.layout = res.pipeline_layout;
-        create_info.renderPass = res.render_pass;
-        create_info.subpass = 0;
         create_info.basePipelineHandle = VK_NULL_HANDLE;
         create_info.basePipelineIndex = -1;
+        VkPipelineRenderingCreateInfo rendering_info;
+        render_target_pipeline(&res.target, &create_info, &rendering_info);
 
         vk_try(
-            vkCreateGraphicsPipelines(res.device, VK_NULL_HANDLE, 1, &create_info, NULL, &res.graphics_pipeline),
+            vkCreateGraphicsPipelines(res.device, res.pipeline_cache, 1, &create_info, NULL, &res.graphics_pipeline),
             "Failed to create graphics pipeline"
         );
 
@@ -973,36 +1990,157 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
         vk_try(vkCreateCommandPool(res.device, &create_info, NULL, &res.command_pool), "Failed to create command pool");
     }
 
-    // Command buffer
+    // Timestamp queries
     {
-        VkCommandBufferAllocateInfo alloc_info = {0};
-        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        alloc_info.commandPool = res.command_pool;
-        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        alloc_info.commandBufferCount = CONCURENT_FRAMES;
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(res.physical_device, &props);
+
+        uint32_t count;
+        vkGetPhysicalDeviceQueueFamilyProperties(res.physical_device, &count, NULL);
+        VkQueueFamilyProperties *queue_props = malloc(count * sizeof(VkQueueFamilyProperties));
+        assert_alloc(queue_props);
+        vkGetPhysicalDeviceQueueFamilyProperties(res.physical_device, &count, queue_props);
+        uint32_t valid_bits = queue_props[res.queue_family_indices.graphics].timestampValidBits;
+        free(queue_props);
+
+        if (valid_bits == 0 || props.limits.timestampPeriod == 0.0f) {
+            log_warn("Timestamps aren't supported by the graphics queue, GPU timings are disabled");
+            res.timestamp_period = 0.0;
+        } else {
+            res.timestamp_period = props.limits.timestampPeriod;
+            res.timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+        }
+    }
 
-        vk_try(vkAllocateCommandBuffers(res.device, &alloc_info, res.command_buffers), "Failed to allocate command buffer");
+    // Frames in flight
+    {
+        res.command_buffers = (VkCommandBufferVec)vec_init();
+        res.image_available_semaphores = (VkSemaphoreVec)vec_init();
+        res.in_flight_fences = (VkFenceVec)vec_init();
+        res.timestamp_pools = (VkQueryPoolVec)vec_init();
+        res.timestamps_pending = (BoolVec)vec_init();
+        res.submit_times = (U64Vec)vec_init();
+        res.frame_numbers = (U64Vec)vec_init();
+        _ctx_create_frames(&res);
+
+        // Lives as long as the context, so that frame numbers keep increasing whatever the number of frames in flight
+        res.frame_timeline = VK_NULL_HANDLE;
+        if (res.settings.timeline_sync) {
+            VkSemaphoreTypeCreateInfo type_info = {0};
+            type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            type_info.initialValue = 0;
+            VkSemaphoreCreateInfo create_info = {0};
+            create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            create_info.pNext = &type_info;
+            vk_try(vkCreateSemaphore(res.device, &create_info, NULL, &res.frame_timeline), "Failed to create frame timeline");
+        }
     }
 
-    // Synchronisation
+    // Cached command buffers
     {
-        VkSemaphoreCreateInfo semaphore_create_info = {0};
-        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        res.cached_commands_count = 0;
+        res.cached_commands = NULL;
+        _ctx_create_cached_commands(&res);
+    }
 
-        VkFenceCreateInfo fence_create_info = {0};
-        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    // Mesh
+    {
+        Vertex *vertices;
+        uint32_t *indices;
+        uint32_t vertex_count, index_count;
+        mesh_subdivided_triangle(settings->mesh_subdivisions, &vertices, &vertex_count, &indices, &index_count);
 
-        for (size_t i = 0; i < CONCURENT_FRAMES; i++) {
-            vk_try(
-                vkCreateSemaphore(res.device, &semaphore_create_info, NULL, &res.image_available_semaphores[i]),
-                "Failed to create semaphore"
-            );
-            vk_try(
-                vkCreateSemaphore(res.device, &semaphore_create_info, NULL, &res.render_finished_semaphores[i]),
-                "Failed to create semaphore"
+        res.mesh = mesh_init(
+            &res.allocator, &res.staging, res.device, settings->mesh_layout, vertices, vertex_count, indices, index_count
+        );
+        free(vertices);
+        free(indices);
+
+        // Nothing can be drawn without it
+        staging_ring_wait(&res.staging, res.mesh.upload);
+
+        log_info(
+            "Mesh: %u vertices, %u triangles (%s layout)",
+            vertex_count,
+            index_count / 3,
+            mesh_layout_name(settings->mesh_layout)
+        );
+    }
+
+    // Instances
+    {
+        uint32_t buffer_count = settings->cache_commands ? 1 : res.frames_in_flight;
+        res.instances = instance_set_init(&res.allocator, res.device, res.jobs, settings->instance_count, buffer_count);
+        res.last_instance_update = 0;
+    }
+
+    // Culling
+    if (res.settings.gpu_culling) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(res.physical_device, &props);
+
+        res.culler = culler_init(
+            res.device, res.pipeline_cache, &res.descriptor_layouts, draw_indirect_count, props.limits.maxDrawIndirectCount
+        );
+        _ctx_update_culler(&res);
+        log_info("Culling instances on the GPU (%s)", draw_indirect_count ? "packed draws" : "a draw per instance");
+    }
+
+    // Sprites
+    if (settings->sprite_count > 0) {
+        res.sprites = sprite_batch_init(
+            &res.allocator,
+            &res.staging,
+            res.device,
+            res.pipeline_cache,
+            &res.target,
+            res.settings.bindless ? res.bindless.layout : VK_NULL_HANDLE,
+            res.frames_in_flight
+        );
+        staging_ring_wait(&res.staging, res.sprites.upload);
+    }
+
+    // Textures
+    res.textures = texture_loader_init(
+        res.physical_device,
+        res.device,
+        res.jobs,
+        res.graphics_queue,
+        res.queue_family_indices.graphics,
+        res.timestamp_period,
+        res.timestamp_mask
+    );
+    vec_foreach(&settings->textures, path, texture_loader_load(&res.textures, path));
+    res.texture_slots = calloc(res.textures.count + 1, sizeof(uint32_t));
+    assert_alloc(res.texture_slots);
+
+    // Draw list
+    {
+        // Every draw is every instance of the whole mesh
+        res.draw_count = settings->draw_count;
+        res.draws = malloc(res.draw_count * sizeof(DrawCommand));
+        res.draw_constants = malloc(res.draw_count * sizeof(DrawConstants));
+        assert_alloc(res.draws);
+        assert_alloc(res.draw_constants);
+        for (uint32_t i = 0; i < res.draw_count; i++) {
+            res.draws[i] = (DrawCommand){
+                .index_count = res.mesh.index_count,
+                .instance_count = res.instances.count,
+                .first_index = 0,
+                .vertex_offset = 0,
+                .first_instance = 0,
+            };
+            res.draw_constants[i] = (DrawConstants){.tint = {1.0f, 1.0f, 1.0f, 1.0f}};
+        }
+
+        res.secondary_buffers = NULL;
+        if (settings->record_slices > 0) {
+            res.recorder = recorder_init(
+                res.device, res.queue_family_indices.graphics, res.jobs, settings->record_slices, res.frames_in_flight
             );
-            vk_try(vkCreateFence(res.device, &fence_create_info, NULL, &res.in_flight_fences[i]), "Failed to create fence");
+            res.secondary_buffers = malloc(settings->record_slices * sizeof(VkCommandBuffer));
+            assert_alloc(res.secondary_buffers);
         }
     }
 
@@ -1012,75 +2150,614 @@ GraphicContext ctx_init(const char *app_name, Window *win) {
     return res;
 }
 
-void ctx_set_resized(GraphicContext *ctx) { ctx->framebuffer_resized = true; }
+void ctx_set_resized(GraphicContext *ctx, uint32_t width, uint32_t height) {
+    if (ctx->framebuffer_resized) {
+        ctx->rebuilds_avoided++;
+    }
+    ctx->framebuffer_resized = true;
+    ctx->last_resize = timing_now();
+    ctx->window_extent = (VkExtent2D){width, height};
+}
+
+// Compute the draw area: the largest rectangle of the images that keeps its aspect ratio once the presentation engine
+// has scaled the images to the window
+void _ctx_update_draw_area(GraphicContext *ctx) {
+    VkExtent2D image = ctx->config.extent;
+    VkExtent2D window = ctx->window_extent;
+    VkRect2D area = {.offset = {0, 0}, .extent = image};
+
+    if (window.width > 0 && window.height > 0 && (window.width != image.width || window.height != image.height)) {
+        double scale_x = (double)window.width / image.width;
+        double scale_y = (double)window.height / image.height;
+        double scale = scale_x < scale_y ? scale_x : scale_y;
+        area.extent.width = image.width * scale / scale_x;
+        area.extent.height = image.height * scale / scale_y;
+        area.offset.x = (image.width - area.extent.width) / 2;
+        area.offset.y = (image.height - area.extent.height) / 2;
+    }
+
+    if (memcmp(&area, &ctx->draw_area, sizeof(VkRect2D)) != 0) {
+        ctx->draw_area = area;
+        ctx_invalidate_commands(ctx);
+    }
+}
+
+// Scale and offset from the scene to clip space: the scene's square is kept square, and fits in the draw area
+static inline void _ctx_view(GraphicContext *ctx, float view[4]) {
+    float width = ctx->draw_area.extent.width;
+    float height = ctx->draw_area.extent.height;
+    float side = width < height ? width : height;
+    view[0] = side / width;
+    view[1] = side / height;
+    view[2] = 0.0f;
+    view[3] = 0.0f;
+}
+
+// Planes the instances are culled against, the edges of clip space brought back to the scene by the view (normalized,
+// facing inward)
+static inline void _ctx_view_frustum(const float view[4], float planes[CULL_PLANE_COUNT][4]) {
+    float frustum[CULL_PLANE_COUNT][4] = {
+        {1.0f, 0.0f, 0.0f, (1.0f + view[2]) / view[0]},
+        {-1.0f, 0.0f, 0.0f, (1.0f - view[2]) / view[0]},
+        {0.0f, 1.0f, 0.0f, (1.0f + view[3]) / view[1]},
+        {0.0f, -1.0f, 0.0f, (1.0f - view[3]) / view[1]},
+    };
+    memcpy(planes, frustum, sizeof(frustum));
+}
 
-void ctx_record_command_buffer(GraphicContext *ctx, VkCommandBuffer buffer, uint32_t image_index) {
+// Write the timestamp starting a GPU pass (no-op if timestamps aren't supported, i.e. pool is VK_NULL_HANDLE)
+static inline void _ctx_begin_gpu_pass(VkCommandBuffer buffer, VkQueryPool pool, GpuPass pass) {
+    if (pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, pass * 2);
+    }
+}
+
+// Write the timestamp ending a GPU pass (no-op if timestamps aren't supported, i.e. pool is VK_NULL_HANDLE)
+static inline void _ctx_end_gpu_pass(VkCommandBuffer buffer, VkQueryPool pool, GpuPass pass) {
+    if (pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, pass * 2 + 1);
+    }
+}
+
+// Read the GPU timings of the last submission writing to pool, must be called once its fence has signaled (the
+// results are then available, and reading them never blocks). pending is cleared.
+void _ctx_read_timestamps(GraphicContext *ctx, VkQueryPool pool, bool *pending) {
+    if (pool == VK_NULL_HANDLE || !*pending) {
+        return;
+    }
+
+    // (value, availability) pairs, for the start and end of each pass
+    uint64_t results[GPU_PASS_COUNT * 2][2] = {0};
+    VkResult result = vkGetQueryPoolResults(
+        ctx->device,
+        pool,
+        0,
+        GPU_PASS_COUNT * 2,
+        sizeof(results),
+        results,
+        sizeof(results[0]),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+    );
+    *pending = false;
+
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+        log_warn("Failed to read timestamps (%s)", string_VkResult(result));
+        return;
+    }
+
+    for (uint32_t pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        uint64_t *start = results[pass * 2];
+        uint64_t *end = results[pass * 2 + 1];
+        // Passes not recorded this frame are never available
+        if (start[1] == 0 || end[1] == 0) {
+            continue;
+        }
+        uint64_t ticks = (end[0] - start[0]) & ctx->timestamp_mask;
+        frame_timer_gpu_pass(&ctx->timer, pass, ticks * ctx->timestamp_period);
+    }
+}
+
+// Begin rendering to the image_index-th image, cleared, with the draws recorded inline or in secondary buffers. With
+// dynamic rendering, the image is first transitioned to the attachment layout.
+static void _ctx_begin_rendering(GraphicContext *ctx, VkCommandBuffer buffer, uint32_t image_index, bool secondary) {
+    VkClearValue clear_color = (VkClearValue){{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    VkRect2D render_area = {.offset = {0, 0}, .extent = ctx->config.extent};
+
+    if (ctx->target.render_pass != VK_NULL_HANDLE) {
+        VkRenderPassBeginInfo render_pass_info = {0};
+        render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        render_pass_info.renderPass = ctx->target.render_pass;
+        render_pass_info.framebuffer = vec_get(&ctx->framebuffers, image_index);
+        render_pass_info.renderArea = render_area;
+        render_pass_info.clearValueCount = 1;
+        render_pass_info.pClearValues = &clear_color;
+        VkSubpassContents contents = secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+        vkCmdBeginRenderPass(buffer, &render_pass_info, contents);
+        return;
+    }
+
+    // The previous contents are cleared anyway. Waits on the same stage as the acquire semaphore, so that the
+    // transition happens after the image is acquired.
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = vec_get(&ctx->images, image_index);
+    barrier.subresourceRange = (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(
+        buffer,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        0,
+        0,
+        NULL,
+        0,
+        NULL,
+        1,
+        &barrier
+    );
+
+    VkRenderingAttachmentInfo color_attachment = {0};
+    color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    color_attachment.imageView = vec_get(&ctx->image_views, image_index);
+    color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    color_attachment.resolveMode = VK_RESOLVE_MODE_NONE;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color_attachment.clearValue = clear_color;
+
+    VkRenderingInfo rendering_info = {0};
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    rendering_info.flags = secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+    rendering_info.renderArea = render_area;
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = 1;
+    rendering_info.pColorAttachments = &color_attachment;
+    ctx->begin_rendering(buffer, &rendering_info);
+}
+
+// End rendering to the image_index-th image, leaving it ready to be presented (or read back in headless mode)
+static void _ctx_end_rendering(GraphicContext *ctx, VkCommandBuffer buffer, uint32_t image_index) {
+    if (ctx->target.render_pass != VK_NULL_HANDLE) {
+        vkCmdEndRenderPass(buffer);
+        return;
+    }
+
+    ctx->end_rendering(buffer);
+
+    // Like the final layout of the render pass, presentation (or whoever reads the image) is synchronized by the
+    // semaphores and fences of the submission
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = ctx->settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = vec_get(&ctx->images, image_index);
+    barrier.subresourceRange = (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(
+        buffer,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0,
+        NULL,
+        0,
+        NULL,
+        1,
+        &barrier
+    );
+}
+
+// Record the commands rendering to the image_index-th image, writing the GPU timings to timestamps (which can be
+// VK_NULL_HANDLE)
+void ctx_record_command_buffer(GraphicContext *ctx, VkCommandBuffer buffer, uint32_t image_index, VkQueryPool timestamps) {
     VkCommandBufferBeginInfo begin_info = {0};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
     vk_try(vkBeginCommandBuffer(buffer, &begin_info), "Failed to begin command buffer");
 
-    VkClearValue clear_color = (VkClearValue){{{0.0f, 0.0f, 0.0f, 1.0f}}};
-
-    VkRenderPassBeginInfo render_pass_info = {0};
-    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_pass_info.renderPass = ctx->render_pass;
-    render_pass_info.framebuffer = vec_get(&ctx->framebuffers, image_index);
-    render_pass_info.renderArea.offset = (VkOffset2D){0, 0};
-    render_pass_info.renderArea.extent = ctx->config.extent;
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues = &clear_color;
+    if (timestamps != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(buffer, timestamps, 0, GPU_PASS_COUNT * 2);
+    }
 
+    // The whole image is cleared, but only the draw area is drawn to
     VkViewport viewport = {0};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)ctx->config.extent.width;
-    viewport.height = (float)ctx->config.extent.height;
+    viewport.x = (float)ctx->draw_area.offset.x;
+    viewport.y = (float)ctx->draw_area.offset.y;
+    viewport.width = (float)ctx->draw_area.extent.width;
+    viewport.height = (float)ctx->draw_area.extent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
 
-    VkRect2D scissor = {0};
-    scissor.offset = (VkOffset2D){0, 0};
-    scissor.extent = ctx->config.extent;
+    VkRect2D scissor = ctx->draw_area;
+
+    // Cached buffers are replayed whatever the frame in flight
+    uint32_t instance_index = ctx->settings.cache_commands ? 0 : ctx->current_frame;
+    VkBuffer instance_buffer = ctx->instances.buffers[instance_index];
+
+    // The region of the uniform ring is free: its frame's fence (or the image's, with cached buffers) has signaled
+    FrameUniforms frame = {0};
+    _ctx_view(ctx, frame.view);
+    uint32_t frame_offset;
+    uniform_ring_begin(&ctx->uniforms, ctx->settings.cache_commands ? image_index : ctx->current_frame);
+    memcpy(uniform_ring_alloc(&ctx->uniforms, sizeof(FrameUniforms), &frame_offset), &frame, sizeof(FrameUniforms));
+
+    if (ctx->settings.gpu_culling) {
+        float planes[CULL_PLANE_COUNT][4];
+        _ctx_view_frustum(frame.view, planes);
+        _ctx_begin_gpu_pass(buffer, timestamps, GpuPassCull);
+        culler_record(&ctx->culler, buffer, instance_index, &ctx->mesh, planes);
+        _ctx_end_gpu_pass(buffer, timestamps, GpuPassCull);
+    }
 
-    vkCmdBeginRenderPass(buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    _ctx_begin_gpu_pass(buffer, timestamps, GpuPassMain);
+
+    if (ctx->settings.record_slices > 0) {
+        RecordJob job = {0};
+        job.target = ctx->target;
+        job.framebuffer = ctx->framebuffers.len > 0 ? vec_get(&ctx->framebuffers, image_index) : VK_NULL_HANDLE;
+        job.pipeline = ctx->graphics_pipeline;
+        job.pipeline_layout = ctx->pipeline_layout;
+        job.frame_set = ctx->uniforms.set;
+        job.frame_offset = frame_offset;
+        job.mesh = &ctx->mesh;
+        job.instance_buffer = instance_buffer;
+        job.viewport = viewport;
+        job.scissor = scissor;
+        job.draws = ctx->draws;
+        job.constants = ctx->draw_constants;
+        job.draw_count = ctx->draw_count;
+
+        uint32_t count = recorder_record(&ctx->recorder, ctx->current_frame, &job, ctx->secondary_buffers);
+
+        _ctx_begin_rendering(ctx, buffer, image_index, true);
+        if (count > 0) {
+            vkCmdExecuteCommands(buffer, count, ctx->secondary_buffers);
+        }
+    } else {
+        _ctx_begin_rendering(ctx, buffer, image_index, false);
 
-    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->graphics_pipeline);
-    vkCmdSetViewport(buffer, 0, 1, &viewport);
-    vkCmdSetScissor(buffer, 0, 1, &scissor);
-    vkCmdDraw(buffer, 3, 1, 0, 0);
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->graphics_pipeline);
+        vkCmdBindDescriptorSets(
+            buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipeline_layout, 0, 1, &ctx->uniforms.set, 1, &frame_offset
+        );
+        vkCmdSetViewport(buffer, 0, 1, &viewport);
+        vkCmdSetScissor(buffer, 0, 1, &scissor);
+        mesh_bind(&ctx->mesh, buffer);
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(buffer, ctx->mesh.stream_count, 1, &instance_buffer, &offset);
+        if (ctx->settings.gpu_culling) {
+            vkCmdPushConstants(
+                buffer, ctx->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants), &ctx->draw_constants[0]
+            );
+            culler_draw(&ctx->culler, buffer, instance_index);
+        } else {
+            for (uint32_t i = 0; i < ctx->draw_count; i++) {
+                DrawCommand *draw = &ctx->draws[i];
+                vkCmdPushConstants(
+                    buffer, ctx->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants), &ctx->draw_constants[i]
+                );
+                vkCmdDrawIndexed(
+                    buffer, draw->index_count, draw->instance_count, draw->first_index, draw->vertex_offset, draw->first_instance
+                );
+            }
+        }
+        if (ctx->settings.sprite_count > 0) {
+            sprite_batch_draw(&ctx->sprites, buffer, ctx->settings.bindless ? &ctx->bindless : NULL);
+        }
+    }
 
-    vkCmdEndRenderPass(buffer);
+    _ctx_end_rendering(ctx, buffer, image_index);
+    _ctx_end_gpu_pass(buffer, timestamps, GpuPassMain);
 
     vk_try(vkEndCommandBuffer(buffer), "Failed to record command buffer");
 }
 
+// Change the number of frames in flight, waits for the device to be idle.
+void ctx_set_frames_in_flight(GraphicContext *ctx, uint32_t count) {
+    vkDeviceWaitIdle(ctx->device);
+
+    _ctx_destroy_frames(ctx);
+    ctx->frames_in_flight = count;
+    ctx->current_frame = 0;
+
+    // Offscreen images are per frame in flight
+    if (ctx->settings.headless) {
+        _ctx_destroy_cached_commands(ctx);
+        _ctx_destroy_offscreen_images(ctx);
+        ctx->config.image_count = count;
+        _ctx_create_offscreen_images(ctx);
+        _ctx_create_image_views(ctx);
+        _ctx_create_framebuffers(ctx);
+        _ctx_create_cached_commands(ctx);
+    }
+
+    _ctx_create_frames(ctx);
+
+    // Everything submitted so far is done
+    ctx->completed_frame = ctx->frame_number;
+    deletion_queue_flush(&ctx->deletion_queue, ctx->device, ctx->completed_frame);
+
+    // The recorder has pools per frame in flight
+    if (ctx->settings.record_slices > 0) {
+        recorder_drop(ctx->recorder);
+        ctx->recorder = recorder_init(
+            ctx->device, ctx->queue_family_indices.graphics, ctx->jobs, ctx->settings.record_slices, count
+        );
+    }
+
+    // And so do the instances, unless commands are cached
+    if (!ctx->settings.cache_commands) {
+        instance_set_set_buffer_count(&ctx->instances, &ctx->allocator, count);
+        _ctx_update_culler(ctx);
+    }
+
+    if (ctx->settings.sprite_count > 0) {
+        sprite_batch_set_frame_count(&ctx->sprites, &ctx->allocator, count);
+    }
+}
+
+// Change the number of instances drawn, waits for the device to be idle.
+void ctx_set_instance_count(GraphicContext *ctx, uint32_t count) {
+    vkDeviceWaitIdle(ctx->device);
+
+    uint32_t buffer_count = ctx->instances.buffer_count;
+    instance_set_drop(ctx->instances, &ctx->allocator);
+    ctx->instances = instance_set_init(&ctx->allocator, ctx->device, ctx->jobs, count, buffer_count);
+    _ctx_update_culler(ctx);
+    for (uint32_t i = 0; i < ctx->draw_count; i++) {
+        ctx->draws[i].instance_count = count;
+    }
+
+    ctx_invalidate_commands(ctx);
+}
+
+// Decide whether the number of frames in flight should change, at the end of each tuning window
+void _ctx_tune_frames_in_flight(GraphicContext *ctx) {
+    FramesInFlightTuner *tuner = &ctx->tuner;
+
+    uint64_t now = timing_now();
+    if (tuner->last_frame_start != 0) {
+        histogram_record(&tuner->frame_times, now - tuner->last_frame_start);
+    }
+    tuner->last_frame_start = now;
+
+    if (!tuner->enabled || ++tuner->frames < TUNER_WINDOW) {
+        return;
+    }
+
+    uint32_t depth = ctx->frames_in_flight;
+    uint32_t next = depth;
+
+    double frame_time = (double)tuner->frame_times.total / tuner->frame_times.count;
+    double wait_share = tuner->fence_wait / (double)tuner->frame_times.total;
+    double latency = (double)tuner->latency / tuner->frames;
+    double spread = (double)histogram_percentile(&tuner->frame_times, 0.99) /
+                    (double)(histogram_percentile(&tuner->frame_times, 0.50) + 1);
+
+    if (latency > tuner->latency_target && depth > TUNER_MIN_FRAMES) {
+        // Over budget, whatever the cause
+        next = depth - 1;
+    } else if (wait_share > TUNER_GPU_BOUND_WAIT && depth > TUNER_GPU_BOUND_MIN_FRAMES) {
+        // GPU bound: the queue is always full, going deeper only adds latency
+        next = depth - 1;
+    } else if (wait_share < TUNER_STARVED_WAIT && spread > TUNER_SPIKE_RATIO && depth < TUNER_MAX_FRAMES &&
+               latency + frame_time < tuner->latency_target) {
+        // The CPU rarely waits but has spikes, which can starve the GPU: buffer one more frame if the latency
+        // budget allows for it
+        next = depth + 1;
+    }
+
+    if (next != depth) {
+        log_info(
+            "Frames in flight: %u -> %u (fence wait %.1f%%, latency %.2fms, p99/p50 %.2f)",
+            depth,
+            next,
+            wait_share * 100.0,
+            latency * 1e-6,
+            spread
+        );
+        ctx_set_frames_in_flight(ctx, next);
+    }
+
+    tuner->frames = 0;
+    tuner->fence_wait = 0;
+    tuner->latency = 0;
+    histogram_reset(&tuner->frame_times);
+}
+
+// Add the textures that became ready to the bindless table
+static void _ctx_update_texture_slots(GraphicContext *ctx) {
+    for (uint32_t i = 0; i < ctx->textures.count; i++) {
+        const Texture *tex = texture_loader_get(&ctx->textures, i);
+        if (ctx->texture_slots[i] == 0 && tex != NULL) {
+            ctx->texture_slots[i] = bindless_table_add_texture(&ctx->bindless, tex->view, ctx->textures.sampler) + 1;
+        }
+    }
+}
+
+// Overlay workload: sprites on a spiral turning around the center, one in eight of them glowing. With bindless
+// resources, the others cycle through the textures (round until their texture is ready).
+void _ctx_update_sprites(GraphicContext *ctx, double time) {
+    SpriteBatch *batch = &ctx->sprites;
+    uint32_t count = ctx->settings.sprite_count;
+    uint32_t texture_count = ctx->settings.bindless ? ctx->textures.count : 0;
+
+    sprite_batch_begin(batch, ctx->current_frame);
+    for (uint32_t i = 0; i < count; i++) {
+        float t = (float)i / count;
+        float angle = 44.0f * t + time * (0.2f + 0.3f * t);
+        float radius = 0.1f + 0.85f * t;
+        bool glow = i % 8 == 0;
+
+        Sprite sprite = {0};
+        sprite.position[0] = radius * cosf(angle);
+        sprite.position[1] = radius * sinf(angle);
+        sprite.size[0] = sprite.size[1] = 0.01f + 0.01f * (i % 3);
+        sprite.rotation = angle;
+        sprite.uv[2] = sprite.uv[3] = 1.0f;
+        sprite.color = glow ? 0x8040c0ff : 0xc0ffffff;
+        uint32_t texture = !glow && texture_count > 0 ? ctx->texture_slots[i % texture_count] : 0;
+        sprite.key = SPRITE_KEY(glow ? SpriteAdditive : SpriteAlpha, texture);
+        sprite_batch_push(batch, &sprite);
+    }
+    sprite_batch_end(batch);
+}
+
+// Number of the last frame the device is known to have completed. With settings.timeline_sync this reads the frame
+// timeline, which is cheap, and retires the frames that completed since.
+uint64_t ctx_completed_frame(GraphicContext *ctx) {
+    if (ctx->settings.timeline_sync) {
+        uint64_t value;
+        vk_try(vkGetSemaphoreCounterValue(ctx->device, ctx->frame_timeline, &value), "Failed to read frame timeline");
+        if (value > ctx->completed_frame) {
+            ctx->completed_frame = value;
+            deletion_queue_flush(&ctx->deletion_queue, ctx->device, ctx->completed_frame);
+        }
+    }
+    return ctx->completed_frame;
+}
+
+// Wait for the device to complete a frame (and every frame before it), and retire them
+void _ctx_wait_frame(GraphicContext *ctx, uint64_t frame) {
+    if (frame <= ctx_completed_frame(ctx)) {
+        return;
+    }
+
+    if (ctx->settings.timeline_sync) {
+        VkSemaphoreWaitInfo wait_info = {0};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &ctx->frame_timeline;
+        wait_info.pValues = &frame;
+        vk_try(vkWaitSemaphores(ctx->device, &wait_info, UINT64_MAX), "Failed to wait for frame timeline");
+    } else {
+        // Submissions to a queue complete in order: the first frame in flight at or after the one waited on will do
+        uint32_t slot = UINT32_MAX;
+        for (uint32_t i = 0; i < ctx->frames_in_flight; i++) {
+            uint64_t number = ctx->frame_numbers.data[i];
+            if (number >= frame && (slot == UINT32_MAX || number < ctx->frame_numbers.data[slot])) {
+                slot = i;
+            }
+        }
+        assert(slot != UINT32_MAX, "Waiting on frame %lu which wasn't submitted", (unsigned long)frame);
+        frame = ctx->frame_numbers.data[slot];
+        vkWaitForFences(ctx->device, 1, &ctx->in_flight_fences.data[slot], VK_TRUE, UINT64_MAX);
+    }
+
+    ctx->completed_frame = frame;
+    deletion_queue_flush(&ctx->deletion_queue, ctx->device, ctx->completed_frame);
+}
+
+// Move on to the next frame in flight
+static inline void _ctx_end_frame(GraphicContext *ctx) {
+    ctx->current_frame = (ctx->current_frame + 1) % ctx->frames_in_flight;
+    _ctx_tune_frames_in_flight(ctx);
+}
+
 void ctx_draw_frame(GraphicContext *ctx, Window *win) {
     VkResult result;
 
-    VkSemaphore image_available_semaphore = ctx->image_available_semaphores[ctx->current_frame];
-    VkSemaphore render_finished_semaphore = ctx->render_finished_semaphores[ctx->current_frame];
-    VkFence in_flight_fence = ctx->in_flight_fences[ctx->current_frame];
-    VkCommandBuffer command_buffer = ctx->command_buffers[ctx->current_frame];
+    VkSemaphore image_available_semaphore = ctx->image_available_semaphores.data[ctx->current_frame];
+    VkSemaphore render_finished_semaphore = VK_NULL_HANDLE;
+    VkFence in_flight_fence = ctx->settings.timeline_sync ? VK_NULL_HANDLE : ctx->in_flight_fences.data[ctx->current_frame];
+    VkCommandBuffer command_buffer = ctx->command_buffers.data[ctx->current_frame];
 
-    vkWaitForFences(ctx->device, 1, &in_flight_fence, VK_TRUE, UINT64_MAX);
+    // The frame last submitted from this slot must be done before its resources are reused
+    uint64_t wait_start = timing_now();
+    // Fences aren't guaranteed to signal in submission order: the slot's own must have signaled before it is reset
+    if (in_flight_fence != VK_NULL_HANDLE) {
+        vkWaitForFences(ctx->device, 1, &in_flight_fence, VK_TRUE, UINT64_MAX);
+    }
+    _ctx_wait_frame(ctx, ctx->frame_numbers.data[ctx->current_frame]);
+    uint64_t wait_end = timing_now();
+    frame_timer_stage(&ctx->timer, TimingFenceWait);
+
+    ctx->tuner.fence_wait += wait_end - wait_start;
+    uint64_t submit_time = ctx->submit_times.data[ctx->current_frame];
+    if (submit_time != 0) {
+        ctx->tuner.latency += wait_end - submit_time;
+    }
+
+    if (!ctx->settings.cache_commands) {
+        _ctx_read_timestamps(
+            ctx, ctx->timestamp_pools.data[ctx->current_frame], &ctx->timestamps_pending.data[ctx->current_frame]
+        );
+    }
+    staging_ring_update(&ctx->staging);
+    texture_loader_update(&ctx->textures, &ctx->allocator, &ctx->staging);
+    if (ctx->settings.bindless) {
+        _ctx_update_texture_slots(ctx);
+    }
+    frame_timer_skip(&ctx->timer);
 
     uint32_t image_index;
 
-    result =
-        vkAcquireNextImageKHR(ctx->device, ctx->swapchain, UINT64_MAX, image_available_semaphore, VK_NULL_HANDLE, &image_index);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        _ctx_recreate_swapchain(ctx, win);
-        return;
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-        log_error("Failed to acquire swap chain image");
-        exit(1);
+    if (ctx->settings.headless) {
+        // Each frame in flight owns an image, which is guarded by the fence we just waited on
+        image_index = ctx->current_frame;
+    } else {
+        result = vkAcquireNextImageKHR(
+            ctx->device, ctx->swapchain, UINT64_MAX, image_available_semaphore, VK_NULL_HANDLE, &image_index
+        );
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            _ctx_recreate_swapchain(ctx, win);
+            return;
+        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            log_error("Failed to acquire swap chain image");
+            exit(1);
+        }
+        render_finished_semaphore = ctx->render_finished_semaphores.data[image_index];
+        frame_timer_stage(&ctx->timer, TimingAcquire);
     }
 
-    vkResetFences(ctx->device, 1, &in_flight_fence);
+    CachedCommands *cached = NULL;
+    if (ctx->settings.cache_commands) {
+        cached = &ctx->cached_commands[image_index];
+        // The image can still be in use by an older frame (when there are more frames in flight than images), and
+        // its buffer can't be submitted again until that frame is done
+        _ctx_wait_frame(ctx, cached->frame);
+        _ctx_read_timestamps(ctx, cached->timestamps, &cached->timestamps_pending);
+        cached->frame = ctx->frame_number + 1;
+        frame_timer_skip(&ctx->timer);
+    }
 
-    vkResetCommandBuffer(command_buffer, 0);
-    ctx_record_command_buffer(ctx, ctx->command_buffers[ctx->current_frame], image_index);
+    if (in_flight_fence != VK_NULL_HANDLE) {
+        vkResetFences(ctx->device, 1, &in_flight_fence);
+    }
+
+    // Cached commands draw the instances as they were first written
+    if (cached == NULL) {
+        uint64_t now = timing_now();
+        float dt = ctx->last_instance_update != 0 ? (now - ctx->last_instance_update) * 1e-9 : 0.0f;
+        instance_set_update(&ctx->instances, ctx->current_frame, dt);
+        ctx->last_instance_update = now;
+        if (ctx->settings.sprite_count > 0) {
+            _ctx_update_sprites(ctx, now * 1e-9);
+        }
+        frame_timer_stage(&ctx->timer, TimingUpdate);
+    }
+
+    if (cached == NULL) {
+        VkQueryPool timestamps = ctx->timestamp_period > 0.0 ? ctx->timestamp_pools.data[ctx->current_frame] : VK_NULL_HANDLE;
+        vkResetCommandBuffer(command_buffer, 0);
+        ctx_record_command_buffer(ctx, command_buffer, image_index, timestamps);
+    } else {
+        if (cached->dirty) {
+            vkResetCommandBuffer(cached->buffer, 0);
+            ctx_record_command_buffer(ctx, cached->buffer, image_index, cached->timestamps);
+            cached->dirty = false;
+        }
+        command_buffer = cached->buffer;
+    }
+    frame_timer_stage(&ctx->timer, TimingRecord);
 
     VkSubmitInfo submit_info = {0};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1092,10 +2769,43 @@ void ctx_draw_frame(GraphicContext *ctx, Window *win) {
     submit_info.pWaitDstStageMask = wait_stages;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command_buffer;
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = &render_finished_semaphore;
+
+    // The timeline is signaled with the number of the frame (the value is ignored for the binary semaphore)
+    VkSemaphore signal_semaphores[] = {render_finished_semaphore, ctx->frame_timeline};
+    uint64_t signal_values[] = {0, ctx->frame_number + 1};
+    uint32_t signal_count = ctx->settings.timeline_sync ? 2 : 1;
+    uint32_t first_signal = 0;
+
+    // Nothing to acquire or present offscreen
+    if (ctx->settings.headless) {
+        submit_info.waitSemaphoreCount = 0;
+        first_signal = 1;
+    }
+    submit_info.signalSemaphoreCount = signal_count - first_signal;
+    submit_info.pSignalSemaphores = &signal_semaphores[first_signal];
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {0};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.signalSemaphoreValueCount = submit_info.signalSemaphoreCount;
+    timeline_info.pSignalSemaphoreValues = &signal_values[first_signal];
+    if (ctx->settings.timeline_sync) {
+        submit_info.pNext = &timeline_info;
+    }
 
     vk_try(vkQueueSubmit(ctx->graphics_queue, 1, &submit_info, in_flight_fence), "Failed to submit draw command buffer");
+    if (cached == NULL) {
+        ctx->timestamps_pending.data[ctx->current_frame] = ctx->timestamp_period > 0.0;
+    } else {
+        cached->timestamps_pending = cached->timestamps != VK_NULL_HANDLE;
+    }
+    ctx->submit_times.data[ctx->current_frame] = timing_now();
+    ctx->frame_numbers.data[ctx->current_frame] = ++ctx->frame_number;
+    frame_timer_stage(&ctx->timer, TimingSubmit);
+
+    if (ctx->settings.headless) {
+        _ctx_end_frame(ctx);
+        return;
+    }
 
     VkPresentInfoKHR present_info = {0};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1107,41 +2817,117 @@ void ctx_draw_frame(GraphicContext *ctx, Window *win) {
     present_info.pResults = NULL;
 
     result = vkQueuePresentKHR(ctx->present_queue, &present_info);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || ctx->framebuffer_resized) {
+    frame_timer_stage(&ctx->timer, TimingPresent);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Can't present to it anymore, no choice but to rebuild now
         ctx->framebuffer_resized = false;
         _ctx_recreate_swapchain(ctx, win);
+    } else if (result == VK_SUBOPTIMAL_KHR || ctx->framebuffer_resized) {
+        uint64_t debounce = ctx->settings.resize_debounce * 1e9;
+        if (timing_now() - ctx->last_resize >= debounce) {
+            ctx->framebuffer_resized = false;
+            _ctx_recreate_swapchain(ctx, win);
+        } else {
+            _ctx_update_draw_area(ctx);
+        }
     } else if (result != VK_SUCCESS) {
         log_error("Failed to present swapchain image");
         exit(1);
     }
 
-    ctx->current_frame = (ctx->current_frame + 1) % CONCURENT_FRAMES;
+    _ctx_end_frame(ctx);
 }
 
 void ctx_drop(GraphicContext ctx) {
     vkDeviceWaitIdle(ctx.device);
+    // While everything is still alive
+    allocator_log_stats(&ctx.allocator);
+    descriptor_allocator_log_stats(&ctx.uniforms.descriptors, "uniforms");
+    if (ctx.settings.gpu_culling) {
+        descriptor_allocator_log_stats(&ctx.culler.descriptors, "culling");
+    }
+    uniform_ring_log_stats(&ctx.uniforms);
+    if (ctx.settings.bindless) {
+        bindless_table_log_stats(&ctx.bindless);
+    }
+    log_info(
+        "Descriptor set layouts: %u created, %lu lookups deduplicated",
+        ctx.descriptor_layouts.count,
+        (unsigned long)ctx.descriptor_layouts.hits
+    );
 
-    for (size_t i = 0; i < CONCURENT_FRAMES; i++) {
-        vkDestroyFence(ctx.device, ctx.in_flight_fences[i], NULL);
-        vkDestroySemaphore(ctx.device, ctx.render_finished_semaphores[i], NULL);
-        vkDestroySemaphore(ctx.device, ctx.image_available_semaphores[i], NULL);
+    _ctx_destroy_frames(&ctx);
+    vec_foreach(&ctx.render_finished_semaphores, semaphore, vkDestroySemaphore(ctx.device, semaphore, NULL));
+    if (ctx.frame_timeline != VK_NULL_HANDLE) {
+        vkDestroySemaphore(ctx.device, ctx.frame_timeline, NULL);
+    }
+    _ctx_destroy_cached_commands(&ctx);
+    deletion_queue_drop(ctx.deletion_queue, ctx.device);
+    if (ctx.settings.record_slices > 0) {
+        recorder_drop(ctx.recorder);
+        free(ctx.secondary_buffers);
     }
+    free(ctx.draws);
+    free(ctx.draw_constants);
     vkDestroyCommandPool(ctx.device, ctx.command_pool, NULL);
     vec_foreach(&ctx.framebuffers, framebuffer, vkDestroyFramebuffer(ctx.device, framebuffer, NULL));
     vkDestroyPipeline(ctx.device, ctx.graphics_pipeline, NULL);
     vkDestroyPipelineLayout(ctx.device, ctx.pipeline_layout, NULL);
-    vkDestroyRenderPass(ctx.device, ctx.render_pass, NULL);
+    if (ctx.settings.pipeline_cache_path != NULL) {
+        pipeline_cache_save(ctx.device, ctx.pipeline_cache, ctx.settings.pipeline_cache_path);
+    }
+    vkDestroyPipelineCache(ctx.device, ctx.pipeline_cache, NULL);
+    if (ctx.target.render_pass != VK_NULL_HANDLE) {
+        vkDestroyRenderPass(ctx.device, ctx.target.render_pass, NULL);
+    }
     vec_foreach(&ctx.image_views, view, vkDestroyImageView(ctx.device, view, NULL););
-    vkDestroySwapchainKHR(ctx.device, ctx.swapchain, NULL);
+    if (ctx.settings.headless) {
+        vec_foreach(&ctx.images, image, vkDestroyImage(ctx.device, image, NULL));
+        for (size_t i = 0; i < ctx.offscreen_allocations.len; i++) {
+            allocator_free(&ctx.allocator, &ctx.offscreen_allocations.data[i]);
+        }
+    } else {
+        vkDestroySwapchainKHR(ctx.device, ctx.swapchain, NULL);
+    }
+    if (ctx.settings.gpu_culling) {
+        culler_drop(ctx.culler, &ctx.allocator);
+    }
+    if (ctx.settings.sprite_count > 0) {
+        sprite_batch_drop(ctx.sprites, &ctx.allocator);
+    }
+    if (ctx.settings.bindless) {
+        bindless_table_drop(ctx.bindless);
+    }
+    texture_loader_drop(ctx.textures, &ctx.allocator);
+    free(ctx.texture_slots);
+    uniform_ring_drop(ctx.uniforms, &ctx.allocator);
+    descriptor_layout_cache_drop(ctx.descriptor_layouts);
+    instance_set_drop(ctx.instances, &ctx.allocator);
+    mesh_drop(ctx.mesh, ctx.device, &ctx.allocator);
+    staging_ring_drop(ctx.staging, &ctx.allocator);
+    allocator_drop(ctx.allocator);
     vkDestroyDevice(ctx.device, NULL);
-    vkDestroySurfaceKHR(ctx.instance, ctx.surface, NULL);
+    if (ctx.surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(ctx.instance, ctx.surface, NULL);
+    }
     DestroyDebugUtilsMessengerEXT(ctx.instance, ctx.debug_messenger, NULL);
     vkDestroyInstance(ctx.instance, NULL);
+    job_system_drop(ctx.jobs);
 
     swapchain_support_details_drop(ctx.swapchain_support);
     vec_drop(ctx.images);
+    vec_drop(ctx.offscreen_allocations);
     vec_drop(ctx.image_views);
     vec_drop(ctx.framebuffers);
+    vec_drop(ctx.command_buffers);
+    vec_drop(ctx.image_available_semaphores);
+    vec_drop(ctx.render_finished_semaphores);
+    vec_drop(ctx.in_flight_fences);
+    vec_drop(ctx.timestamp_pools);
+    vec_drop(ctx.timestamps_pending);
+    vec_drop(ctx.submit_times);
+    vec_drop(ctx.frame_numbers);
+    vec_drop(ctx.settings.textures);
 
     log_info("Context destroyed");
 }
@@ -1167,32 +2953,351 @@ Window window_init(const char *title, uint32_t width, uint32_t height) {
 
 static void _window_framebuffer_resized_callback(GLFWwindow *window, int width, int height) {
     Window *win = glfwGetWindowUserPointer(window);
-    ctx_set_resized(&win->ctx);
+    ctx_set_resized(&win->ctx, width, height);
+}
+
+// Render frame_limit frames for each instance count (by powers of ten up to BENCHMARK_MAX_INSTANCES), and report how
+// the frame time and the throughput scale with it
+void window_benchmark_instances(Window *win) {
+    GraphicContext *ctx = &win->ctx;
+    FrameTimer *timer = &ctx->timer;
+    uint64_t frames = ctx->settings.frame_limit;
+    uint32_t triangles = ctx->mesh.index_count / 3;
+
+    log_info(
+        "Instance benchmark (%lu frames per step, %u draws of %u triangles per instance), times in ms:",
+        (unsigned long)frames,
+        ctx->draw_count,
+        triangles
+    );
+    log_info("    %10s %8s %8s %8s %8s %10s %10s", "instances", "frame", "p99", "update", "gpu", "Minst/s", "Mtri/s");
+
+    for (uint32_t count = 1; count <= BENCHMARK_MAX_INSTANCES; count *= 10) {
+        ctx_set_instance_count(ctx, count);
+
+        for (uint64_t i = 0; i < BENCHMARK_WARMUP_FRAMES + frames; i++) {
+            // Only measure from the end of the warmup
+            if (i == BENCHMARK_WARMUP_FRAMES) {
+                vkDeviceWaitIdle(ctx->device);
+                frame_timer_flush(timer);
+            }
+            frame_timer_begin(timer);
+            ctx_draw_frame(ctx, win);
+            frame_timer_end(timer);
+        }
+        uint64_t start = timer->last_report;
+        vkDeviceWaitIdle(ctx->device);
+        double elapsed = (timing_now() - start) * 1e-9;
+
+        Histogram *frame = &timer->window[TimingFrame];
+        Histogram *update = &timer->window[TimingUpdate];
+        Histogram *gpu = &timer->gpu_window[GpuPassMain];
+        double instances = (double)count * ctx->draw_count * frames / elapsed;
+        log_info(
+            "    %10u %8.3f %8.3f %8.3f %8.3f %10.2f %10.2f",
+            count,
+            (double)frame->total / frame->count * 1e-6,
+            histogram_percentile(frame, 0.99) * 1e-6,
+            update->count > 0 ? (double)update->total / update->count * 1e-6 : 0.0,
+            gpu->count > 0 ? (double)gpu->total / gpu->count * 1e-6 : 0.0,
+            instances * 1e-6,
+            instances * triangles * 1e-6
+        );
+        frame_timer_flush(timer);
+    }
 }
 
 void window_run(Window *win) {
-    glfwSetWindowUserPointer(win->win, win);
-    glfwSetFramebufferSizeCallback(win->win, _window_framebuffer_resized_callback);
-    while (!glfwWindowShouldClose(win->win)) {
-        glfwPollEvents();
+    if (win->ctx.settings.benchmark_instances) {
+        window_benchmark_instances(win);
+        return;
+    }
+
+    bool headless = win->win == NULL;
+    uint64_t frame_limit = win->ctx.settings.frame_limit;
+
+    if (!headless) {
+        glfwSetWindowUserPointer(win->win, win);
+        glfwSetFramebufferSizeCallback(win->win, _window_framebuffer_resized_callback);
+    }
+
+    FrameTimer *timer = &win->ctx.timer;
+    uint64_t start = timing_now();
+
+    uint64_t frames = 0;
+    while (headless || !glfwWindowShouldClose(win->win)) {
+        if (frame_limit > 0 && frames >= frame_limit) {
+            break;
+        }
+
+        // Before polling, so that the frame starts from the latest input
+        frame_limiter_wait(&win->ctx.limiter);
+        frame_timer_begin(timer);
+        if (!headless) {
+            glfwPollEvents();
+            frame_timer_stage(timer, TimingPoll);
+        }
         ctx_draw_frame(&win->ctx, win);
+        frame_timer_end(timer);
+        frames++;
+    }
+
+    // Include the frames still in flight in the measurement
+    vkDeviceWaitIdle(win->ctx.device);
+    double elapsed = (timing_now() - start) * 1e-9;
+    log_info("Rendered %lu frames in %.3fs (%.1f fps)", frames, elapsed, frames / elapsed);
+    if (win->ctx.settings.sprite_count > 0) {
+        sprite_batch_log_stats(&win->ctx.sprites, elapsed);
+    }
+    frame_timer_report(timer, true);
+    frame_limiter_report(&win->ctx.limiter);
+    if (win->ctx.rebuilds_avoided > 0) {
+        log_info("Swapchain rebuilds avoided by resize coalescing: %lu", (unsigned long)win->ctx.rebuilds_avoided);
     }
 }
 
 void window_drop(Window win) {
     ctx_drop(win.ctx);
-    glfwDestroyWindow(win.win);
-    glfwTerminate();
-    log_info("Window destroyed");
+    if (win.win != NULL) {
+        glfwDestroyWindow(win.win);
+        glfwTerminate();
+        log_info("Window destroyed");
+    }
 }
 
-int main() {
+Settings settings_init(int argc, char **argv) {
+    Settings res = {0};
+    res.headless = false;
+    res.width = 800;
+    res.height = 600;
+    res.frame_limit = 0;
+    res.stats_interval = 5.0;
+    res.frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT;
+    res.tune_frames_in_flight = false;
+    res.latency_target = 0.05;
+    res.image_count = 0;
+    res.cache_commands = false;
+    res.draw_count = 1;
+    res.record_slices = 0;
+    // One worker per core, counting the main thread
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    res.worker_threads = cores > 1 ? cores - 1 : 0;
+    res.pipeline_cache_path = "pipeline_cache";
+    res.device_cache_path = "device_cache";
+    res.resize_debounce = 0.1;
+    res.mesh_layout = MeshInterleaved;
+    res.mesh_subdivisions = 1;
+    res.instance_count = 1;
+    res.benchmark_instances = false;
+    res.gpu_culling = false;
+    res.bindless = false;
+    res.dynamic_rendering = false;
+    res.timeline_sync = false;
+    res.latency_policy = LatencyBalanced;
+    res.fps_cap = 0.0;
+    res.sprite_count = 0;
+    res.textures = (ConstStringVec)vec_init();
+
+    bool has_frame_limit = false;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        // Value of the argument, for options that take one
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--headless") == 0) {
+            res.headless = true;
+        } else if (strcmp(arg, "--size") == 0 && value != NULL) {
+            assert(sscanf(value, "%ux%u", &res.width, &res.height) == 2, "Invalid size '%s' (expected WIDTHxHEIGHT)", value);
+            i++;
+        } else if (strcmp(arg, "--frames") == 0 && value != NULL) {
+            assert(sscanf(value, "%lu", &res.frame_limit) == 1, "Invalid frame count '%s'", value);
+            has_frame_limit = true;
+            i++;
+        } else if (strcmp(arg, "--frames-in-flight") == 0 && value != NULL) {
+            assert(
+                sscanf(value, "%u", &res.frames_in_flight) == 1 && res.frames_in_flight > 0 &&
+                    res.frames_in_flight <= MAX_FRAMES_IN_FLIGHT,
+                "Invalid frames in flight '%s' (expected 1 to %u)",
+                value,
+                MAX_FRAMES_IN_FLIGHT
+            );
+            i++;
+        } else if (strcmp(arg, "--cache-commands") == 0) {
+            res.cache_commands = true;
+        } else if (strcmp(arg, "--draws") == 0 && value != NULL) {
+            assert(sscanf(value, "%u", &res.draw_count) == 1, "Invalid draw count '%s'", value);
+            i++;
+        } else if (strcmp(arg, "--record-slices") == 0 && value != NULL) {
+            assert(sscanf(value, "%u", &res.record_slices) == 1, "Invalid record slice count '%s'", value);
+            i++;
+        } else if (strcmp(arg, "--pipeline-cache") == 0 && value != NULL) {
+            res.pipeline_cache_path = value;
+            i++;
+        } else if (strcmp(arg, "--no-pipeline-cache") == 0) {
+            res.pipeline_cache_path = NULL;
+        } else if (strcmp(arg, "--resize-debounce") == 0 && value != NULL) {
+            double ms;
+            assert(sscanf(value, "%lf", &ms) == 1 && ms >= 0, "Invalid resize debounce '%s' (in ms)", value);
+            res.resize_debounce = ms * 1e-3;
+            i++;
+        } else if (strcmp(arg, "--device-cache") == 0 && value != NULL) {
+            res.device_cache_path = value;
+            i++;
+        } else if (strcmp(arg, "--no-device-cache") == 0) {
+            res.device_cache_path = NULL;
+        } else if (strcmp(arg, "--workers") == 0 && value != NULL) {
+            assert(sscanf(value, "%u", &res.worker_threads) == 1, "Invalid worker thread count '%s'", value);
+            i++;
+        } else if (strcmp(arg, "--tune-frames-in-flight") == 0) {
+            res.tune_frames_in_flight = true;
+        } else if (strcmp(arg, "--latency-target") == 0 && value != NULL) {
+            double ms;
+            assert(sscanf(value, "%lf", &ms) == 1 && ms > 0, "Invalid latency target '%s' (in ms)", value);
+            res.latency_target = ms * 1e-3;
+            i++;
+        } else if (strcmp(arg, "--swapchain-images") == 0 && value != NULL) {
+            assert(sscanf(value, "%u", &res.image_count) == 1, "Invalid swapchain image count '%s'", value);
+            i++;
+        } else if (strcmp(arg, "--mesh-layout") == 0 && value != NULL) {
+            if (strcmp(value, "interleaved") == 0) {
+                res.mesh_layout = MeshInterleaved;
+            } else if (strcmp(value, "split") == 0) {
+                res.mesh_layout = MeshSplit;
+            } else {
+                log_error("Invalid mesh layout '%s' (expected interleaved or split)", value);
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(arg, "--mesh-subdivisions") == 0 && value != NULL) {
+            assert(
+                sscanf(value, "%u", &res.mesh_subdivisions) == 1 && res.mesh_subdivisions > 0,
+                "Invalid mesh subdivisions '%s'",
+                value
+            );
+            i++;
+        } else if (strcmp(arg, "--instances") == 0 && value != NULL) {
+            assert(
+                sscanf(value, "%u", &res.instance_count) == 1 && res.instance_count > 0, "Invalid instance count '%s'", value
+            );
+            i++;
+        } else if (strcmp(arg, "--benchmark-instances") == 0) {
+            res.benchmark_instances = true;
+        } else if (strcmp(arg, "--bindless") == 0) {
+            res.bindless = true;
+        } else if (strcmp(arg, "--dynamic-rendering") == 0) {
+            res.dynamic_rendering = true;
+        } else if (strcmp(arg, "--timeline-sync") == 0) {
+            res.timeline_sync = true;
+        } else if (strcmp(arg, "--latency") == 0 && value != NULL) {
+            if (strcmp(value, "balanced") == 0) {
+                res.latency_policy = LatencyBalanced;
+            } else if (strcmp(value, "lowest") == 0) {
+                res.latency_policy = LatencyLowest;
+            } else if (strcmp(value, "vsync") == 0) {
+                res.latency_policy = LatencyVsync;
+            } else if (strcmp(value, "capped") == 0) {
+                res.latency_policy = LatencyCapped;
+            } else {
+                log_error("Invalid latency policy '%s' (expected balanced, lowest, vsync or capped)", value);
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(arg, "--fps-cap") == 0 && value != NULL) {
+            assert(sscanf(value, "%lf", &res.fps_cap) == 1 && res.fps_cap > 0, "Invalid frame rate cap '%s'", value);
+            res.latency_policy = LatencyCapped;
+            i++;
+        } else if (strcmp(arg, "--gpu-culling") == 0) {
+            res.gpu_culling = true;
+        } else if (strcmp(arg, "--sprites") == 0 && value != NULL) {
+            assert(sscanf(value, "%u", &res.sprite_count) == 1, "Invalid sprite count '%s'", value);
+            i++;
+        } else if (strcmp(arg, "--texture") == 0 && value != NULL) {
+            vec_push(&res.textures, value);
+            i++;
+        } else if (strcmp(arg, "--stats-interval") == 0 && value != NULL) {
+            assert(sscanf(value, "%lf", &res.stats_interval) == 1, "Invalid stats interval '%s'", value);
+            i++;
+        } else {
+            log_error("Unknown or incomplete argument '%s'", arg);
+            exit(1);
+        }
+    }
+
+    // The frame limit is per instance count, and reports would be mixed with the benchmark's
+    if (res.benchmark_instances) {
+        if (has_frame_limit && res.frame_limit == 0) {
+            log_error("The instance benchmark needs a number of frames per step (--frames can't be 0)");
+            exit(1);
+        }
+        res.headless = true;
+        res.stats_interval = 0.0;
+        if (!has_frame_limit) {
+            res.frame_limit = BENCHMARK_FRAMES;
+            has_frame_limit = true;
+        }
+    }
+
+    if (res.latency_policy == LatencyCapped && res.fps_cap <= 0) {
+        log_error("The capped latency policy needs a frame rate (--fps-cap FPS)");
+        exit(1);
+    }
+
+    // There is no window to close in headless mode, so always stop eventually
+    if (res.headless && has_frame_limit && res.frame_limit == 0) {
+        log_error("Headless runs need a frame limit (--frames can't be 0)");
+        exit(1);
+    }
+    if (res.headless && !has_frame_limit) {
+        res.frame_limit = DEFAULT_HEADLESS_FRAME_LIMIT;
+    }
+
+    // Each image has its own region of the uniform ring with cached command buffers
+    if (res.cache_commands && res.image_count > UNIFORM_RING_REGIONS) {
+        log_error("At most %u swapchain images are supported with cached command buffers", UNIFORM_RING_REGIONS);
+        exit(1);
+    }
+
+    // Secondary buffers are recorded from per frame pools, which are reset under the cached buffers referencing them
+    if (res.cache_commands && res.record_slices > 0) {
+        log_warn("Parallel recording isn't supported with cached command buffers, recording inline");
+        res.record_slices = 0;
+    }
+
+    // The culling pass writes the draws, so there is neither a draw list nor slices of it to record in parallel
+    if (res.gpu_culling && res.draw_count != 1) {
+        log_warn("The draws are written by the culling pass, ignoring the draw count");
+        res.draw_count = 1;
+    }
+    if (res.gpu_culling && res.record_slices > 0) {
+        log_warn("Parallel recording isn't supported with GPU culling, recording inline");
+        res.record_slices = 0;
+    }
+
+    // The sprites change every frame, and are drawn in the main render pass after the instances
+    if (res.sprite_count > 0 && res.cache_commands) {
+        log_warn("Sprites aren't supported with cached command buffers, disabling the overlay");
+        res.sprite_count = 0;
+    }
+    if (res.sprite_count > 0 && res.record_slices > 0) {
+        log_warn("Parallel recording isn't supported with sprites, recording inline");
+        res.record_slices = 0;
+    }
+
+    return res;
+}
+
+int main(int argc, char **argv) {
     logger_set_fd(stdout);
     logger_enable_severities(Info | Warning | Error);
     logger_init();
 
-    Window win = window_init("Window!", 800, 600);
-    win.ctx = ctx_init("vulkan_app", &win);
+    Settings settings = settings_init(argc, argv);
+
+    Window win = {0};
+    if (!settings.headless) {
+        win = window_init("Window!", settings.width, settings.height);
+    }
+    win.ctx = ctx_init("vulkan_app", &win, &settings);
 
     window_run(&win);
 
@@ -0,0 +1,216 @@
+#include "mesh.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "staging.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Alignment of the streams in the mesh's buffer
+#define MESH_STREAM_ALIGNMENT 16
+
+static inline VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+const char *mesh_layout_name(MeshLayout layout) {
+    switch (layout) {
+    case MeshInterleaved:
+        return "interleaved";
+    case MeshSplit:
+        return "split";
+    }
+    return "unknown";
+}
+
+VertexLayout mesh_vertex_layout(MeshLayout layout) {
+    VertexLayout res = {0};
+    res.attribute_count = 2;
+    res.attributes[0] = (VkVertexInputAttributeDescription){
+        .location = 0,
+        .binding = 0,
+        .format = VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = offsetof(Vertex, position),
+    };
+
+    if (layout == MeshInterleaved) {
+        res.binding_count = 1;
+        res.bindings[0] = (VkVertexInputBindingDescription){
+            .binding = 0,
+            .stride = sizeof(Vertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        res.attributes[1] = (VkVertexInputAttributeDescription){
+            .location = 1,
+            .binding = 0,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = offsetof(Vertex, color),
+        };
+    } else {
+        res.binding_count = 2;
+        res.bindings[0] = (VkVertexInputBindingDescription){
+            .binding = 0,
+            .stride = sizeof(float[3]),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        res.bindings[1] = (VkVertexInputBindingDescription){
+            .binding = 1,
+            .stride = sizeof(float[3]),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        res.attributes[0].offset = 0;
+        res.attributes[1] = (VkVertexInputAttributeDescription){
+            .location = 1,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = 0,
+        };
+    }
+
+    return res;
+}
+
+Mesh mesh_init(
+    Allocator *allocator,
+    StagingRing *staging,
+    VkDevice device,
+    MeshLayout layout,
+    const Vertex *vertices,
+    uint32_t vertex_count,
+    const uint32_t *indices,
+    uint32_t index_count
+) {
+    Mesh res = {0};
+    res.layout = layout;
+    res.vertex_count = vertex_count;
+    res.index_count = index_count;
+    res.radius = 0.0f;
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        const float *p = vertices[i].position;
+        res.radius = fmaxf(res.radius, sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]));
+    }
+
+    VkDeviceSize size = 0;
+    if (layout == MeshInterleaved) {
+        res.stream_count = 1;
+        res.stream_offsets[0] = 0;
+        size = (VkDeviceSize)vertex_count * sizeof(Vertex);
+    } else {
+        res.stream_count = 2;
+        res.stream_offsets[0] = 0;
+        res.stream_offsets[1] = align_up((VkDeviceSize)vertex_count * sizeof(float[3]), MESH_STREAM_ALIGNMENT);
+        size = res.stream_offsets[1] + (VkDeviceSize)vertex_count * sizeof(float[3]);
+    }
+    res.index_offset = align_up(size, MESH_STREAM_ALIGNMENT);
+    size = res.index_offset + (VkDeviceSize)index_count * sizeof(uint32_t);
+
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = size;
+    create_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vk_try(vkCreateBuffer(device, &create_info, NULL, &res.buffer), "Failed to create mesh buffer");
+    vk_try(
+        allocator_bind_buffer(allocator, res.buffer, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &res.allocation),
+        "Failed to allocate mesh memory"
+    );
+
+    if (layout == MeshInterleaved) {
+        staging_ring_upload_buffer(staging, vertices, (VkDeviceSize)vertex_count * sizeof(Vertex), res.buffer, 0);
+    } else {
+        // Split the attributes in their streams
+        float(*positions)[3] = malloc(vertex_count * sizeof(float[3]));
+        float(*colors)[3] = malloc(vertex_count * sizeof(float[3]));
+        assert_alloc(positions);
+        assert_alloc(colors);
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            memcpy(positions[i], vertices[i].position, sizeof(float[3]));
+            memcpy(colors[i], vertices[i].color, sizeof(float[3]));
+        }
+
+        VkDeviceSize stream_size = (VkDeviceSize)vertex_count * sizeof(float[3]);
+        staging_ring_upload_buffer(staging, positions, stream_size, res.buffer, res.stream_offsets[0]);
+        staging_ring_upload_buffer(staging, colors, stream_size, res.buffer, res.stream_offsets[1]);
+
+        free(positions);
+        free(colors);
+    }
+    staging_ring_upload_buffer(staging, indices, (VkDeviceSize)index_count * sizeof(uint32_t), res.buffer, res.index_offset);
+
+    res.upload = staging_ring_submit(staging);
+
+    return res;
+}
+
+void mesh_subdivided_triangle(
+    uint32_t subdivisions, Vertex **vertices, uint32_t *vertex_count, uint32_t **indices, uint32_t *index_count
+) {
+    // Corners (clockwise, as the front face) and their colors
+    static const float CORNERS[3][2] = {{0.0f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+    static const float COLORS[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+
+    uint32_t n = subdivisions > 0 ? subdivisions : 1;
+    // Row r (from the top corner) has r + 1 vertices
+    *vertex_count = (n + 1) * (n + 2) / 2;
+    *index_count = n * n * 3;
+    *vertices = malloc(*vertex_count * sizeof(Vertex));
+    *indices = malloc(*index_count * sizeof(uint32_t));
+    assert_alloc(*vertices);
+    assert_alloc(*indices);
+
+    Vertex *v = *vertices;
+    for (uint32_t r = 0; r <= n; r++) {
+        for (uint32_t c = 0; c <= r; c++) {
+            // Barycentric coordinates
+            float w[3] = {(float)(n - r) / n, (float)c / n, (float)(r - c) / n};
+            Vertex vertex = {0};
+            for (uint32_t k = 0; k < 3; k++) {
+                vertex.position[0] += w[k] * CORNERS[k][0];
+                vertex.position[1] += w[k] * CORNERS[k][1];
+                vertex.color[0] += w[k] * COLORS[k][0];
+                vertex.color[1] += w[k] * COLORS[k][1];
+                vertex.color[2] += w[k] * COLORS[k][2];
+            }
+            *v++ = vertex;
+        }
+    }
+
+    uint32_t *i = *indices;
+    for (uint32_t r = 0; r < n; r++) {
+        uint32_t row = r * (r + 1) / 2;
+        uint32_t next = (r + 1) * (r + 2) / 2;
+        for (uint32_t c = 0; c <= r; c++) {
+            // Pointing up, with the same winding as the whole triangle
+            *i++ = row + c;
+            *i++ = next + c + 1;
+            *i++ = next + c;
+            // Pointing down, between this one and the next
+            if (c < r) {
+                *i++ = row + c;
+                *i++ = row + c + 1;
+                *i++ = next + c + 1;
+            }
+        }
+    }
+}
+
+void mesh_bind(const Mesh *mesh, VkCommandBuffer buffer) {
+    VkBuffer buffers[MESH_MAX_STREAMS];
+    for (uint32_t i = 0; i < mesh->stream_count; i++) {
+        buffers[i] = mesh->buffer;
+    }
+    vkCmdBindVertexBuffers(buffer, 0, mesh->stream_count, buffers, mesh->stream_offsets);
+    vkCmdBindIndexBuffer(buffer, mesh->buffer, mesh->index_offset, VK_INDEX_TYPE_UINT32);
+}
+
+void mesh_drop(Mesh mesh, VkDevice device, Allocator *allocator) {
+    vkDestroyBuffer(device, mesh.buffer, NULL);
+    allocator_free(allocator, &mesh.allocation);
+}
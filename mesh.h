@@ -0,0 +1,77 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "allocator.h"
+#include "staging.h"
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#define MESH_MAX_STREAMS 2
+// Room for the mesh's streams and attributes, and the per instance ones
+#define VERTEX_LAYOUT_MAX_BINDINGS 3
+#define VERTEX_LAYOUT_MAX_ATTRIBUTES 4
+
+// How the vertices are laid out in memory
+typedef enum {
+    // A single stream of whole vertices
+    MeshInterleaved,
+    // A stream of positions, and one of the other attributes (passes that only need positions read less memory)
+    MeshSplit,
+} MeshLayout;
+
+// A vertex as given to mesh_init (and as stored by interleaved meshes)
+typedef struct {
+    float position[3];
+    float color[3];
+} Vertex;
+
+// Vertex input description of a layout, for pipeline creation
+typedef struct {
+    uint32_t binding_count;
+    VkVertexInputBindingDescription bindings[VERTEX_LAYOUT_MAX_BINDINGS];
+    uint32_t attribute_count;
+    VkVertexInputAttributeDescription attributes[VERTEX_LAYOUT_MAX_ATTRIBUTES];
+} VertexLayout;
+
+// Indexed triangle list in device memory
+typedef struct {
+    MeshLayout layout;
+    // Holds the vertex streams followed by the indices
+    VkBuffer buffer;
+    Allocation allocation;
+    uint32_t stream_count;
+    VkDeviceSize stream_offsets[MESH_MAX_STREAMS];
+    VkDeviceSize index_offset;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    // Radius of the bounding sphere centered on the mesh's origin
+    float radius;
+    // Staging ring submission uploading the mesh, it can't be drawn before it is done
+    uint64_t upload;
+} Mesh;
+
+const char *mesh_layout_name(MeshLayout layout);
+VertexLayout mesh_vertex_layout(MeshLayout layout);
+// Create a mesh and submit the upload of its data
+Mesh mesh_init(
+    Allocator *allocator,
+    StagingRing *staging,
+    VkDevice device,
+    MeshLayout layout,
+    const Vertex *vertices,
+    uint32_t vertex_count,
+    const uint32_t *indices,
+    uint32_t index_count
+);
+// Generate a triangle split in subdivisions^2 triangles, colored from red to green and blue at its corners. The
+// arrays are allocated with malloc.
+void mesh_subdivided_triangle(
+    uint32_t subdivisions, Vertex **vertices, uint32_t *vertex_count, uint32_t **indices, uint32_t *index_count
+);
+// Bind the mesh's vertex and index buffers
+void mesh_bind(const Mesh *mesh, VkCommandBuffer buffer);
+// The mesh mustn't be in use by the device anymore
+void mesh_drop(Mesh mesh, VkDevice device, Allocator *allocator);
+
+#endif
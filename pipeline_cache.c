@@ -0,0 +1,96 @@
+#include "pipeline_cache.h"
+
+#include "assert.h"
+#include "fs.h"
+#include "log.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Check that the cache data was written by the same device and driver
+static bool pipeline_cache_valid(const VkPhysicalDeviceProperties *props, const void *data, size_t size) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (size < sizeof(header)) {
+        log_warn("Pipeline cache is truncated, discarding it");
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (header.headerSize < sizeof(header) || header.headerSize > size ||
+        header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+        log_warn("Pipeline cache has an invalid header, discarding it");
+        return false;
+    }
+    if (header.vendorID != props->vendorID || header.deviceID != props->deviceID ||
+        memcmp(header.pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        log_info("Pipeline cache was written for another device or driver, discarding it");
+        return false;
+    }
+    return true;
+}
+
+VkPipelineCache pipeline_cache_load(VkPhysicalDevice physical_device, VkDevice device, const char *path) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+
+    size_t size = 0;
+    void *data = fs_read_file(path, &size);
+    if (data != NULL && !pipeline_cache_valid(&props, data, size)) {
+        free(data);
+        data = NULL;
+        size = 0;
+    }
+
+    VkPipelineCacheCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = size;
+    create_info.pInitialData = data;
+
+    VkPipelineCache cache;
+    VkResult result = vkCreatePipelineCache(device, &create_info, NULL, &cache);
+    if (result != VK_SUCCESS && data != NULL) {
+        // The driver is still allowed to refuse it, start from scratch then
+        log_warn("Failed to create pipeline cache from '%s' (%s), discarding it", path, string_VkResult(result));
+        create_info.initialDataSize = 0;
+        create_info.pInitialData = NULL;
+        result = vkCreatePipelineCache(device, &create_info, NULL, &cache);
+    }
+    vk_try(result, "Failed to create pipeline cache");
+
+    if (data != NULL) {
+        log_info("Loaded pipeline cache '%s' (%lu bytes)", path, (unsigned long)size);
+        free(data);
+    }
+
+    return cache;
+}
+
+void pipeline_cache_save(VkDevice device, VkPipelineCache cache, const char *path) {
+    size_t size = 0;
+    vk_try(vkGetPipelineCacheData(device, cache, &size, NULL), "Failed to get pipeline cache size");
+    if (size == 0) {
+        return;
+    }
+
+    void *data = malloc(size);
+    assert_alloc(data);
+    VkResult result = vkGetPipelineCacheData(device, cache, &size, data);
+    if (result != VK_SUCCESS) {
+        log_warn("Failed to get pipeline cache data (%s)", string_VkResult(result));
+        free(data);
+        return;
+    }
+
+    if (fs_write_file_atomic(path, data, size)) {
+        log_debug("Saved pipeline cache '%s' (%lu bytes)", path, (unsigned long)size);
+    } else {
+        log_warn("Failed to save pipeline cache to '%s'", path);
+    }
+
+    free(data);
+}
@@ -0,0 +1,12 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <vulkan/vulkan.h>
+
+// Create a pipeline cache, with the content of the file at path if it exists and was written for the same device and
+// driver (it is discarded otherwise).
+VkPipelineCache pipeline_cache_load(VkPhysicalDevice physical_device, VkDevice device, const char *path);
+// Write the content of the cache to path, atomically (through a temporary file renamed over the previous one)
+void pipeline_cache_save(VkDevice device, VkPipelineCache cache, const char *path);
+
+#endif
@@ -0,0 +1,152 @@
+#include "recorder.h"
+
+#include "assert.h"
+#include "job.h"
+#include "log.h"
+#include "rendering.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vulkan/vulkan.h>
+
+// Slices smaller than this aren't worth a job
+#define RECORDER_MIN_DRAWS 64
+
+static void recorder_record_slice(void *data) {
+    RecorderSlice *slice = data;
+    const RecordJob *job = slice->job;
+    uint32_t first = (uint64_t)job->draw_count * slice->index / slice->active;
+    uint32_t last = (uint64_t)job->draw_count * (slice->index + 1) / slice->active;
+
+    slice->recorded = false;
+    if (first == last) {
+        return;
+    }
+
+    VkCommandBuffer buffer = slice->buffers[slice->frame];
+
+    VkCommandBufferInheritanceInfo inheritance_info;
+    VkCommandBufferInheritanceRenderingInfo rendering_info;
+    render_target_inheritance(&job->target, job->framebuffer, &inheritance_info, &rendering_info);
+
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    vk_try(vkBeginCommandBuffer(buffer, &begin_info), "Failed to begin secondary command buffer");
+
+    // Secondary command buffers don't inherit any state
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, job->pipeline);
+    vkCmdBindDescriptorSets(
+        buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, job->pipeline_layout, 0, 1, &job->frame_set, 1, &job->frame_offset
+    );
+    vkCmdSetViewport(buffer, 0, 1, &job->viewport);
+    vkCmdSetScissor(buffer, 0, 1, &job->scissor);
+    mesh_bind(job->mesh, buffer);
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(buffer, job->mesh->stream_count, 1, &job->instance_buffer, &offset);
+    for (uint32_t i = first; i < last; i++) {
+        const DrawCommand *draw = &job->draws[i];
+        vkCmdPushConstants(
+            buffer, job->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants), &job->constants[i]
+        );
+        vkCmdDrawIndexed(
+            buffer, draw->index_count, draw->instance_count, draw->first_index, draw->vertex_offset, draw->first_instance
+        );
+    }
+
+    vk_try(vkEndCommandBuffer(buffer), "Failed to record secondary command buffer");
+    slice->recorded = true;
+}
+
+Recorder recorder_init(VkDevice device, uint32_t queue_family, JobSystem *jobs, uint32_t slice_count, uint32_t frame_count) {
+    Recorder res = {0};
+    res.device = device;
+    res.jobs = jobs;
+    res.slice_count = slice_count;
+    res.frame_count = frame_count;
+
+    res.slices = malloc(slice_count * sizeof(RecorderSlice));
+    res.slice_jobs = malloc(slice_count * sizeof(Job));
+    assert_alloc(res.slices);
+    assert_alloc(res.slice_jobs);
+
+    VkCommandPoolCreateInfo pool_create_info = {0};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    // The whole pool is reset at once, every time the frame is recorded
+    pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_create_info.queueFamilyIndex = queue_family;
+
+    for (uint32_t i = 0; i < slice_count; i++) {
+        RecorderSlice *slice = &res.slices[i];
+        slice->index = i;
+        slice->recorded = false;
+        slice->pools = malloc(frame_count * sizeof(VkCommandPool));
+        slice->buffers = malloc(frame_count * sizeof(VkCommandBuffer));
+        assert_alloc(slice->pools);
+        assert_alloc(slice->buffers);
+
+        for (uint32_t f = 0; f < frame_count; f++) {
+            vk_try(
+                vkCreateCommandPool(device, &pool_create_info, NULL, &slice->pools[f]), "Failed to create recorder command pool"
+            );
+
+            VkCommandBufferAllocateInfo alloc_info = {0};
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.commandPool = slice->pools[f];
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            alloc_info.commandBufferCount = 1;
+
+            vk_try(
+                vkAllocateCommandBuffers(device, &alloc_info, &slice->buffers[f]), "Failed to allocate secondary command buffer"
+            );
+        }
+    }
+
+    return res;
+}
+
+uint32_t recorder_record(Recorder *rec, uint32_t frame, const RecordJob *job, VkCommandBuffer *buffers) {
+    uint32_t active = (job->draw_count + RECORDER_MIN_DRAWS - 1) / RECORDER_MIN_DRAWS;
+    if (active > rec->slice_count) {
+        active = rec->slice_count;
+    }
+
+    for (uint32_t i = 0; i < active; i++) {
+        RecorderSlice *slice = &rec->slices[i];
+        // Pools are reset here rather than in the jobs, as it is cheap compared to the recording
+        vkResetCommandPool(rec->device, slice->pools[frame], 0);
+        slice->job = job;
+        slice->frame = frame;
+        slice->active = active;
+        rec->slice_jobs[i] = (Job){.func = recorder_record_slice, .data = slice};
+    }
+
+    JobCounter counter = 0;
+    job_system_run(rec->jobs, rec->slice_jobs, active, &counter);
+    job_system_wait(rec->jobs, &counter);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < active; i++) {
+        if (rec->slices[i].recorded) {
+            buffers[count++] = rec->slices[i].buffers[frame];
+        }
+    }
+    return count;
+}
+
+void recorder_drop(Recorder rec) {
+    for (uint32_t i = 0; i < rec.slice_count; i++) {
+        RecorderSlice *slice = &rec.slices[i];
+        for (uint32_t f = 0; f < rec.frame_count; f++) {
+            vkDestroyCommandPool(rec.device, slice->pools[f], NULL);
+        }
+        free(slice->pools);
+        free(slice->buffers);
+    }
+    free(rec.slices);
+    free(rec.slice_jobs);
+}
@@ -0,0 +1,80 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "job.h"
+#include "mesh.h"
+#include "rendering.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// A draw of the draw list (parameters of vkCmdDrawIndexed)
+typedef struct {
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t first_instance;
+} DrawCommand;
+
+// Push constants of the draws (small per draw data)
+typedef struct {
+    // Multiplies the color of the draw's instances
+    float tint[4];
+} DrawConstants;
+
+// Everything needed to record a slice of the draw list inside a render pass (or dynamic rendering)
+typedef struct {
+    RenderTarget target;
+    // Unused with dynamic rendering
+    VkFramebuffer framebuffer;
+    VkPipeline pipeline;
+    VkPipelineLayout pipeline_layout;
+    // Set 0, and the dynamic offset of the frame's uniforms
+    VkDescriptorSet frame_set;
+    uint32_t frame_offset;
+    const Mesh *mesh;
+    // Per instance attributes, bound after the mesh's streams
+    VkBuffer instance_buffer;
+    VkViewport viewport;
+    VkRect2D scissor;
+    const DrawCommand *draws;
+    // Pushed before each draw
+    const DrawConstants *constants;
+    uint32_t draw_count;
+} RecordJob;
+
+// A slice of the draw list, recorded by a single job at a time into a command pool (and a secondary command buffer)
+// of its own per frame in flight
+typedef struct {
+    uint32_t index;
+    VkCommandPool *pools;
+    VkCommandBuffer *buffers;
+    // Parameters of the current recording
+    const RecordJob *job;
+    uint32_t frame;
+    uint32_t active;
+    // Whether the buffer of the last recording has been recorded (false if the slice was empty)
+    bool recorded;
+} RecorderSlice;
+
+// Records secondary command buffers for disjoint slices of a draw list, as jobs of the job system
+typedef struct {
+    VkDevice device;
+    JobSystem *jobs;
+    uint32_t slice_count;
+    uint32_t frame_count;
+    RecorderSlice *slices;
+    Job *slice_jobs;
+} Recorder;
+
+Recorder recorder_init(VkDevice device, uint32_t queue_family, JobSystem *jobs, uint32_t slice_count, uint32_t frame_count);
+// Record the job in parallel, with the frame's pools (which mustn't be in use by the device anymore). Blocks until
+// every slice is done (running jobs in the meantime), and writes the recorded buffers (in draw order) to buffers,
+// which must be able to hold slice_count buffers. Returns the number of buffers written.
+uint32_t recorder_record(Recorder *rec, uint32_t frame, const RecordJob *job, VkCommandBuffer *buffers);
+// Destroy the pools, which mustn't be in use by the device anymore
+void recorder_drop(Recorder rec);
+
+#endif
@@ -0,0 +1,47 @@
+#include "rendering.h"
+
+#include <vulkan/vulkan.h>
+
+void render_target_pipeline(
+    const RenderTarget *target, VkGraphicsPipelineCreateInfo *create_info, VkPipelineRenderingCreateInfo *rendering
+) {
+    create_info->renderPass = target->render_pass;
+    create_info->subpass = 0;
+    if (target->render_pass != VK_NULL_HANDLE) {
+        return;
+    }
+
+    *rendering = (VkPipelineRenderingCreateInfo){0};
+    rendering->sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    rendering->pNext = create_info->pNext;
+    rendering->colorAttachmentCount = 1;
+    rendering->pColorAttachmentFormats = &target->color_format;
+    rendering->depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+    rendering->stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+    create_info->pNext = rendering;
+}
+
+void render_target_inheritance(
+    const RenderTarget *target,
+    VkFramebuffer framebuffer,
+    VkCommandBufferInheritanceInfo *inheritance,
+    VkCommandBufferInheritanceRenderingInfo *rendering
+) {
+    *inheritance = (VkCommandBufferInheritanceInfo){0};
+    inheritance->sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance->renderPass = target->render_pass;
+    inheritance->subpass = 0;
+    if (target->render_pass != VK_NULL_HANDLE) {
+        inheritance->framebuffer = framebuffer;
+        return;
+    }
+
+    *rendering = (VkCommandBufferInheritanceRenderingInfo){0};
+    rendering->sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    rendering->colorAttachmentCount = 1;
+    rendering->pColorAttachmentFormats = &target->color_format;
+    rendering->depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+    rendering->stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+    rendering->rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    inheritance->pNext = rendering;
+}
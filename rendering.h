@@ -0,0 +1,27 @@
+#ifndef RENDERING_H
+#define RENDERING_H
+
+#include <vulkan/vulkan.h>
+
+// What the pipelines and secondary command buffers of a pass render to: subpass 0 of a render pass, or with dynamic
+// rendering (render_pass is VK_NULL_HANDLE) an attachment of color_format
+typedef struct {
+    VkRenderPass render_pass;
+    VkFormat color_format;
+} RenderTarget;
+
+// Point a pipeline at the target: sets its render pass, or chains rendering (which must live until the pipeline is
+// created) to it
+void render_target_pipeline(
+    const RenderTarget *target, VkGraphicsPipelineCreateInfo *create_info, VkPipelineRenderingCreateInfo *rendering
+);
+// Fill the inheritance info of secondary command buffers recorded inside the target, chaining rendering to it with
+// dynamic rendering (framebuffer is ignored then)
+void render_target_inheritance(
+    const RenderTarget *target,
+    VkFramebuffer framebuffer,
+    VkCommandBufferInheritanceInfo *inheritance,
+    VkCommandBufferInheritanceRenderingInfo *rendering
+);
+
+#endif
@@ -1,20 +1,27 @@
 #version 450
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
-
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 in_color;
+// Offset (xy), scale (z) and rotation (w)
+layout(location = 2) in vec4 transform;
+layout(location = 3) in vec4 instance_color;
 
 layout(location = 0) out vec3 color;
 
+// Slice of the uniform ring, bound with a dynamic offset
+layout(set = 0, binding = 0) uniform Frame {
+    // Scale (xy) and offset (zw) from the scene to clip space
+    vec4 view;
+} frame;
+
+layout(push_constant) uniform Draw {
+    vec4 tint;
+} draw;
+
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    color = colors[gl_VertexIndex];
+    float s = sin(transform.w);
+    float c = cos(transform.w);
+    vec2 pos = mat2(c, s, -s, c) * position.xy * transform.z + transform.xy;
+    gl_Position = vec4(pos * frame.view.xy + frame.view.zw, position.z, 1.0);
+    color = in_color * instance_color.rgb * draw.tint.rgb;
 }
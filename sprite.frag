@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+layout(location = 0) in vec4 color;
+layout(location = 1) in vec2 uv;
+
+void main() {
+    // Round sprites, with a soft edge
+    float d = length(uv * 2.0 - 1.0);
+    outColor = vec4(color.rgb, color.a * (1.0 - smoothstep(0.8, 1.0, d)));
+}
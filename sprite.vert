@@ -0,0 +1,14 @@
+#version 450
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 in_uv;
+layout(location = 2) in vec4 in_color;
+
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec2 uv;
+
+void main() {
+    gl_Position = vec4(position, 0.0, 1.0);
+    color = in_color;
+    uv = in_uv;
+}
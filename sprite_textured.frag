@@ -0,0 +1,25 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) out vec4 outColor;
+layout(location = 0) in vec4 color;
+layout(location = 1) in vec2 uv;
+
+// Every texture of the bindless table
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+layout(push_constant) uniform Draw {
+    // 0 for round sprites, otherwise one more than the index of the texture
+    uint texture_index;
+} draw;
+
+void main() {
+    if (draw.texture_index == 0) {
+        // Round sprites, with a soft edge
+        float d = length(uv * 2.0 - 1.0);
+        outColor = vec4(color.rgb, color.a * (1.0 - smoothstep(0.8, 1.0, d)));
+    } else {
+        // The same for the whole draw, no need for nonuniformEXT
+        outColor = color * texture(textures[draw.texture_index - 1], uv);
+    }
+}
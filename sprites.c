@@ -0,0 +1,428 @@
+#include "sprites.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "bindless.h"
+#include "log.h"
+#include "rendering.h"
+#include "staging.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+__attribute__((aligned(4))) static const uint8_t SPRITE_VERTEX_SHADER[] = {
+#include "include/sprite.vert.spv.bytes"
+};
+static const size_t SPRITE_VERTEX_SHADER_LEN = sizeof(SPRITE_VERTEX_SHADER) / sizeof(uint8_t);
+__attribute__((aligned(4))) static const uint8_t SPRITE_FRAGMENT_SHADER[] = {
+#include "include/sprite.frag.spv.bytes"
+};
+static const size_t SPRITE_FRAGMENT_SHADER_LEN = sizeof(SPRITE_FRAGMENT_SHADER) / sizeof(uint8_t);
+__attribute__((aligned(4))) static const uint8_t SPRITE_TEXTURED_FRAGMENT_SHADER[] = {
+#include "include/sprite_textured.frag.spv.bytes"
+};
+static const size_t SPRITE_TEXTURED_FRAGMENT_SHADER_LEN = sizeof(SPRITE_TEXTURED_FRAGMENT_SHADER) / sizeof(uint8_t);
+
+// Size of the vertices of a frame in the vertex ring
+#define SPRITE_FRAME_SIZE ((VkDeviceSize)SPRITE_MAX_QUADS * 4 * sizeof(SpriteVertex))
+
+static VkShaderModule sprite_shader_module(VkDevice device, const uint8_t *code, size_t len) {
+    VkShaderModuleCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.codeSize = len;
+    create_info.pCode = (const uint32_t *)code;
+    VkShaderModule module;
+    vk_try(vkCreateShaderModule(device, &create_info, NULL, &module), "Failed to create sprite shader module");
+    return module;
+}
+
+static void sprite_batch_create_pipelines(SpriteBatch *batch, VkPipelineCache pipeline_cache, const RenderTarget *target) {
+    VkShaderModule vertex_shader = sprite_shader_module(batch->device, SPRITE_VERTEX_SHADER, SPRITE_VERTEX_SHADER_LEN);
+    VkShaderModule fragment_shader =
+        batch->bindless
+            ? sprite_shader_module(batch->device, SPRITE_TEXTURED_FRAGMENT_SHADER, SPRITE_TEXTURED_FRAGMENT_SHADER_LEN)
+            : sprite_shader_module(batch->device, SPRITE_FRAGMENT_SHADER, SPRITE_FRAGMENT_SHADER_LEN);
+
+    VkPipelineShaderStageCreateInfo stages[2] = {0};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertex_shader;
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragment_shader;
+    stages[1].pName = "main";
+
+    VkVertexInputBindingDescription binding = {
+        .binding = 0,
+        .stride = sizeof(SpriteVertex),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+    };
+    VkVertexInputAttributeDescription attributes[3] = {
+        {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT, .offset = offsetof(SpriteVertex, position)},
+        {.location = 1, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT, .offset = offsetof(SpriteVertex, uv)},
+        {.location = 2, .binding = 0, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = offsetof(SpriteVertex, color)},
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_state = {0};
+    vertex_input_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_state.vertexBindingDescriptionCount = 1;
+    vertex_input_state.pVertexBindingDescriptions = &binding;
+    vertex_input_state.vertexAttributeDescriptionCount = 3;
+    vertex_input_state.pVertexAttributeDescriptions = attributes;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {0};
+    input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    static const VkDynamicState DYNAMIC_STATES[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+    VkPipelineDynamicStateCreateInfo dynamic_state = {0};
+    dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state.dynamicStateCount = 2;
+    dynamic_state.pDynamicStates = DYNAMIC_STATES;
+
+    VkPipelineViewportStateCreateInfo viewport_state = {0};
+    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.scissorCount = 1;
+    viewport_state.viewportCount = 1;
+
+    // Rotated sprites can face either way
+    VkPipelineRasterizationStateCreateInfo rasterizer_state = {0};
+    rasterizer_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer_state.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer_state.lineWidth = 1.0f;
+    rasterizer_state.cullMode = VK_CULL_MODE_NONE;
+    rasterizer_state.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisample_state = {0};
+    multisample_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample_state.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisample_state.minSampleShading = 1.0f;
+
+    VkPipelineColorBlendAttachmentState blend_attachment_state = {0};
+    blend_attachment_state.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    blend_attachment_state.blendEnable = VK_TRUE;
+    blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    blend_attachment_state.colorBlendOp = VK_BLEND_OP_ADD;
+    blend_attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    blend_attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo color_blend_state = {0};
+    color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blend_state.attachmentCount = 1;
+    color_blend_state.pAttachments = &blend_attachment_state;
+
+    VkGraphicsPipelineCreateInfo create_infos[SPRITE_BLEND_COUNT] = {0};
+    VkPipelineRenderingCreateInfo rendering_infos[SPRITE_BLEND_COUNT];
+    VkPipelineColorBlendAttachmentState blend_attachment_states[SPRITE_BLEND_COUNT];
+    VkPipelineColorBlendStateCreateInfo color_blend_states[SPRITE_BLEND_COUNT];
+    for (uint32_t i = 0; i < SPRITE_BLEND_COUNT; i++) {
+        blend_attachment_states[i] = blend_attachment_state;
+        blend_attachment_states[i].dstColorBlendFactor =
+            i == SpriteAdditive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        color_blend_states[i] = color_blend_state;
+        color_blend_states[i].pAttachments = &blend_attachment_states[i];
+
+        VkGraphicsPipelineCreateInfo *create_info = &create_infos[i];
+        create_info->sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        create_info->stageCount = 2;
+        create_info->pStages = stages;
+        create_info->pVertexInputState = &vertex_input_state;
+        create_info->pInputAssemblyState = &input_assembly;
+        create_info->pViewportState = &viewport_state;
+        create_info->pRasterizationState = &rasterizer_state;
+        create_info->pMultisampleState = &multisample_state;
+        create_info->pColorBlendState = &color_blend_states[i];
+        create_info->pDynamicState = &dynamic_state;
+        create_info->layout = batch->pipeline_layout;
+        create_info->basePipelineIndex = -1;
+        render_target_pipeline(target, create_info, &rendering_infos[i]);
+    }
+
+    vk_try(
+        vkCreateGraphicsPipelines(batch->device, pipeline_cache, SPRITE_BLEND_COUNT, create_infos, NULL, batch->pipelines),
+        "Failed to create sprite pipelines"
+    );
+
+    vkDestroyShaderModule(batch->device, fragment_shader, NULL);
+    vkDestroyShaderModule(batch->device, vertex_shader, NULL);
+}
+
+static void sprite_batch_create_vertex_ring(SpriteBatch *batch, Allocator *allocator) {
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = SPRITE_FRAME_SIZE * batch->frame_count;
+    create_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vk_try(vkCreateBuffer(batch->device, &create_info, NULL, &batch->vertex_buffer), "Failed to create sprite vertex ring");
+    vk_try(
+        allocator_bind_streaming_buffer(allocator, batch->vertex_buffer, &batch->vertex_allocation),
+        "Failed to allocate sprite vertex ring memory"
+    );
+}
+
+SpriteBatch sprite_batch_init(
+    Allocator *allocator,
+    StagingRing *staging,
+    VkDevice device,
+    VkPipelineCache pipeline_cache,
+    const RenderTarget *target,
+    VkDescriptorSetLayout bindless_layout,
+    uint32_t frame_count
+) {
+    SpriteBatch res = {0};
+    res.device = device;
+    res.bindless = bindless_layout != VK_NULL_HANDLE;
+
+    // The texture of the draw (see SPRITE_KEY)
+    VkPushConstantRange push_constant_range = {0};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo layout_create_info = {0};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    if (res.bindless) {
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &bindless_layout;
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &push_constant_range;
+    }
+    vk_try(
+        vkCreatePipelineLayout(device, &layout_create_info, NULL, &res.pipeline_layout), "Failed to create sprite pipeline layout"
+    );
+    sprite_batch_create_pipelines(&res, pipeline_cache, target);
+
+    // Two triangles per quad, clockwise: top left, top right, bottom right, bottom left
+    uint32_t *indices = malloc(SPRITE_MAX_QUADS * 6 * sizeof(uint32_t));
+    assert_alloc(indices);
+    for (uint32_t i = 0; i < SPRITE_MAX_QUADS; i++) {
+        uint32_t *quad = &indices[i * 6];
+        quad[0] = i * 4 + 0;
+        quad[1] = i * 4 + 1;
+        quad[2] = i * 4 + 2;
+        quad[3] = i * 4 + 0;
+        quad[4] = i * 4 + 2;
+        quad[5] = i * 4 + 3;
+    }
+
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = SPRITE_MAX_QUADS * 6 * sizeof(uint32_t);
+    create_info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vk_try(vkCreateBuffer(device, &create_info, NULL, &res.index_buffer), "Failed to create sprite index buffer");
+    vk_try(
+        allocator_bind_buffer(allocator, res.index_buffer, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &res.index_allocation),
+        "Failed to allocate sprite index buffer memory"
+    );
+    staging_ring_upload_buffer(staging, indices, create_info.size, res.index_buffer, 0);
+    res.upload = staging_ring_submit(staging);
+    free(indices);
+
+    res.frame_count = frame_count;
+    sprite_batch_create_vertex_ring(&res, allocator);
+
+    res.sprites = malloc(SPRITE_MAX_QUADS * sizeof(Sprite));
+    res.keys = malloc(SPRITE_MAX_QUADS * sizeof(uint32_t));
+    res.order = malloc(SPRITE_MAX_QUADS * sizeof(uint32_t));
+    res.scratch_keys = malloc(SPRITE_MAX_QUADS * sizeof(uint32_t));
+    res.scratch_order = malloc(SPRITE_MAX_QUADS * sizeof(uint32_t));
+    res.draws = malloc(SPRITE_MAX_QUADS * sizeof(SpriteDraw));
+    assert_alloc(res.sprites);
+    assert_alloc(res.keys);
+    assert_alloc(res.order);
+    assert_alloc(res.scratch_keys);
+    assert_alloc(res.scratch_order);
+    assert_alloc(res.draws);
+
+    return res;
+}
+
+void sprite_batch_set_frame_count(SpriteBatch *batch, Allocator *allocator, uint32_t frame_count) {
+    vkDestroyBuffer(batch->device, batch->vertex_buffer, NULL);
+    allocator_free(allocator, &batch->vertex_allocation);
+    batch->frame_count = frame_count;
+    batch->frame = 0;
+    batch->count = 0;
+    batch->draw_count = 0;
+    sprite_batch_create_vertex_ring(batch, allocator);
+}
+
+void sprite_batch_begin(SpriteBatch *batch, uint32_t frame) {
+    assert(frame < batch->frame_count, "Sprite frame %u out of range (%u frames)", frame, batch->frame_count);
+    batch->frame = frame;
+    batch->count = 0;
+}
+
+bool sprite_batch_push(SpriteBatch *batch, const Sprite *sprite) {
+    if (batch->count == SPRITE_MAX_QUADS) {
+        batch->dropped++;
+        return false;
+    }
+    batch->sprites[batch->count++] = *sprite;
+    return true;
+}
+
+// Stable least significant digit radix sort of the keys (and the sprite indices along them), a byte at a time.
+// Passes over bytes that are the same for every key are skipped, so few distinct keys sort in a pass or two.
+static void sprite_batch_sort(SpriteBatch *batch) {
+    uint32_t count = batch->count;
+    uint32_t *keys = batch->keys;
+    uint32_t *order = batch->order;
+    uint32_t *scratch_keys = batch->scratch_keys;
+    uint32_t *scratch_order = batch->scratch_order;
+
+    for (uint32_t i = 0; i < count; i++) {
+        keys[i] = batch->sprites[i].key;
+        order[i] = i;
+    }
+
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t offsets[256] = {0};
+        for (uint32_t i = 0; i < count; i++) {
+            offsets[(keys[i] >> shift) & 0xff]++;
+        }
+        if (count == 0 || offsets[(keys[0] >> shift) & 0xff] == count) {
+            continue;
+        }
+
+        uint32_t total = 0;
+        for (uint32_t digit = 0; digit < 256; digit++) {
+            uint32_t digit_count = offsets[digit];
+            offsets[digit] = total;
+            total += digit_count;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t dst = offsets[(keys[i] >> shift) & 0xff]++;
+            scratch_keys[dst] = keys[i];
+            scratch_order[dst] = order[i];
+        }
+
+        uint32_t *tmp = keys;
+        keys = scratch_keys;
+        scratch_keys = tmp;
+        tmp = order;
+        order = scratch_order;
+        scratch_order = tmp;
+    }
+
+    // Whichever arrays hold the result become the sorted ones
+    batch->keys = keys;
+    batch->order = order;
+    batch->scratch_keys = scratch_keys;
+    batch->scratch_order = scratch_order;
+}
+
+void sprite_batch_end(SpriteBatch *batch) {
+    sprite_batch_sort(batch);
+
+    SpriteVertex *vertices = (SpriteVertex *)((uint8_t *)batch->vertex_allocation.mapped + SPRITE_FRAME_SIZE * batch->frame);
+    batch->draw_count = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const Sprite *sprite = &batch->sprites[batch->order[i]];
+
+        // Corners in the order of the indices
+        float s = sinf(sprite->rotation);
+        float c = cosf(sprite->rotation);
+        static const float CORNERS[4][2] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+        // The ring may be write combined: build the quad on the stack, and write it at once
+        SpriteVertex quad[4];
+        for (uint32_t j = 0; j < 4; j++) {
+            float x = CORNERS[j][0] * sprite->size[0];
+            float y = CORNERS[j][1] * sprite->size[1];
+            quad[j].position[0] = sprite->position[0] + x * c - y * s;
+            quad[j].position[1] = sprite->position[1] + x * s + y * c;
+            quad[j].uv[0] = CORNERS[j][0] < 0.0f ? sprite->uv[0] : sprite->uv[2];
+            quad[j].uv[1] = CORNERS[j][1] < 0.0f ? sprite->uv[1] : sprite->uv[3];
+            quad[j].color = sprite->color;
+        }
+        memcpy(&vertices[i * 4], quad, sizeof(quad));
+
+        if (batch->draw_count == 0 || batch->draws[batch->draw_count - 1].key != sprite->key) {
+            batch->draws[batch->draw_count++] = (SpriteDraw){.key = sprite->key, .first_quad = i, .quad_count = 0};
+        }
+        batch->draws[batch->draw_count - 1].quad_count++;
+    }
+
+    batch->frames++;
+    batch->quads += batch->count;
+    batch->total_draws += batch->draw_count;
+}
+
+void sprite_batch_draw(SpriteBatch *batch, VkCommandBuffer buffer, BindlessTable *bindless) {
+    if (batch->draw_count == 0) {
+        return;
+    }
+
+    VkDeviceSize offset = SPRITE_FRAME_SIZE * batch->frame;
+    vkCmdBindVertexBuffers(buffer, 0, 1, &batch->vertex_buffer, &offset);
+    vkCmdBindIndexBuffer(buffer, batch->index_buffer, 0, VK_INDEX_TYPE_UINT32);
+    // Every texture is reached through the one set, so it is bound once whatever the draws use
+    if (batch->bindless) {
+        bindless_table_bind(bindless, buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch->pipeline_layout, 0);
+    }
+
+    // Draws are sorted by key, so each pipeline is bound once
+    int64_t bound = -1;
+    int64_t texture = -1;
+    for (uint32_t i = 0; i < batch->draw_count; i++) {
+        SpriteDraw *draw = &batch->draws[i];
+        SpriteBlend blend = SPRITE_KEY_BLEND(draw->key);
+        if (blend != bound) {
+            vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch->pipelines[blend]);
+            batch->pipeline_binds++;
+            bound = blend;
+        }
+        if (batch->bindless && SPRITE_KEY_TEXTURE(draw->key) != texture) {
+            uint32_t value = SPRITE_KEY_TEXTURE(draw->key);
+            vkCmdPushConstants(buffer, batch->pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &value);
+            batch->texture_changes++;
+            texture = value;
+        }
+        vkCmdDrawIndexed(buffer, draw->quad_count * 6, 1, draw->first_quad * 6, 0, 0);
+    }
+}
+
+void sprite_batch_log_stats(SpriteBatch *batch, double elapsed) {
+    if (batch->frames == 0) {
+        return;
+    }
+    log_info(
+        "Sprites: %.2f Mquads/s, %.1f quads, %.2f draws, %.2f pipeline binds, %.2f texture changes per frame (%lu dropped)",
+        batch->quads / elapsed * 1e-6,
+        (double)batch->quads / batch->frames,
+        (double)batch->total_draws / batch->frames,
+        (double)batch->pipeline_binds / batch->frames,
+        (double)batch->texture_changes / batch->frames,
+        (unsigned long)batch->dropped
+    );
+}
+
+void sprite_batch_drop(SpriteBatch batch, Allocator *allocator) {
+    for (uint32_t i = 0; i < SPRITE_BLEND_COUNT; i++) {
+        vkDestroyPipeline(batch.device, batch.pipelines[i], NULL);
+    }
+    vkDestroyPipelineLayout(batch.device, batch.pipeline_layout, NULL);
+    vkDestroyBuffer(batch.device, batch.index_buffer, NULL);
+    allocator_free(allocator, &batch.index_allocation);
+    vkDestroyBuffer(batch.device, batch.vertex_buffer, NULL);
+    allocator_free(allocator, &batch.vertex_allocation);
+    free(batch.sprites);
+    free(batch.keys);
+    free(batch.order);
+    free(batch.scratch_keys);
+    free(batch.scratch_order);
+    free(batch.draws);
+}
@@ -0,0 +1,125 @@
+#ifndef SPRITES_H
+#define SPRITES_H
+
+#include "allocator.h"
+#include "bindless.h"
+#include "rendering.h"
+#include "staging.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Quads a frame can draw, further sprites are dropped
+#define SPRITE_MAX_QUADS 65536
+
+// How sprites are blended, each mode has its own pipeline
+typedef enum {
+    SpriteAlpha,
+    SpriteAdditive,
+    SPRITE_BLEND_COUNT,
+} SpriteBlend;
+
+// Sprites are drawn sorted by key, and a draw covers a run of sprites with the same key: the pipeline (blend mode) in
+// the high byte, and the texture in the low bits (0 for round untextured sprites, otherwise one more than the index of
+// the texture in the bindless table, which needs bindless resources)
+#define SPRITE_KEY(blend, texture) ((uint32_t)(blend) << 24 | (uint32_t)(texture))
+#define SPRITE_KEY_BLEND(key) ((SpriteBlend)((key) >> 24))
+#define SPRITE_KEY_TEXTURE(key) ((key) & 0xffffff)
+
+typedef struct {
+    // Center and half extent in clip space, rotation in radians
+    float position[2];
+    float size[2];
+    float rotation;
+    // Texture coordinates of the top left and bottom right corners
+    float uv[4];
+    // RGBA, 8 bits per channel (red in the lowest byte)
+    uint32_t color;
+    uint32_t key;
+} Sprite;
+
+typedef struct {
+    float position[2];
+    float uv[2];
+    uint32_t color;
+} SpriteVertex;
+
+// Run of sorted quads drawn at once
+typedef struct {
+    uint32_t key;
+    uint32_t first_quad;
+    uint32_t quad_count;
+} SpriteDraw;
+
+// Batches the sprites of a frame: they are pushed in any order, sorted by key (with a radix sort), and written to
+// the frame's part of a persistently mapped vertex ring, to be drawn in as few draws as there are keys. Nothing is
+// allocated or created per frame.
+typedef struct {
+    VkDevice device;
+    // Whether sprites are textured, through the bindless table (set 0) and the texture pushed per draw
+    bool bindless;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipelines[SPRITE_BLEND_COUNT];
+
+    // Indices of SPRITE_MAX_QUADS quads, shared by every frame
+    VkBuffer index_buffer;
+    Allocation index_allocation;
+    // Staging ring submission uploading the indices
+    uint64_t upload;
+
+    // SPRITE_MAX_QUADS quads per frame in flight
+    uint32_t frame_count;
+    VkBuffer vertex_buffer;
+    Allocation vertex_allocation;
+
+    // Sprites pushed for the current frame
+    uint32_t frame;
+    uint32_t count;
+    Sprite *sprites;
+    // Sort keys and sprite indices, and their scratch copies for the radix sort passes
+    uint32_t *keys;
+    uint32_t *order;
+    uint32_t *scratch_keys;
+    uint32_t *scratch_order;
+
+    // Draws of the last ended frame
+    uint32_t draw_count;
+    SpriteDraw *draws;
+
+    // Totals since the batch was created
+    uint64_t frames;
+    uint64_t quads;
+    uint64_t total_draws;
+    uint64_t pipeline_binds;
+    uint64_t texture_changes;
+    uint64_t dropped;
+} SpriteBatch;
+
+// bindless_layout is the layout of the bindless table sprites are textured from (VK_NULL_HANDLE: untextured sprites)
+SpriteBatch sprite_batch_init(
+    Allocator *allocator,
+    StagingRing *staging,
+    VkDevice device,
+    VkPipelineCache pipeline_cache,
+    const RenderTarget *target,
+    VkDescriptorSetLayout bindless_layout,
+    uint32_t frame_count
+);
+// Change the number of frames in flight, the vertex ring mustn't be in use by the device anymore
+void sprite_batch_set_frame_count(SpriteBatch *batch, Allocator *allocator, uint32_t frame_count);
+// Start the sprites of a frame, whose part of the vertex ring mustn't be in use by the device anymore
+void sprite_batch_begin(SpriteBatch *batch, uint32_t frame);
+// Returns false if the frame is full, and the sprite is dropped
+bool sprite_batch_push(SpriteBatch *batch, const Sprite *sprite);
+// Sort the sprites, write their vertices and build the draws
+void sprite_batch_end(SpriteBatch *batch);
+// Record the draws of the last ended frame, in a render pass with the viewport and scissor set. bindless is the table
+// whose layout the batch was created with (NULL without one).
+void sprite_batch_draw(SpriteBatch *batch, VkCommandBuffer buffer, BindlessTable *bindless);
+// Log the quads drawn per second (over elapsed seconds), and the draws per frame
+void sprite_batch_log_stats(SpriteBatch *batch, double elapsed);
+// The buffers mustn't be in use by the device anymore
+void sprite_batch_drop(SpriteBatch batch, Allocator *allocator);
+
+#endif
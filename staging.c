@@ -0,0 +1,478 @@
+#include "staging.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+static VkSemaphore create_timeline_semaphore(VkDevice device) {
+    VkSemaphoreTypeCreateInfo type_info = {0};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    create_info.pNext = &type_info;
+
+    VkSemaphore res;
+    vk_try(vkCreateSemaphore(device, &create_info, NULL, &res), "Failed to create timeline semaphore");
+    return res;
+}
+
+static VkCommandPool create_command_pool(VkDevice device, uint32_t family) {
+    VkCommandPoolCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    create_info.queueFamilyIndex = family;
+    create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkCommandPool res;
+    vk_try(vkCreateCommandPool(device, &create_info, NULL, &res), "Failed to create staging command pool");
+    return res;
+}
+
+static void allocate_command_buffer(VkDevice device, VkCommandPool pool, VkCommandBuffer *buffer) {
+    VkCommandBufferAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+
+    vk_try(vkAllocateCommandBuffers(device, &alloc_info, buffer), "Failed to allocate staging command buffer");
+}
+
+static void begin_command_buffer(VkCommandBuffer buffer) {
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vk_try(vkBeginCommandBuffer(buffer, &begin_info), "Failed to begin staging command buffer");
+}
+
+// Submit a single command buffer, with an optional timeline semaphore to wait on, and one to signal
+static void submit_timeline(
+    VkQueue queue,
+    VkCommandBuffer buffer,
+    VkSemaphore wait,
+    uint64_t wait_value,
+    VkSemaphore signal,
+    uint64_t signal_value
+) {
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {0};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = wait != VK_NULL_HANDLE;
+    timeline_info.pWaitSemaphoreValues = &wait_value;
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &signal_value;
+
+    VkSubmitInfo submit_info = {0};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = wait != VK_NULL_HANDLE;
+    submit_info.pWaitSemaphores = &wait;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &signal;
+
+    vk_try(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE), "Failed to submit staging command buffer");
+}
+
+static uint64_t semaphore_value(VkDevice device, VkSemaphore semaphore) {
+    uint64_t value;
+    vk_try(vkGetSemaphoreCounterValue(device, semaphore, &value), "Failed to get semaphore value");
+    return value;
+}
+
+static void wait_semaphore(VkDevice device, VkSemaphore semaphore, uint64_t value) {
+    VkSemaphoreWaitInfo wait_info = {0};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &semaphore;
+    wait_info.pValues = &value;
+
+    vk_try(vkWaitSemaphores(device, &wait_info, UINT64_MAX), "Failed to wait on semaphore");
+}
+
+StagingRing staging_ring_init(
+    Allocator *allocator,
+    VkDevice device,
+    VkQueue transfer_queue,
+    uint32_t transfer_family,
+    VkQueue graphics_queue,
+    uint32_t graphics_family,
+    VkDeviceSize size
+) {
+    assert(size > 0 && (size & (size - 1)) == 0, "Staging ring size must be a power of two");
+
+    StagingRing res = {0};
+    res.device = device;
+    res.size = size;
+    res.head = 0;
+    res.tail = 0;
+    res.transfer_queue = transfer_queue;
+    res.graphics_queue = graphics_queue;
+    res.transfer_family = transfer_family;
+    res.graphics_family = graphics_family;
+    res.next_value = 1;
+
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = size;
+    create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vk_try(vkCreateBuffer(device, &create_info, NULL, &res.buffer), "Failed to create staging buffer");
+    vk_try(
+        allocator_bind_buffer(
+            allocator,
+            res.buffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            0,
+            &res.allocation
+        ),
+        "Failed to allocate staging buffer memory"
+    );
+    assert(res.allocation.mapped != NULL, "Staging buffer isn't mapped");
+
+    res.transfer_pool = create_command_pool(device, transfer_family);
+    res.graphics_pool = VK_NULL_HANDLE;
+    res.copy_semaphore = VK_NULL_HANDLE;
+    if (transfer_family != graphics_family) {
+        res.graphics_pool = create_command_pool(device, graphics_family);
+        res.copy_semaphore = create_timeline_semaphore(device);
+    }
+    res.semaphore = create_timeline_semaphore(device);
+
+    for (uint32_t i = 0; i < STAGING_MAX_BATCHES; i++) {
+        StagingBatch *batch = &res.batches[i];
+        *batch = (StagingBatch){0};
+        allocate_command_buffer(device, res.transfer_pool, &batch->copy);
+        batch->acquire = VK_NULL_HANDLE;
+        if (res.graphics_pool != VK_NULL_HANDLE) {
+            allocate_command_buffer(device, res.graphics_pool, &batch->acquire);
+        }
+    }
+
+    return res;
+}
+
+// Submit the acquisition of the destinations of a batch whose copies are done
+static void _staging_ring_acquire(StagingRing *ring, StagingBatch *batch) {
+    // Same transfers as the release, from the point of view of the graphics queue
+    for (uint32_t i = 0; i < batch->barrier_count; i++) {
+        batch->barriers[i].srcAccessMask = 0;
+        batch->barriers[i].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    }
+    for (uint32_t i = 0; i < batch->image_barrier_count; i++) {
+        batch->image_barriers[i].srcAccessMask = 0;
+        batch->image_barriers[i].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    }
+
+    begin_command_buffer(batch->acquire);
+    vkCmdPipelineBarrier(
+        batch->acquire,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        0,
+        NULL,
+        batch->barrier_count,
+        batch->barriers,
+        batch->image_barrier_count,
+        batch->image_barriers
+    );
+    vk_try(vkEndCommandBuffer(batch->acquire), "Failed to record acquire command buffer");
+
+    // The copies are done, so this doesn't hold the graphics queue
+    submit_timeline(ring->graphics_queue, batch->acquire, ring->copy_semaphore, batch->value, ring->semaphore, batch->value);
+    batch->acquired = true;
+}
+
+// Make the space of the complete batches available again
+static void _staging_ring_reclaim(StagingRing *ring) {
+    uint64_t done = semaphore_value(ring->device, ring->semaphore);
+    while (ring->pending_batches > 0 && ring->batches[ring->first_batch].value <= done) {
+        ring->tail = ring->batches[ring->first_batch].end;
+        ring->first_batch = (ring->first_batch + 1) % STAGING_MAX_BATCHES;
+        ring->pending_batches--;
+    }
+}
+
+void staging_ring_update(StagingRing *ring) {
+    if (ring->copy_semaphore != VK_NULL_HANDLE) {
+        uint64_t copied = semaphore_value(ring->device, ring->copy_semaphore);
+        for (uint32_t i = 0; i < ring->pending_batches; i++) {
+            StagingBatch *batch = &ring->batches[(ring->first_batch + i) % STAGING_MAX_BATCHES];
+            if (batch->value > copied) {
+                break;
+            }
+            if (!batch->acquired) {
+                _staging_ring_acquire(ring, batch);
+            }
+        }
+    }
+    _staging_ring_reclaim(ring);
+}
+
+bool staging_ring_done(StagingRing *ring, uint64_t value) {
+    staging_ring_update(ring);
+    return semaphore_value(ring->device, ring->semaphore) >= value;
+}
+
+void staging_ring_wait(StagingRing *ring, uint64_t value) {
+    // Batches are acquired in order, so every one up to value needs to be
+    for (uint32_t i = 0; i < ring->pending_batches; i++) {
+        StagingBatch *batch = &ring->batches[(ring->first_batch + i) % STAGING_MAX_BATCHES];
+        if (batch->value > value) {
+            break;
+        }
+        if (!batch->acquired) {
+            wait_semaphore(ring->device, ring->copy_semaphore, batch->value);
+            _staging_ring_acquire(ring, batch);
+        }
+    }
+    wait_semaphore(ring->device, ring->semaphore, value);
+    _staging_ring_reclaim(ring);
+}
+
+// The batch being recorded, starting one if there is none
+static StagingBatch *_staging_ring_begin(StagingRing *ring) {
+    if (!ring->recording) {
+        if (ring->pending_batches == STAGING_MAX_BATCHES) {
+            staging_ring_wait(ring, ring->batches[ring->first_batch].value);
+        }
+
+        StagingBatch *batch = &ring->batches[(ring->first_batch + ring->pending_batches) % STAGING_MAX_BATCHES];
+        begin_command_buffer(batch->copy);
+        batch->barrier_count = 0;
+        batch->image_barrier_count = 0;
+        batch->end = ring->head;
+        batch->acquired = false;
+        ring->recording = true;
+    }
+    return &ring->batches[(ring->first_batch + ring->pending_batches) % STAGING_MAX_BATCHES];
+}
+
+static void *_staging_ring_alloc(StagingRing *ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset, bool wait) {
+    if (size > ring->size) {
+        return NULL;
+    }
+    if (alignment == 0) {
+        alignment = 1;
+    }
+
+    staging_ring_update(ring);
+    // Starting a batch would wait for the oldest one to complete
+    if (!wait && !ring->recording && ring->pending_batches == STAGING_MAX_BATCHES) {
+        return NULL;
+    }
+
+    // Data can't wrap around the end of the buffer, skip to its start if it would
+    uint64_t base = ring->head - ring->head % ring->size;
+    VkDeviceSize off = (ring->head % ring->size + alignment - 1) / alignment * alignment;
+    if (off + size > ring->size) {
+        base += ring->size;
+        off = 0;
+    }
+    uint64_t pos = base + off;
+
+    while (pos + size > ring->tail + ring->size) {
+        if (ring->tail == ring->head) {
+            // Nothing is in use: skip the tail ahead
+            ring->tail = pos;
+            break;
+        }
+        if (!wait) {
+            return NULL;
+        }
+        if (ring->pending_batches == 0) {
+            // Everything in use belongs to the batch being recorded
+            staging_ring_submit(ring);
+        }
+        staging_ring_wait(ring, ring->batches[ring->first_batch].value);
+    }
+
+    StagingBatch *batch = _staging_ring_begin(ring);
+    ring->head = pos + size;
+    batch->end = ring->head;
+
+    *offset = off;
+    return (uint8_t *)ring->allocation.mapped + off;
+}
+
+void *staging_ring_alloc(StagingRing *ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset) {
+    return _staging_ring_alloc(ring, size, alignment, offset, true);
+}
+
+void *staging_ring_try_alloc(StagingRing *ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset) {
+    return _staging_ring_alloc(ring, size, alignment, offset, false);
+}
+
+void staging_ring_copy_buffer(StagingRing *ring, VkDeviceSize offset, VkBuffer dst, VkDeviceSize dst_offset, VkDeviceSize size) {
+    StagingBatch *batch = _staging_ring_begin(ring);
+
+    VkBufferCopy region = {0};
+    region.srcOffset = offset;
+    region.dstOffset = dst_offset;
+    region.size = size;
+    vkCmdCopyBuffer(batch->copy, ring->buffer, dst, 1, &region);
+
+    if (ring->copy_semaphore == VK_NULL_HANDLE) {
+        return;
+    }
+
+    if (batch->barrier_count == batch->barrier_cap) {
+        batch->barrier_cap = batch->barrier_cap == 0 ? 16 : batch->barrier_cap * 2;
+        batch->barriers = realloc(batch->barriers, batch->barrier_cap * sizeof(VkBufferMemoryBarrier));
+        assert_alloc(batch->barriers);
+    }
+
+    VkBufferMemoryBarrier *barrier = &batch->barriers[batch->barrier_count++];
+    *barrier = (VkBufferMemoryBarrier){0};
+    barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier->dstAccessMask = 0;
+    barrier->srcQueueFamilyIndex = ring->transfer_family;
+    barrier->dstQueueFamilyIndex = ring->graphics_family;
+    barrier->buffer = dst;
+    barrier->offset = dst_offset;
+    barrier->size = size;
+}
+
+static inline VkImageMemoryBarrier image_barrier(VkImage image, uint32_t mip_levels) {
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mip_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    return barrier;
+}
+
+void staging_ring_prepare_image(StagingRing *ring, VkImage image, uint32_t mip_levels) {
+    StagingBatch *batch = _staging_ring_begin(ring);
+
+    VkImageMemoryBarrier barrier = image_barrier(image, mip_levels);
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        batch->copy, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier
+    );
+}
+
+void staging_ring_copy_image(StagingRing *ring, VkDeviceSize offset, VkImage dst, VkBufferImageCopy region) {
+    StagingBatch *batch = _staging_ring_begin(ring);
+    region.bufferOffset = offset;
+    vkCmdCopyBufferToImage(batch->copy, ring->buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+void staging_ring_release_image(StagingRing *ring, VkImage image, uint32_t mip_levels) {
+    StagingBatch *batch = _staging_ring_begin(ring);
+    // The end of batch barrier covers the image when the copies are done on the graphics queue
+    if (ring->copy_semaphore == VK_NULL_HANDLE) {
+        return;
+    }
+
+    if (batch->image_barrier_count == batch->image_barrier_cap) {
+        batch->image_barrier_cap = batch->image_barrier_cap == 0 ? 16 : batch->image_barrier_cap * 2;
+        batch->image_barriers = realloc(batch->image_barriers, batch->image_barrier_cap * sizeof(VkImageMemoryBarrier));
+        assert_alloc(batch->image_barriers);
+    }
+
+    VkImageMemoryBarrier *barrier = &batch->image_barriers[batch->image_barrier_count++];
+    *barrier = image_barrier(image, mip_levels);
+    barrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier->dstAccessMask = 0;
+    barrier->srcQueueFamilyIndex = ring->transfer_family;
+    barrier->dstQueueFamilyIndex = ring->graphics_family;
+}
+
+VkDeviceSize staging_ring_max_chunk(StagingRing *ring) { return ring->size / 2; }
+
+void staging_ring_upload_buffer(StagingRing *ring, const void *data, VkDeviceSize size, VkBuffer dst, VkDeviceSize dst_offset) {
+    VkDeviceSize chunk_size = staging_ring_max_chunk(ring);
+    for (VkDeviceSize done = 0; done < size; done += chunk_size) {
+        VkDeviceSize len = size - done < chunk_size ? size - done : chunk_size;
+        VkDeviceSize offset;
+        void *ptr = staging_ring_alloc(ring, len, 4, &offset);
+        memcpy(ptr, (const uint8_t *)data + done, len);
+        staging_ring_copy_buffer(ring, offset, dst, dst_offset + done, len);
+    }
+}
+
+uint64_t staging_ring_submit(StagingRing *ring) {
+    if (!ring->recording) {
+        return ring->next_value - 1;
+    }
+
+    StagingBatch *batch = &ring->batches[(ring->first_batch + ring->pending_batches) % STAGING_MAX_BATCHES];
+    batch->value = ring->next_value++;
+
+    if (ring->copy_semaphore == VK_NULL_HANDLE) {
+        // The copies are done on the graphics queue: make them visible to everything submitted after them
+        VkMemoryBarrier barrier = {0};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        vkCmdPipelineBarrier(
+            batch->copy, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL, 0, NULL
+        );
+        vk_try(vkEndCommandBuffer(batch->copy), "Failed to record staging command buffer");
+        submit_timeline(ring->transfer_queue, batch->copy, VK_NULL_HANDLE, 0, ring->semaphore, batch->value);
+        batch->acquired = true;
+    } else {
+        // Release the destinations to the graphics queue, which acquires them once the copies are done
+        vkCmdPipelineBarrier(
+            batch->copy,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0,
+            NULL,
+            batch->barrier_count,
+            batch->barriers,
+            batch->image_barrier_count,
+            batch->image_barriers
+        );
+        vk_try(vkEndCommandBuffer(batch->copy), "Failed to record staging command buffer");
+        submit_timeline(ring->transfer_queue, batch->copy, VK_NULL_HANDLE, 0, ring->copy_semaphore, batch->value);
+    }
+
+    ring->recording = false;
+    ring->pending_batches++;
+    return batch->value;
+}
+
+void staging_ring_drop(StagingRing ring, Allocator *allocator) {
+    staging_ring_wait(&ring, staging_ring_submit(&ring));
+
+    for (uint32_t i = 0; i < STAGING_MAX_BATCHES; i++) {
+        free(ring.batches[i].barriers);
+        free(ring.batches[i].image_barriers);
+    }
+    // Destroying the pools frees their command buffers
+    vkDestroyCommandPool(ring.device, ring.transfer_pool, NULL);
+    if (ring.graphics_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(ring.device, ring.graphics_pool, NULL);
+        vkDestroySemaphore(ring.device, ring.copy_semaphore, NULL);
+    }
+    vkDestroySemaphore(ring.device, ring.semaphore, NULL);
+    vkDestroyBuffer(ring.device, ring.buffer, NULL);
+    allocator_free(allocator, &ring.allocation);
+}
@@ -0,0 +1,113 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include "allocator.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Default size of the staging ring (must be a power of two)
+#define STAGING_RING_SIZE (16ull << 20)
+// Maximum number of batches submitted and not yet complete
+#define STAGING_MAX_BATCHES 8
+
+// The copies recorded between two submissions
+typedef struct {
+    VkCommandBuffer copy;
+    // Acquires the ownership of the destinations on the graphics queue (VK_NULL_HANDLE if the copies are done on it)
+    VkCommandBuffer acquire;
+    // Ownership transfers of the destinations (only used with a dedicated transfer queue)
+    VkBufferMemoryBarrier *barriers;
+    uint32_t barrier_count;
+    uint32_t barrier_cap;
+    VkImageMemoryBarrier *image_barriers;
+    uint32_t image_barrier_count;
+    uint32_t image_barrier_cap;
+    // Ring position the batch's data ends at
+    uint64_t end;
+    // Value of the ring's semaphores once the batch is complete
+    uint64_t value;
+    // Whether the acquire has been submitted
+    bool acquired;
+} StagingBatch;
+
+// Persistently mapped ring buffer data is written to before being copied to device local memory. Copies are done on
+// the transfer queue (when it is distinct from the graphics one), and their completion is tracked with timeline
+// semaphores: a batch's part of the ring is reused once the semaphore reaches its value. The ownership of the
+// destinations is only acquired on the graphics queue once the copies are done, so that it never waits on them.
+typedef struct {
+    VkDevice device;
+    VkBuffer buffer;
+    Allocation allocation;
+    VkDeviceSize size;
+    // Positions in the ring (they only ever increase, offsets are taken modulo size), the data between tail and head
+    // may still be in use
+    uint64_t head;
+    uint64_t tail;
+
+    VkQueue transfer_queue;
+    VkQueue graphics_queue;
+    uint32_t transfer_family;
+    uint32_t graphics_family;
+    VkCommandPool transfer_pool;
+    // VK_NULL_HANDLE if the transfer and graphics families are the same
+    VkCommandPool graphics_pool;
+    // Timeline signaled once the copies are done on the transfer queue (VK_NULL_HANDLE if it isn't distinct)
+    VkSemaphore copy_semaphore;
+    // Timeline signaled once the data can be used on the graphics queue
+    VkSemaphore semaphore;
+    uint64_t next_value;
+
+    StagingBatch batches[STAGING_MAX_BATCHES];
+    // Batches submitted that aren't known to be complete (oldest first), the one after them is being recorded if
+    // recording is true
+    uint32_t first_batch;
+    uint32_t pending_batches;
+    bool recording;
+} StagingRing;
+
+// transfer_queue can be the graphics queue (with transfer_family == graphics_family)
+StagingRing staging_ring_init(
+    Allocator *allocator,
+    VkDevice device,
+    VkQueue transfer_queue,
+    uint32_t transfer_family,
+    VkQueue graphics_queue,
+    uint32_t graphics_family,
+    VkDeviceSize size
+);
+// Reserve size bytes of the ring (waiting for previous uploads to complete if it is full), returns a pointer to write
+// the data to and sets offset to its offset in the ring's buffer. Returns NULL if size is larger than the ring.
+void *staging_ring_alloc(StagingRing *ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset);
+// Same as staging_ring_alloc, but returns NULL instead of waiting if the ring is full (or every batch is pending)
+void *staging_ring_try_alloc(StagingRing *ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset);
+// Copy data written at offset in the ring (by staging_ring_alloc) to dst
+void staging_ring_copy_buffer(StagingRing *ring, VkDeviceSize offset, VkBuffer dst, VkDeviceSize dst_offset, VkDeviceSize size);
+// Move every level of an image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL (discarding its content), before copying to it
+void staging_ring_prepare_image(StagingRing *ring, VkImage image, uint32_t mip_levels);
+// Copy data written at offset in the ring (by staging_ring_alloc) to a prepared image, region.bufferOffset is set to
+// offset
+void staging_ring_copy_image(StagingRing *ring, VkDeviceSize offset, VkImage dst, VkBufferImageCopy region);
+// Hand a prepared image over to the graphics queue once the copies recorded so far are done, it stays in
+// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+void staging_ring_release_image(StagingRing *ring, VkImage image, uint32_t mip_levels);
+// Largest allocation uploads should be split into: half the ring, so that a chunk can be written while the previous
+// one is copied
+VkDeviceSize staging_ring_max_chunk(StagingRing *ring);
+// Upload size bytes of data to dst, in chunks if it doesn't fit the ring
+void staging_ring_upload_buffer(StagingRing *ring, const void *data, VkDeviceSize size, VkBuffer dst, VkDeviceSize dst_offset);
+// Submit the copies recorded so far, returns the value the ring's semaphore reaches once they are done (or the value
+// of the last submission if there wasn't anything to submit)
+uint64_t staging_ring_submit(StagingRing *ring);
+// Hand the destinations of the copies that are done over to the graphics queue, and reclaim the space of the
+// complete batches. Doesn't block, should be called regularly (i.e. every frame).
+void staging_ring_update(StagingRing *ring);
+// Whether the submission that returned value is complete: work submitted to the graphics queue from then on sees
+// the uploaded data
+bool staging_ring_done(StagingRing *ring, uint64_t value);
+void staging_ring_wait(StagingRing *ring, uint64_t value);
+// Wait for every submission to complete and destroy the ring
+void staging_ring_drop(StagingRing ring, Allocator *allocator);
+
+#endif
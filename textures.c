@@ -0,0 +1,465 @@
+#include "textures.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "fs.h"
+#include "image.h"
+#include "job.h"
+#include "log.h"
+#include "staging.h"
+#include "timing.h"
+#include "utils.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Read and decode the file of a load, on a background thread (can't log)
+static void texture_decode(void *data) {
+    TextureLoad *load = data;
+    uint64_t start = timing_now();
+
+    size_t size;
+    uint8_t *file = fs_read_file(load->path, &size);
+    if (file == NULL) {
+        load->error = "Can't read file";
+    } else {
+        load->error = image_decode(&load->buffer, file, size);
+        free(file);
+    }
+
+    load->decode_time = timing_now() - start;
+}
+
+TextureLoader texture_loader_init(
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    JobSystem *jobs,
+    VkQueue graphics_queue,
+    uint32_t graphics_family,
+    double timestamp_period,
+    uint64_t timestamp_mask
+) {
+    TextureLoader res = {0};
+    res.device = device;
+    res.jobs = jobs;
+    res.graphics_queue = graphics_queue;
+    res.next_value = 1;
+    res.timestamp_period = timestamp_period;
+    res.timestamp_mask = timestamp_mask;
+
+    VkFormatProperties format_props;
+    vkGetPhysicalDeviceFormatProperties(physical_device, TEXTURE_FORMAT, &format_props);
+    VkFormatFeatureFlags blit_features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                         VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    res.mipmaps = (format_props.optimalTilingFeatures & blit_features) == blit_features;
+    if (!res.mipmaps) {
+        log_warn("Texture format doesn't support linear blits, textures won't have mips");
+    }
+
+    VkCommandPoolCreateInfo pool_create_info = {0};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_create_info.queueFamilyIndex = graphics_family;
+    pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    vk_try(vkCreateCommandPool(device, &pool_create_info, NULL, &res.command_pool), "Failed to create texture command pool");
+
+    VkSemaphoreTypeCreateInfo type_info = {0};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+    VkSemaphoreCreateInfo semaphore_create_info = {0};
+    semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_create_info.pNext = &type_info;
+    vk_try(vkCreateSemaphore(device, &semaphore_create_info, NULL, &res.semaphore), "Failed to create texture semaphore");
+
+    res.timestamps = VK_NULL_HANDLE;
+    if (timestamp_period > 0.0) {
+        VkQueryPoolCreateInfo query_create_info = {0};
+        query_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_create_info.queryCount = TEXTURE_MAX_LOADS * 2;
+        vk_try(vkCreateQueryPool(device, &query_create_info, NULL, &res.timestamps), "Failed to create texture query pool");
+    }
+
+    VkSamplerCreateInfo sampler_create_info = {0};
+    sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_create_info.magFilter = VK_FILTER_LINEAR;
+    sampler_create_info.minFilter = VK_FILTER_LINEAR;
+    sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_create_info.minLod = 0.0f;
+    sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
+    vk_try(vkCreateSampler(device, &sampler_create_info, NULL, &res.sampler), "Failed to create texture sampler");
+
+    res.loads = malloc(TEXTURE_MAX_LOADS * sizeof(TextureLoad));
+    assert_alloc(res.loads);
+    VkCommandBuffer buffers[TEXTURE_MAX_LOADS];
+    VkCommandBufferAllocateInfo alloc_info = {0};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = res.command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = TEXTURE_MAX_LOADS;
+    vk_try(vkAllocateCommandBuffers(device, &alloc_info, buffers), "Failed to allocate texture command buffers");
+    for (uint32_t i = 0; i < TEXTURE_MAX_LOADS; i++) {
+        res.loads[i] = (TextureLoad){0};
+        res.loads[i].buffer = image_buffer_init();
+        res.loads[i].commands = buffers[i];
+        atomic_init(&res.loads[i].counter, 0);
+    }
+
+    return res;
+}
+
+TextureHandle texture_loader_load(TextureLoader *loader, const char *path) {
+    if (loader->count == loader->cap) {
+        loader->cap = loader->cap == 0 ? 16 : loader->cap * 2;
+        loader->textures = realloc(loader->textures, loader->cap * sizeof(Texture));
+        assert_alloc(loader->textures);
+    }
+
+    Texture *tex = &loader->textures[loader->count];
+    *tex = (Texture){0};
+    tex->state = TextureQueued;
+    tex->path = malloc(strlen(path) + 1);
+    assert_alloc(tex->path);
+    strcpy(tex->path, path);
+    return loader->count++;
+}
+
+// Create the image of a decoded texture
+static void _texture_loader_create_image(TextureLoader *loader, Allocator *allocator, Texture *tex, const ImageBuffer *buf) {
+    tex->width = buf->width;
+    tex->height = buf->height;
+    tex->mip_levels = 1;
+    if (loader->mipmaps) {
+        uint32_t side = tex->width > tex->height ? tex->width : tex->height;
+        while (side > 1) {
+            side /= 2;
+            tex->mip_levels++;
+        }
+    }
+
+    VkImageCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    create_info.imageType = VK_IMAGE_TYPE_2D;
+    create_info.format = TEXTURE_FORMAT;
+    create_info.extent.width = tex->width;
+    create_info.extent.height = tex->height;
+    create_info.extent.depth = 1;
+    create_info.mipLevels = tex->mip_levels;
+    create_info.arrayLayers = 1;
+    create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    create_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    vk_try(vkCreateImage(loader->device, &create_info, NULL, &tex->image), "Failed to create texture image");
+    vk_try(
+        allocator_bind_image(
+            allocator,
+            tex->image,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            0,
+            &tex->allocation
+        ),
+        "Failed to allocate texture memory"
+    );
+}
+
+// Copy the next rows of a texture to the staging ring, as far as the budget and the room in the ring allow. Returns
+// the bytes copied.
+static VkDeviceSize _texture_loader_upload(TextureLoad *load, Texture *tex, StagingRing *staging, VkDeviceSize budget) {
+    VkDeviceSize row_size = (VkDeviceSize)tex->width * 4;
+    uint32_t max_rows = staging_ring_max_chunk(staging) / row_size;
+    assert(max_rows > 0, "Staging ring too small for a row of texture %s", tex->path);
+
+    VkDeviceSize copied = 0;
+    while (load->rows_uploaded < tex->height && copied < budget) {
+        uint32_t rows = tex->height - load->rows_uploaded;
+        rows = rows < max_rows ? rows : max_rows;
+        // What is left of the budget, at least a row so that wide textures still make progress
+        uint32_t budget_rows = (budget - copied) / row_size;
+        budget_rows = budget_rows > 0 ? budget_rows : 1;
+        rows = rows < budget_rows ? rows : budget_rows;
+
+        VkDeviceSize offset;
+        void *ptr = staging_ring_try_alloc(staging, rows * row_size, 4, &offset);
+        if (ptr == NULL) {
+            break;
+        }
+        if (load->rows_uploaded == 0) {
+            staging_ring_prepare_image(staging, tex->image, tex->mip_levels);
+        }
+        memcpy(ptr, load->buffer.pixels + load->rows_uploaded * row_size, rows * row_size);
+
+        VkBufferImageCopy region = {0};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = (VkOffset3D){0, load->rows_uploaded, 0};
+        region.imageExtent = (VkExtent3D){tex->width, rows, 1};
+        staging_ring_copy_image(staging, offset, tex->image, region);
+
+        load->rows_uploaded += rows;
+        copied += rows * row_size;
+    }
+    return copied;
+}
+
+// Record and submit the generation of the mips of an uploaded texture, from each level to the next, leaving every
+// level in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+static void _texture_loader_generate_mips(TextureLoader *loader, uint32_t index, Texture *tex) {
+    TextureLoad *load = &loader->loads[index];
+    VkCommandBuffer buffer = load->commands;
+
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vk_try(vkResetCommandBuffer(buffer, 0), "Failed to reset texture command buffer");
+    vk_try(vkBeginCommandBuffer(buffer, &begin_info), "Failed to begin texture command buffer");
+
+    if (loader->timestamps != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(buffer, loader->timestamps, index * 2, 2);
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, loader->timestamps, index * 2);
+    }
+
+    VkImageMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = tex->image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    int32_t width = tex->width;
+    int32_t height = tex->height;
+    for (uint32_t level = 1; level < tex->mip_levels; level++) {
+        // The level before is complete, and becomes the source
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(
+            buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier
+        );
+
+        int32_t next_width = width > 1 ? width / 2 : 1;
+        int32_t next_height = height > 1 ? height / 2 : 1;
+        VkImageBlit blit = {0};
+        blit.srcSubresource = (VkImageSubresourceLayers){VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        blit.srcOffsets[1] = (VkOffset3D){width, height, 1};
+        blit.dstSubresource = (VkImageSubresourceLayers){VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        blit.dstOffsets[1] = (VkOffset3D){next_width, next_height, 1};
+        vkCmdBlitImage(
+            buffer,
+            tex->image,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            tex->image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1,
+            &blit,
+            VK_FILTER_LINEAR
+        );
+
+        // Done with the level before
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier
+        );
+
+        width = next_width;
+        height = next_height;
+    }
+
+    // The last level is only ever written to
+    barrier.subresourceRange.baseMipLevel = tex->mip_levels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(
+        buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier
+    );
+
+    if (loader->timestamps != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, loader->timestamps, index * 2 + 1);
+    }
+    vk_try(vkEndCommandBuffer(buffer), "Failed to record texture command buffer");
+
+    load->mip_value = loader->next_value++;
+    VkTimelineSemaphoreSubmitInfo timeline_info = {0};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &load->mip_value;
+
+    VkSubmitInfo submit_info = {0};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &loader->semaphore;
+    vk_try(vkQueueSubmit(loader->graphics_queue, 1, &submit_info, VK_NULL_HANDLE), "Failed to submit texture mips");
+    load->mip_start = timing_now();
+}
+
+// Finish a texture whose mips are generated
+static void _texture_loader_finish(TextureLoader *loader, uint32_t index, Texture *tex) {
+    TextureLoad *load = &loader->loads[index];
+
+    tex->mip_time = timing_now() - load->mip_start;
+    if (loader->timestamps != VK_NULL_HANDLE) {
+        uint64_t ticks[2];
+        VkResult result = vkGetQueryPoolResults(
+            loader->device, loader->timestamps, index * 2, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT
+        );
+        if (result == VK_SUCCESS) {
+            tex->mip_time = ((ticks[1] - ticks[0]) & loader->timestamp_mask) * loader->timestamp_period;
+        }
+    }
+
+    VkImageViewCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    create_info.image = tex->image;
+    create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    create_info.format = TEXTURE_FORMAT;
+    create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    create_info.subresourceRange.baseMipLevel = 0;
+    create_info.subresourceRange.levelCount = tex->mip_levels;
+    create_info.subresourceRange.baseArrayLayer = 0;
+    create_info.subresourceRange.layerCount = 1;
+    vk_try(vkCreateImageView(loader->device, &create_info, NULL, &tex->view), "Failed to create texture view");
+
+    tex->state = TextureReady;
+    load->active = false;
+    loader->loaded++;
+    log_info(
+        "Loaded texture %s (%ux%u, %u levels): decode %.2f ms, upload %.2f ms, mips %.2f ms",
+        tex->path,
+        tex->width,
+        tex->height,
+        tex->mip_levels,
+        tex->decode_time * 1e-6,
+        tex->upload_time * 1e-6,
+        tex->mip_time * 1e-6
+    );
+}
+
+void texture_loader_update(TextureLoader *loader, Allocator *allocator, StagingRing *staging) {
+    uint64_t mips_done;
+    vk_try(vkGetSemaphoreCounterValue(loader->device, loader->semaphore, &mips_done), "Failed to get semaphore value");
+    VkDeviceSize budget = TEXTURE_UPLOAD_BUDGET;
+    bool copied = false;
+
+    for (uint32_t i = 0; i < TEXTURE_MAX_LOADS; i++) {
+        TextureLoad *load = &loader->loads[i];
+        if (!load->active) {
+            continue;
+        }
+        Texture *tex = &loader->textures[load->texture];
+
+        if (tex->state == TextureDecoding && atomic_load_explicit(&load->counter, memory_order_acquire) == 0) {
+            tex->decode_time = load->decode_time;
+            if (load->error != NULL) {
+                log_warn("Failed to load texture %s (%s)", tex->path, load->error);
+                tex->state = TextureFailed;
+                load->active = false;
+                loader->failed++;
+                continue;
+            }
+            _texture_loader_create_image(loader, allocator, tex, &load->buffer);
+            tex->state = TextureUploading;
+            load->rows_uploaded = 0;
+            load->upload_start = timing_now();
+        }
+
+        if (tex->state == TextureUploading && budget > 0) {
+            VkDeviceSize size = _texture_loader_upload(load, tex, staging, budget);
+            budget = size < budget ? budget - size : 0;
+            copied = copied || size > 0;
+            if (load->rows_uploaded == tex->height) {
+                staging_ring_release_image(staging, tex->image, tex->mip_levels);
+                load->upload_value = staging_ring_submit(staging);
+                tex->state = TextureUploaded;
+            }
+        }
+
+        if (tex->state == TextureUploaded && staging_ring_done(staging, load->upload_value)) {
+            tex->upload_time = timing_now() - load->upload_start;
+            _texture_loader_generate_mips(loader, i, tex);
+            tex->state = TextureGeneratingMips;
+        } else if (tex->state == TextureGeneratingMips && mips_done >= load->mip_value) {
+            _texture_loader_finish(loader, i, tex);
+        }
+    }
+
+    // Partial uploads are submitted too, so that their part of the ring is freed
+    if (copied) {
+        staging_ring_submit(staging);
+    }
+
+    // Start the queued textures on the free loads
+    for (uint32_t i = 0; i < TEXTURE_MAX_LOADS && loader->first_queued < loader->count; i++) {
+        TextureLoad *load = &loader->loads[i];
+        if (load->active) {
+            continue;
+        }
+        Texture *tex = &loader->textures[loader->first_queued];
+        tex->state = TextureDecoding;
+        load->active = true;
+        load->texture = loader->first_queued++;
+        load->path = tex->path;
+        load->error = NULL;
+        load->job = (Job){.func = texture_decode, .data = load};
+        job_system_run_background(loader->jobs, &load->job, 1, &load->counter);
+    }
+}
+
+const Texture *texture_loader_get(TextureLoader *loader, TextureHandle handle) {
+    assert(handle < loader->count, "Invalid texture handle %u", handle);
+    Texture *tex = &loader->textures[handle];
+    return tex->state == TextureReady ? tex : NULL;
+}
+
+void texture_loader_drop(TextureLoader loader, Allocator *allocator) {
+    for (uint32_t i = 0; i < TEXTURE_MAX_LOADS; i++) {
+        job_system_wait(loader.jobs, &loader.loads[i].counter);
+        image_buffer_drop(loader.loads[i].buffer);
+    }
+    free(loader.loads);
+
+    for (uint32_t i = 0; i < loader.count; i++) {
+        Texture *tex = &loader.textures[i];
+        if (tex->view != VK_NULL_HANDLE) {
+            vkDestroyImageView(loader.device, tex->view, NULL);
+        }
+        if (tex->image != VK_NULL_HANDLE) {
+            vkDestroyImage(loader.device, tex->image, NULL);
+            allocator_free(allocator, &tex->allocation);
+        }
+        free(tex->path);
+    }
+    free(loader.textures);
+
+    vkDestroySampler(loader.device, loader.sampler, NULL);
+    if (loader.timestamps != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(loader.device, loader.timestamps, NULL);
+    }
+    vkDestroySemaphore(loader.device, loader.semaphore, NULL);
+    // Frees the command buffers
+    vkDestroyCommandPool(loader.device, loader.command_pool, NULL);
+}
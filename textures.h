@@ -0,0 +1,126 @@
+#ifndef TEXTURES_H
+#define TEXTURES_H
+
+#include "allocator.h"
+#include "image.h"
+#include "job.h"
+#include "staging.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Textures loaded at the same time, each load keeps its decode buffers from one texture to the next
+#define TEXTURE_MAX_LOADS 4
+// Pixel data copied to the staging ring per update, so that a big texture doesn't stall a frame
+#define TEXTURE_UPLOAD_BUDGET ((VkDeviceSize)4 << 20)
+#define TEXTURE_FORMAT VK_FORMAT_R8G8B8A8_SRGB
+
+// Index of a texture in its loader
+typedef uint32_t TextureHandle;
+
+typedef enum {
+    // Waiting for a load to be free
+    TextureQueued,
+    // Read and decoded by a background job
+    TextureDecoding,
+    // Copied to the staging ring, over as many updates as needed
+    TextureUploading,
+    // The copies are submitted, and the mips are generated once they are done
+    TextureUploaded,
+    TextureGeneratingMips,
+    TextureReady,
+    TextureFailed,
+} TextureState;
+
+typedef struct {
+    TextureState state;
+    char *path;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    VkImage image;
+    Allocation allocation;
+    // Of every level, created once the texture is ready
+    VkImageView view;
+    // Nanoseconds spent reading and decoding the file (on a background thread), from the first copy to the staging
+    // ring to the upload being done, and generating the mips (measured on the GPU if timestamps are supported)
+    uint64_t decode_time;
+    uint64_t upload_time;
+    uint64_t mip_time;
+} Texture;
+
+// A texture being loaded
+typedef struct {
+    bool active;
+    TextureHandle texture;
+    // Decode job, which sets error (NULL on success) and decode_time
+    const char *path;
+    ImageBuffer buffer;
+    const char *error;
+    uint64_t decode_time;
+    Job job;
+    JobCounter counter;
+    // Rows copied to the staging ring so far, and the staging submission of the last ones
+    uint32_t rows_uploaded;
+    uint64_t upload_start;
+    uint64_t upload_value;
+    // Mip generation, signals the loader's semaphore with mip_value
+    VkCommandBuffer commands;
+    uint64_t mip_start;
+    uint64_t mip_value;
+} TextureLoad;
+
+// Loads textures asynchronously: files are decoded by background jobs, uploaded through the staging ring and get
+// their mip chain generated by blits on the graphics queue. Nothing ever waits on the device or on a job, loads move
+// forward with each update.
+typedef struct {
+    VkDevice device;
+    JobSystem *jobs;
+    VkQueue graphics_queue;
+    // Whether the format supports linear blits, without them textures have a single level
+    bool mipmaps;
+    VkCommandPool command_pool;
+    // Timeline signaled by the mip generation submissions
+    VkSemaphore semaphore;
+    uint64_t next_value;
+    // A start and end timestamp per load (VK_NULL_HANDLE if timestamps aren't supported)
+    VkQueryPool timestamps;
+    double timestamp_period;
+    uint64_t timestamp_mask;
+    // Samples every texture (linear, repeating)
+    VkSampler sampler;
+
+    Texture *textures;
+    uint32_t count;
+    uint32_t cap;
+    // Textures before this one aren't queued anymore
+    uint32_t first_queued;
+    TextureLoad *loads;
+    uint32_t loaded;
+    uint32_t failed;
+} TextureLoader;
+
+// timestamp_period is in nanoseconds per tick (0 if the graphics queue doesn't support timestamps), and
+// timestamp_mask the mask of their valid bits
+TextureLoader texture_loader_init(
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    JobSystem *jobs,
+    VkQueue graphics_queue,
+    uint32_t graphics_family,
+    double timestamp_period,
+    uint64_t timestamp_mask
+);
+// Start loading a PNG, PPM or TGA file (see image_decode), returns right away. The texture can be used once it is
+// returned by texture_loader_get.
+TextureHandle texture_loader_load(TextureLoader *loader, const char *path);
+// Move the loads forward without blocking, should be called regularly (i.e. every frame). Submits the staging ring
+// if anything was copied to it.
+void texture_loader_update(TextureLoader *loader, Allocator *allocator, StagingRing *staging);
+// The texture if it is ready, NULL while it is loading or if it failed to
+const Texture *texture_loader_get(TextureLoader *loader, TextureHandle handle);
+// Waits for the jobs still running, the textures mustn't be in use by the device anymore
+void texture_loader_drop(TextureLoader loader, Allocator *allocator);
+
+#endif
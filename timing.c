@@ -0,0 +1,191 @@
+#include "timing.h"
+
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static const char *STAGE_NAMES[TIMING_STAGE_COUNT] = {
+    [TimingPoll] = "poll",
+    [TimingFenceWait] = "fence wait",
+    [TimingAcquire] = "acquire",
+    [TimingUpdate] = "update",
+    [TimingRecord] = "record",
+    [TimingSubmit] = "submit",
+    [TimingPresent] = "present",
+    [TimingFrame] = "frame",
+};
+
+static const char *GPU_PASS_NAMES[GPU_PASS_COUNT] = {
+    [GpuPassCull] = "gpu cull",
+    [GpuPassMain] = "gpu main",
+};
+
+uint64_t timing_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t histogram_bucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    // Position of the most significant bit, and how much to shift to only keep the sub bucket bits below it
+    uint32_t msb = 63 - __builtin_clzll(value);
+    uint32_t shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Largest value that falls in bucket
+static inline uint64_t histogram_bucket_max(uint32_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void histogram_record(Histogram *hist, uint64_t value) {
+    hist->buckets[histogram_bucket(value)]++;
+    hist->count++;
+    hist->total += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+uint64_t histogram_percentile(const Histogram *hist, double fraction) {
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(fraction * hist->count);
+    if (rank >= hist->count) {
+        rank = hist->count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank) {
+            uint64_t value = histogram_bucket_max(i);
+            // The bucket's bound can overshoot the actual values
+            return value < hist->max ? value : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+void histogram_merge(Histogram *dst, const Histogram *src) {
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->total += src->total;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+void histogram_reset(Histogram *hist) { memset(hist, 0, sizeof(Histogram)); }
+
+FrameTimer frame_timer_init(uint64_t report_interval) {
+    FrameTimer res;
+    memset(&res, 0, sizeof(FrameTimer));
+    res.report_interval = report_interval;
+    res.last_report = timing_now();
+    return res;
+}
+
+void frame_timer_begin(FrameTimer *timer) {
+    timer->frame_start = timing_now();
+    timer->stage_start = timer->frame_start;
+}
+
+void frame_timer_stage(FrameTimer *timer, TimingStage stage) {
+    uint64_t now = timing_now();
+    histogram_record(&timer->window[stage], now - timer->stage_start);
+    timer->stage_start = now;
+}
+
+void frame_timer_skip(FrameTimer *timer) { timer->stage_start = timing_now(); }
+
+void frame_timer_gpu_pass(FrameTimer *timer, GpuPass pass, uint64_t duration) {
+    histogram_record(&timer->gpu_window[pass], duration);
+}
+
+void frame_timer_end(FrameTimer *timer) {
+    uint64_t now = timing_now();
+    histogram_record(&timer->window[TimingFrame], now - timer->frame_start);
+
+    if (timer->report_interval > 0 && now - timer->last_report >= timer->report_interval) {
+        frame_timer_report(timer, false);
+    }
+}
+
+static void log_histogram(const char *name, Histogram *hist) {
+    // Stages that never ran (i.e. acquire and present in headless mode)
+    if (hist->count == 0) {
+        return;
+    }
+    log_info(
+        "    %-12s %8.3f %8.3f %8.3f %8.3f %8.3f",
+        name,
+        (double)hist->total / hist->count * 1e-6,
+        histogram_percentile(hist, 0.50) * 1e-6,
+        histogram_percentile(hist, 0.95) * 1e-6,
+        histogram_percentile(hist, 0.99) * 1e-6,
+        hist->max * 1e-6
+    );
+}
+
+void frame_timer_flush(FrameTimer *timer) {
+    for (uint32_t i = 0; i < TIMING_STAGE_COUNT; i++) {
+        histogram_merge(&timer->total[i], &timer->window[i]);
+        histogram_reset(&timer->window[i]);
+    }
+    for (uint32_t i = 0; i < GPU_PASS_COUNT; i++) {
+        histogram_merge(&timer->gpu_total[i], &timer->gpu_window[i]);
+        histogram_reset(&timer->gpu_window[i]);
+    }
+    timer->last_report = timing_now();
+}
+
+void frame_timer_report(FrameTimer *timer, bool total) {
+    // Fold the current window in the totals, so that they are always up to date when reported
+    for (uint32_t i = 0; i < TIMING_STAGE_COUNT; i++) {
+        histogram_merge(&timer->total[i], &timer->window[i]);
+    }
+    for (uint32_t i = 0; i < GPU_PASS_COUNT; i++) {
+        histogram_merge(&timer->gpu_total[i], &timer->gpu_window[i]);
+    }
+
+    Histogram *hists = total ? timer->total : timer->window;
+    Histogram *gpu_hists = total ? timer->gpu_total : timer->gpu_window;
+
+    if (hists[TimingFrame].count > 0) {
+        log_info(
+            "Frame timings (%s, %lu frames), in ms:", total ? "total" : "recent", (unsigned long)hists[TimingFrame].count
+        );
+        log_info("    %-12s %8s %8s %8s %8s %8s", "stage", "mean", "p50", "p95", "p99", "max");
+        for (uint32_t i = 0; i < TIMING_STAGE_COUNT; i++) {
+            log_histogram(STAGE_NAMES[i], &hists[i]);
+        }
+        for (uint32_t i = 0; i < GPU_PASS_COUNT; i++) {
+            log_histogram(GPU_PASS_NAMES[i], &gpu_hists[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < TIMING_STAGE_COUNT; i++) {
+        histogram_reset(&timer->window[i]);
+    }
+    for (uint32_t i = 0; i < GPU_PASS_COUNT; i++) {
+        histogram_reset(&timer->gpu_window[i]);
+    }
+    timer->last_report = timing_now();
+}
@@ -0,0 +1,84 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Histograms are log-linear: each power of two is split in 2^HISTOGRAM_SUB_BUCKET_BITS buckets, so a recorded
+// duration is known within 1/8th (12.5%) of its value, whatever its magnitude.
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+// Histogram of durations (in nanoseconds)
+typedef struct {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+// The parts of a frame that are timed
+typedef enum {
+    TimingPoll,
+    TimingFenceWait,
+    TimingAcquire,
+    // Per frame CPU work on the scene (i.e. instances)
+    TimingUpdate,
+    TimingRecord,
+    TimingSubmit,
+    TimingPresent,
+    // Whole frame, from the start of polling to the end of presentation
+    TimingFrame,
+    TIMING_STAGE_COUNT,
+} TimingStage;
+
+// The passes timed on the GPU (through timestamp queries)
+typedef enum {
+    GpuPassCull,
+    GpuPassMain,
+    GPU_PASS_COUNT,
+} GpuPass;
+
+// Per frame CPU (and GPU) timings
+typedef struct {
+    // Histograms since the last report
+    Histogram window[TIMING_STAGE_COUNT];
+    // Histograms since the creation of the timer
+    Histogram total[TIMING_STAGE_COUNT];
+    // Same, for the GPU passes
+    Histogram gpu_window[GPU_PASS_COUNT];
+    Histogram gpu_total[GPU_PASS_COUNT];
+    uint64_t frame_start;
+    uint64_t stage_start;
+    uint64_t last_report;
+    // Minimum time between two reports in nanoseconds (0: only report on demand)
+    uint64_t report_interval;
+} FrameTimer;
+
+// Monotonic time in nanoseconds
+uint64_t timing_now();
+
+void histogram_record(Histogram *hist, uint64_t value);
+// Value under which lies the given fraction (0-1) of the recorded values (upper bound of the bucket)
+uint64_t histogram_percentile(const Histogram *hist, double fraction);
+void histogram_merge(Histogram *dst, const Histogram *src);
+void histogram_reset(Histogram *hist);
+
+FrameTimer frame_timer_init(uint64_t report_interval);
+// Start timing a new frame (and its first stage)
+void frame_timer_begin(FrameTimer *timer);
+// End the current stage, recording the time elapsed since the end of the previous one, and start the next
+void frame_timer_stage(FrameTimer *timer, TimingStage stage);
+// Skip the time elapsed since the end of the previous stage (to exclude it from the next one)
+void frame_timer_skip(FrameTimer *timer);
+// Record the GPU time (in nanoseconds) taken by a pass (of a previous frame)
+void frame_timer_gpu_pass(FrameTimer *timer, GpuPass pass, uint64_t duration);
+// End the frame, and log a report if the report interval has elapsed
+void frame_timer_end(FrameTimer *timer);
+// Fold the recent statistics in the totals and start a new window, without logging them
+void frame_timer_flush(FrameTimer *timer);
+// Log the statistics since the last report (or since the start if total is true)
+void frame_timer_report(FrameTimer *timer, bool total);
+
+#endif
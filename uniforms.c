@@ -0,0 +1,100 @@
+#include "uniforms.h"
+
+#include "allocator.h"
+#include "assert.h"
+#include "descriptors.h"
+#include "log.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vulkan/vulkan.h>
+
+UniformRing uniform_ring_init(
+    Allocator *allocator,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    DescriptorLayoutCache *layouts,
+    VkShaderStageFlags stages
+) {
+    UniformRing res = {0};
+    res.device = device;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    // A power of two, at most 256
+    res.alignment = props.limits.minUniformBufferOffsetAlignment;
+
+    VkBufferCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = UNIFORM_RING_REGION_SIZE * UNIFORM_RING_REGIONS;
+    create_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vk_try(vkCreateBuffer(device, &create_info, NULL, &res.buffer), "Failed to create uniform ring");
+    vk_try(allocator_bind_streaming_buffer(allocator, res.buffer, &res.allocation), "Failed to allocate uniform ring memory");
+
+    VkDescriptorSetLayoutBinding binding = {0};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    binding.descriptorCount = 1;
+    binding.stageFlags = stages;
+    res.set_layout = descriptor_layout_cache_get(layouts, &binding, 1);
+
+    // The set lives as long as the ring, every slice is reached through its dynamic offset
+    res.descriptors = descriptor_allocator_init(device, 1);
+    res.set = descriptor_allocator_alloc(&res.descriptors, 0, res.set_layout);
+
+    VkDescriptorBufferInfo buffer_info = {.buffer = res.buffer, .offset = 0, .range = UNIFORM_RING_MAX_SLICE};
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = res.set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+    return res;
+}
+
+void uniform_ring_begin(UniformRing *ring, uint32_t region) {
+    assert(region < UNIFORM_RING_REGIONS, "Uniform ring region %u out of range (%u regions)", region, UNIFORM_RING_REGIONS);
+    ring->region = region;
+    ring->head = 0;
+}
+
+void *uniform_ring_alloc(UniformRing *ring, VkDeviceSize size, uint32_t *dynamic_offset) {
+    assert(size <= UNIFORM_RING_MAX_SLICE, "Uniform slice too big (%lu bytes)", (unsigned long)size);
+    VkDeviceSize offset = (ring->head + ring->alignment - 1) & ~(ring->alignment - 1);
+    // The slice is read as a whole descriptor range, which must fit in the region
+    assert(
+        offset + UNIFORM_RING_MAX_SLICE <= UNIFORM_RING_REGION_SIZE,
+        "Uniform ring region full (%lu bytes)",
+        (unsigned long)UNIFORM_RING_REGION_SIZE
+    );
+    ring->head = offset + size;
+    ring->peak = ring->head > ring->peak ? ring->head : ring->peak;
+    ring->slices++;
+    ring->bytes += size;
+
+    offset += UNIFORM_RING_REGION_SIZE * ring->region;
+    *dynamic_offset = offset;
+    return (uint8_t *)ring->allocation.mapped + offset;
+}
+
+void uniform_ring_log_stats(UniformRing *ring) {
+    log_info(
+        "Uniforms: %lu slices (%lu bytes) allocated, at most %lu of the %lu bytes of a region used",
+        (unsigned long)ring->slices,
+        (unsigned long)ring->bytes,
+        (unsigned long)ring->peak,
+        (unsigned long)UNIFORM_RING_REGION_SIZE
+    );
+}
+
+void uniform_ring_drop(UniformRing ring, Allocator *allocator) {
+    descriptor_allocator_drop(ring.descriptors);
+    vkDestroyBuffer(ring.device, ring.buffer, NULL);
+    allocator_free(allocator, &ring.allocation);
+}
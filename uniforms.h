@@ -0,0 +1,56 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include "allocator.h"
+#include "descriptors.h"
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Regions of the ring (the frames in flight, or the images with cached command buffers)
+#define UNIFORM_RING_REGIONS 16
+#define UNIFORM_RING_REGION_SIZE ((VkDeviceSize)64 << 10)
+// Range of the dynamic descriptor, no slice can be bigger
+#define UNIFORM_RING_MAX_SLICE 256
+
+// A single persistently mapped uniform buffer, split in regions that are each used by one frame at a time. Slices
+// of the current region are bump allocated and bound through the dynamic offset of a single descriptor set, written
+// once: nothing is created or written per draw.
+typedef struct {
+    VkDevice device;
+    // minUniformBufferOffsetAlignment
+    VkDeviceSize alignment;
+    VkBuffer buffer;
+    Allocation allocation;
+    // Owned by the layout cache
+    VkDescriptorSetLayout set_layout;
+    DescriptorAllocator descriptors;
+    VkDescriptorSet set;
+
+    // Region allocated from, and offset of the next slice in it
+    uint32_t region;
+    VkDeviceSize head;
+
+    // Totals since the ring was created, and the most any region had allocated
+    uint64_t slices;
+    uint64_t bytes;
+    VkDeviceSize peak;
+} UniformRing;
+
+// stages are the shader stages the slices are visible to
+UniformRing uniform_ring_init(
+    Allocator *allocator,
+    VkPhysicalDevice physical_device,
+    VkDevice device,
+    DescriptorLayoutCache *layouts,
+    VkShaderStageFlags stages
+);
+// Start allocating from a region, which mustn't be in use by the device anymore (its previous slices are reused)
+void uniform_ring_begin(UniformRing *ring, uint32_t region);
+// Allocate a slice of the current region, returns where to write it, and sets the dynamic offset to bind it with
+void *uniform_ring_alloc(UniformRing *ring, VkDeviceSize size, uint32_t *dynamic_offset);
+void uniform_ring_log_stats(UniformRing *ring);
+// The buffer mustn't be in use by the device anymore
+void uniform_ring_drop(UniformRing ring, Allocator *allocator);
+
+#endif
@@ -1,4 +1,30 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "assert.h"
+#include "vk_enum_string_helper.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// run expr, and assert that the returned VkResult is VK_SUCCESS
+#define vk_try(expr, fmt, ...) \
+    do { \
+        VkResult _res = expr; \
+        assert_eq(_res, VK_SUCCESS, fmt " (%s)", __VA_ARGS__ __VA_OPT__(, ) string_VkResult(_res)); \
+    } while (false)
+// Call expr twice to get an array: once to get the count, then to fill the vector (expr must use count and ptr)
+#define vk_get_vec(vec, expr) \
+    do { \
+        uint32_t _count; \
+        uint32_t *count = &_count; \
+        void *ptr = NULL; \
+        expr; \
+        vec_grow(vec, _count); \
+        ptr = (vec)->data; \
+        expr; \
+        (vec)->len = _count; \
+    } while (false)
+
 #endif